@@ -0,0 +1,288 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * bench.c
+ *
+ * xtrsbench: a headless Z80 throughput benchmark.  It links the whole
+ * emulator with a null frontend, loads the workloads in bench.hex as a
+ * Model I ROM, runs each one through z80_run for a fixed number of
+ * T-states, and prints the host time per emulated instruction and per
+ * T-state and the emulated clock rate as JSON, for tracking
+ * regressions over time.
+ *
+ * Usage: xtrsbench [-m] [-r] [-t tstates] [-w workload] bench.hex
+ *
+ * There is no instruction counter in z80_run, but with the timer off
+ * it calls trs_get_event after exactly x_poll_count+1 instructions,
+ * so we count instructions there.  We also stop the run from there
+ * once the T-state budget is spent, shortening x_poll_count as the
+ * end nears so that long instructions such as ldir do not overshoot
+ * it by much.  A block instruction such as ldir, inir, or otir counts
+ * as one instruction however many bytes it moves, so for the ldir and
+ * hdisk workloads ns_per_instruction depends on the block length;
+ * compare those by ns_per_tstate or emulated_mhz instead.
+ *
+ * The disk workload uses a scratch JV1 image in a temporary directory;
+ * -m accesses it with -diskmmap, and -r with -diskram.  The hdisk
+ * workload uses a small scratch hard disk image in the same directory.
+ */
+
+#define _XOPEN_SOURCE 700 /* mkdtemp(), clock_gettime(), getopt() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "z80.h"
+#include "trs.h"
+#include "trs_disk.h"
+#include "trs_hard.h"
+#include "trs_metrics.h"
+#include "reed.h"
+
+#define DEFAULT_BUDGET 500000000 /* T-states per workload */
+#define JV1_SIZE (35 * 10 * 256)
+#define HARD_CYLS 2  /* of one head of TRS_HARD_SEC_PER_TRK sectors */
+
+int trs_model = 1;
+int trs_paused = 0;
+int trs_autodelay = 0;
+char *program_name;
+
+extern int load_hex(FILE *file);
+
+static struct {
+  char *name;
+  int entry;  /* address in bench.z80's jump table */
+} workloads[] = {
+  { "arith",  0 },
+  { "ldir",   3 },
+  { "interp", 6 },
+  { "disk",   9 },
+  { "scroll", 12 },
+  { "hdisk",  15 },
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static tstate_t stop_at, last_t;
+static unsigned long long insns;
+static int interval;  /* x_poll_count as of the last poll, or -1 */
+
+/* Null frontend */
+
+void
+trs_get_event(int wait)
+{
+  tstate_t remaining, per_insn;
+  int n = interval + 1;
+
+  insns += n;
+  if (z80_state.t_count >= stop_at) {
+    trs_continuous = 0;
+    return;
+  }
+  /* z80_run has just set x_poll_count to its usual interval; ramp
+     up to that from the start, and back down near the end. */
+  remaining = stop_at - z80_state.t_count;
+  per_insn = (z80_state.t_count - last_t) / n + 1;
+  if (2 * interval + 1 < x_poll_count) {
+    x_poll_count = 2 * interval + 1;
+  }
+  if (remaining / per_insn / 2 < x_poll_count) {
+    x_poll_count = remaining / per_insn / 2;
+  }
+  interval = x_poll_count;
+  last_t = z80_state.t_count;
+}
+
+void trs_exit(void) { exit(0); }
+void trs_screen_init(void) { }
+void trs_screen_write_char(int position, int char_index) { }
+void trs_screen_expanded(int flag) { }
+void trs_screen_alternate(int flag) { }
+void trs_screen_80x24(int flag) { }
+void trs_screen_inverse(int flag) { }
+void trs_screen_scroll(void) { }
+void trs_screen_refresh(void) { }
+void trs_screen_overlay(const trs_metrics_rates *r) { }
+void grafyx_write_x(int value) { }
+void grafyx_write_y(int value) { }
+void grafyx_write_data(int value) { }
+int grafyx_read_data(void) { return 0xff; }
+void grafyx_write_mode(int value) { }
+void grafyx_write_xoffset(int value) { }
+void grafyx_write_yoffset(int value) { }
+void grafyx_write_overlay(int value) { }
+void grafyx_set_microlabs(int on_off) { }
+int grafyx_get_microlabs(void) { return 0; }
+void grafyx_m3_reset() { }
+int grafyx_m3_active() { return 0; }
+void grafyx_m3_write_mode(int value) { }
+unsigned char grafyx_m3_read_byte(int position) { return 0xff; }
+int grafyx_m3_write_byte(int position, int value) { return 0; }
+void hrg_onoff(int enable) { }
+void hrg_write_addr(int addr, int mask) { }
+void hrg_write_data(int data) { }
+int hrg_read_data(void) { return 0xff; }
+void trs_get_mouse_pos(int *x, int *y, unsigned int *buttons)
+  { *x = *y = 0; *buttons = 0; }
+void trs_set_mouse_pos(int x, int y) { }
+void trs_get_mouse_max(int *x, int *y, unsigned int *sens)
+  { *x = *y = 0; *sens = 0; }
+void trs_set_mouse_max(int x, int y, unsigned int sens) { }
+int trs_get_mouse_type(void) { return 0; }
+
+static double
+bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Make a scratch disk directory with a blank JV1 image in floppy
+   drive 0 and a small hard disk image in hard drive 0 */
+static char *
+bench_disk(void)
+{
+  static char dir[] = "/tmp/xtrsbenchXXXXXX";
+  char name[sizeof(dir) + 16];
+  ReedHardHeader rhh;
+  Uchar *p;
+  FILE *f;
+  int i;
+
+  if (mkdtemp(dir) == NULL) fatal("could not create %s", dir);
+  sprintf(name, "%s/disk1-0", dir);
+  f = fopen(name, "w");
+  if (f == NULL) fatal("could not create %s", name);
+  for (i = 0; i < JV1_SIZE; i++) putc(i & 0xff, f);
+  fclose(f);
+
+  memset(&rhh, 0, sizeof(rhh));
+  rhh.id1 = 0x56;
+  rhh.id2 = 0xcb;
+  rhh.ver = 0x10;
+  rhh.blks = 1;
+  rhh.crtr = 0x42;
+  rhh.cyl = HARD_CYLS;
+  rhh.sec = TRS_HARD_SEC_PER_TRK;
+  rhh.gran = TRS_HARD_SEC_PER_TRK;
+  rhh.dcyl = 1;
+  for (p = (Uchar *) &rhh, i = 0; i < 32; i++) {
+    if (i != 3) rhh.cksum += p[i];
+  }
+  rhh.cksum ^= 0x4c;
+  sprintf(name, "%s/hard1-0", dir);
+  f = fopen(name, "w");
+  if (f == NULL) fatal("could not create %s", name);
+  fwrite(&rhh, sizeof(rhh), 1, f);
+  for (i = 0; i < HARD_CYLS * TRS_HARD_SEC_PER_TRK * TRS_HARD_SECSIZE; i++) {
+    putc((i + i / TRS_HARD_SECSIZE) & 0xff, f);
+  }
+  fclose(f);
+  return dir;
+}
+
+static void
+bench_run(int w, tstate_t budget, int first)
+{
+  tstate_t t0;
+  double start, secs;
+
+  trs_reset(1);
+  REG_PC = workloads[w].entry;
+  x_poll_count = 0;
+  insns = 0;
+  interval = 0;  /* the first poll comes before the first instruction */
+  t0 = last_t = z80_state.t_count;
+  stop_at = t0 + budget;
+
+  start = bench_now();
+  z80_run(1);
+  secs = bench_now() - start;
+
+  printf("%s    {\"name\": \"%s\", \"instructions\": %llu, "
+	 "\"tstates\": %llu, \"seconds\": %.6f,\n"
+	 "     \"ns_per_instruction\": %.3f, \"ns_per_tstate\": %.3f,\n"
+	 "     \"emulated_mhz\": %.3f, \"speed\": %.3f}",
+	 first ? "" : ",\n", workloads[w].name, insns,
+	 (unsigned long long) (z80_state.t_count - t0), secs,
+	 secs * 1e9 / insns,
+	 secs * 1e9 / (z80_state.t_count - t0),
+	 (z80_state.t_count - t0) / secs / 1e6,
+	 (z80_state.t_count - t0) / secs / 1e6 / z80_state.clockMHz);
+  fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+  tstate_t budget = DEFAULT_BUDGET;
+  char *only = NULL, *dir, name[64];
+  FILE *f;
+  int c, w, first = 1;
+
+  program_name = "xtrsbench";
+  while ((c = getopt(argc, argv, "mrt:w:")) != -1) {
+    switch (c) {
+    case 'm':
+      trs_disk_mmap = 1;
+      break;
+    case 'r':
+      trs_disk_ram = 1;
+      break;
+    case 't':
+      budget = strtoull(optarg, NULL, 0);
+      break;
+    case 'w':
+      only = optarg;
+      break;
+    default:
+      fatal("usage: xtrsbench [-m] [-r] [-t tstates] [-w workload] bench.hex");
+    }
+  }
+  if (optind != argc - 1) {
+    fatal("usage: xtrsbench [-m] [-r] [-t tstates] [-w workload] bench.hex");
+  }
+
+  mem_init();
+  f = fopen(argv[optind], "r");
+  if (f == NULL) fatal("could not read %s", argv[optind]);
+  trs_rom_size = load_hex(f);
+  fclose(f);
+
+  dir = bench_disk();
+  trs_disk_dir = dir;
+  trs_disk_init();
+  trs_hard_init();
+  stringy_init();
+
+  trs_timer_speed(0);
+  printf("{\"budget_tstates\": %llu, \"model\": %d, \"target_mhz\": %.3f,\n"
+	 " \"workloads\": [\n", (unsigned long long) budget, trs_model,
+	 z80_state.clockMHz);
+  for (w = 0; w < NWORKLOADS; w++) {
+    if (only && strcmp(only, workloads[w].name) != 0) continue;
+    bench_run(w, budget, first);
+    first = 0;
+  }
+  printf("\n ]}\n");
+
+  trs_disk_set_name(0, NULL);  /* writes back a -diskram image */
+  sprintf(name, "%s/disk1-0", dir);
+  unlink(name);
+  sprintf(name, "%s/hard1-0", dir);
+  unlink(name);
+  rmdir(dir);
+  return 0;
+}
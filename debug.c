@@ -22,8 +22,15 @@
 
 #include "z80.h"
 #include "trs.h"
+#include "trs_profile.h"
+#include "debug_expr.h"
+#include "trs_trace.h"
+#include "dis.h"
+#include "trs_cover.h"
+#include "trs_heat.h"
 
 #include <stdlib.h>
+#include <ctype.h>
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
@@ -46,12 +53,29 @@
 #define DISASSEMBLE_OFF_FLAG	(0x8)
 #define BREAK_ONCE_FLAG		(0x10)
 #define WATCHPOINT_FLAG		(0x20)
+#define READ_WATCH_FLAG		(0x40)
+#define IN_WATCH_FLAG		(0x80)
+#define OUT_WATCH_FLAG		(0x100)
+
+/* Watchpoints live only in trap_table and the watch bitmaps, not traps[] */
+#define WATCH_FLAGS (WATCHPOINT_FLAG | READ_WATCH_FLAG | \
+		     IN_WATCH_FLAG | OUT_WATCH_FLAG)
+#define PORT_WATCH_FLAGS (IN_WATCH_FLAG | OUT_WATCH_FLAG)
 
 static Uchar *traps;
 static int num_traps;
+static Uchar exec_trap_bitmap[ADDRESS_SPACE / 8];
+static int num_exec_trap_addrs;
+static Uchar watch_read_bitmap[ADDRESS_SPACE / 8];
+static Uchar watch_write_bitmap[ADDRESS_SPACE / 8];
+static Uchar watch_in_bitmap[256 / 8];
+static Uchar watch_out_bitmap[256 / 8];
+static int watch_armed;
 static int print_instructions;
 static int stop_signaled;
-static unsigned int num_watchpoints = 0;
+
+Uchar *mem_watch_reads = NULL, *mem_watch_writes = NULL;
+Uchar *io_watch_ins = NULL, *io_watch_outs = NULL;
 
 static char help_message[] =
 
@@ -96,6 +120,23 @@ Printing:\n\
         Disable tracing.\n\
     diskdump\n\
         Print the state of the floppy disk controller emulation.\n\
+    callprofile\n\
+    callprofile <n>\n\
+        Print the n (default 20) subroutines with the most inclusive\n\
+        T-states, as measured by the -callprofile option.\n\
+    tracedump\n\
+    tracedump <file>\n\
+        Write the instructions recorded by the -tracebuffer option to the\n\
+        -tracefile file or the given file, for decoding with tracedump(1).\n\
+        This also happens whenever execution stops.\n\
+    coverage\n\
+    coverage <file>\n\
+        Write the code coverage recorded by the -coverage option so far to\n\
+        that option's file or the given file.\n\
+    heatmap\n\
+    heatmap <file>\n\
+        Print the memory page and I/O port counts kept by the -heatmap\n\
+        option so far, or write them to the given file.\n\
 Traps:\n\
     status\n\
         Show all traps (breakpoints, tracepoints, watchpoints).\n\
@@ -104,17 +145,34 @@ Traps:\n\
     delete <n>\n\
     delete *\n\
         Delete trap n, or all traps.\n\
-    stop at <address>\n\
-    break <address>\n\
+    stop at <address> [if <condition>]\n\
+    break <address> [if <condition>]\n\
         Set a breakpoint at the specified hex address.\n\
-    trace <address>\n\
+    trace <address> [if <condition>]\n\
         Set a trap to trace execution at the specified hex address.\n\
+    condition <n> [<condition>]\n\
+        Set, replace, or remove the condition on breakpoint or tracepoint n.\n\
+        A trap with a condition fires only when the condition is nonzero.\n\
+        Conditions are C expressions over registers (a, hl, ix, af', ...),\n\
+        flags (zf, cf, sf, pf, hf, nf), memory bytes [addr] and words\n\
+        w[addr], and hits, the number of times the trap has been reached.\n\
+        Numbers are decimal unless prefixed with 0x.  For example:\n\
+        break 4400 if hl==0x4400 && (a&0x80)\n\
     traceon at <address>\n\
         Set a trap to enable tracing at the specified hex address.\n\
     traceoff at <address>\n\
         Set a trap to disable tracing at the specified hex address.\n\
     watch <address>\n\
-        Set a trap to watch specified hex address for changes.\n\
+    watch <start addr> , <end addr>\n\
+        Set a trap to watch the specified hex address or range for changes.\n\
+    rwatch <address>\n\
+    rwatch <start addr> , <end addr>\n\
+        Set a trap to watch for reads from the specified hex address or\n\
+        range, including instruction fetches.\n\
+    iwatch <port>\n\
+    owatch <port>\n\
+        Set a trap to watch for input from or output to the specified hex\n\
+        I/O port.\n\
 Miscellaneous:\n\
     assign $<reg> = <value>\n\
     assign <addr> = <value>\n\
@@ -140,8 +198,10 @@ static struct
 {
     int   valid;
     int   address;
+    int   end;  /* last address or port; used only by watchpoints */
     int   flag;
-    Uchar byte; /* used only by watchpoints */
+    debug_expr *cond;  /* NULL if unconditional */
+    int   hits;  /* times execution has reached the trap */
 } trap_table[MAX_TRAPS];
 
 static char *trap_name(int flag)
@@ -160,11 +220,89 @@ static char *trap_name(int flag)
 	return "temporary breakpoint";
       case WATCHPOINT_FLAG:
 	return "watchpoint";
+      case READ_WATCH_FLAG:
+	return "read watchpoint";
+      case IN_WATCH_FLAG:
+	return "input watchpoint";
+      case OUT_WATCH_FLAG:
+	return "output watchpoint";
       default:
 	return "unknown trap";
     }
 }
 
+/*
+ * Keep exec_trap_bitmap in sync with the traps that fire on execution
+ * (everything but watchpoints) at the given address.  z80_run tests
+ * this bitmap after each instruction, so it can run continuously
+ * until it reaches a trap.
+ */
+static void update_exec_trap(int address)
+{
+    Uchar bit = 1 << (address & 7);
+    int was = (exec_trap_bitmap[address >> 3] & bit) != 0;
+    int is = traps[address] != 0;
+
+    if(is && !was)
+    {
+	exec_trap_bitmap[address >> 3] |= bit;
+	num_exec_trap_addrs++;
+    }
+    else if(was && !is)
+    {
+	exec_trap_bitmap[address >> 3] &= ~bit;
+	num_exec_trap_addrs--;
+    }
+    z80_exec_traps = num_exec_trap_addrs ? exec_trap_bitmap : NULL;
+}
+
+/*
+ * Rebuild the watch bitmaps from the watchpoints in trap_table.  The
+ * memory and I/O access paths test these bitmaps themselves, so
+ * watchpoints do not force the debugger to single-step.
+ */
+static void update_watch_maps()
+{
+    int i, a;
+    Uchar *map;
+
+    memset(watch_read_bitmap, 0, sizeof(watch_read_bitmap));
+    memset(watch_write_bitmap, 0, sizeof(watch_write_bitmap));
+    memset(watch_in_bitmap, 0, sizeof(watch_in_bitmap));
+    memset(watch_out_bitmap, 0, sizeof(watch_out_bitmap));
+    mem_watch_reads = mem_watch_writes = NULL;
+    io_watch_ins = io_watch_outs = NULL;
+
+    for(i = 0; i < MAX_TRAPS; ++i)
+    {
+	if(!trap_table[i].valid) continue;
+	switch(trap_table[i].flag)
+	{
+	  case WATCHPOINT_FLAG:
+	    map = mem_watch_writes = watch_write_bitmap;
+	    break;
+	  case READ_WATCH_FLAG:
+	    map = mem_watch_reads = watch_read_bitmap;
+	    break;
+	  case IN_WATCH_FLAG:
+	    map = io_watch_ins = watch_in_bitmap;
+	    break;
+	  case OUT_WATCH_FLAG:
+	    map = io_watch_outs = watch_out_bitmap;
+	    break;
+	  default:
+	    continue;
+	}
+	a = trap_table[i].address;
+	for(;;)
+	{
+	    map[a >> 3] |= 1 << (a & 7);
+	    if(a == trap_table[i].end) break;
+	    a = (a + 1) % ADDRESS_SPACE;
+	}
+    }
+}
+
 static void show_zbxinfo()
 {
     printf("zbx: Z80 debugger by David Gingold, Alex Wolman, and Timothy"
@@ -187,12 +325,18 @@ static void clear_all_traps()
     {
 	if(trap_table[i].valid)
 	{
-	    traps[trap_table[i].address] &= ~(trap_table[i].flag);
+	    if(!(trap_table[i].flag & WATCH_FLAGS))
+	    {
+		traps[trap_table[i].address] &= ~(trap_table[i].flag);
+		update_exec_trap(trap_table[i].address);
+	    }
 	    trap_table[i].valid = 0;
+	    debug_expr_free(trap_table[i].cond);
+	    trap_table[i].cond = NULL;
 	}
     }
     num_traps = 0;
-    num_watchpoints = 0;
+    update_watch_maps();
 }
 
 static void print_traps()
@@ -205,8 +349,33 @@ static void print_traps()
 	{
 	    if(trap_table[i].valid)
 	    {
-		printf("[%d] %.4x (%s)\n", i, trap_table[i].address,
-		       trap_name(trap_table[i].flag));
+		if(trap_table[i].flag & PORT_WATCH_FLAGS)
+		{
+		    printf("[%d] port %.2x (%s)\n", i, trap_table[i].address,
+			   trap_name(trap_table[i].flag));
+		}
+		else if((trap_table[i].flag & WATCH_FLAGS) &&
+			trap_table[i].end != trap_table[i].address)
+		{
+		    printf("[%d] %.4x-%.4x (%s)\n", i, trap_table[i].address,
+			   trap_table[i].end, trap_name(trap_table[i].flag));
+		}
+		else
+		{
+		    printf("[%d] %.4x (%s", i, trap_table[i].address,
+			   trap_name(trap_table[i].flag));
+		    if(trap_table[i].hits)
+		    {
+			printf(", %d hit%s", trap_table[i].hits,
+			       trap_table[i].hits == 1 ? "" : "s");
+		    }
+		    printf(")");
+		    if(trap_table[i].cond)
+		    {
+			printf(" if %s", debug_expr_text(trap_table[i].cond));
+		    }
+		    printf("\n");
+		}
 	    }
 	}
     }
@@ -216,13 +385,14 @@ static void print_traps()
     }
 }
 
-static void set_trap(int address, int flag)
+static void set_trap_range(int address, int end, int flag, debug_expr *cond)
 {
     int i;
 
     if(num_traps == MAX_TRAPS)
     {
 	printf("Cannot set more than %d traps.\n", MAX_TRAPS);
+	debug_expr_free(cond);
     }
     else
     {
@@ -231,20 +401,101 @@ static void set_trap(int address, int flag)
 	
 	trap_table[i].valid = 1;
 	trap_table[i].address = address;
+	trap_table[i].end = end;
 	trap_table[i].flag = flag;
-	if (trap_table[i].flag == WATCHPOINT_FLAG) {
-	    /* Initialize the byte field to current memory contents. */
-	    trap_table[i].byte = mem_read(address);
-	    /* Increment number of set watchpoints. */
-	    num_watchpoints++;
+	trap_table[i].cond = cond;
+	trap_table[i].hits = 0;
+	if(flag & WATCH_FLAGS)
+	{
+	    update_watch_maps();
+	}
+	else
+	{
+	    traps[address] |= flag;
+	    update_exec_trap(address);
 	}
-	traps[address] |= flag;
 	num_traps++;
 
-	printf("Set %s [%d] at %.4x\n", trap_name(flag), i, address);
+	if(flag & PORT_WATCH_FLAGS)
+	{
+	    printf("Set %s [%d] at port %.2x\n", trap_name(flag), i, address);
+	}
+	else if(end != address)
+	{
+	    printf("Set %s [%d] at %.4x-%.4x\n", trap_name(flag), i,
+		   address, end);
+	}
+	else if(cond)
+	{
+	    printf("Set %s [%d] at %.4x if %s\n", trap_name(flag), i, address,
+		   debug_expr_text(cond));
+	}
+	else
+	{
+	    printf("Set %s [%d] at %.4x\n", trap_name(flag), i, address);
+	}
     }
 }
 
+static void set_trap(int address, int flag)
+{
+    set_trap_range(address, address, flag, NULL);
+}
+
+/*
+ * Split the "if <condition>" clause off the end of a trap command and
+ * compile it.  Returns 0 after reporting a syntax error; otherwise
+ * returns 1, with *cond set to the condition, or NULL if none.
+ */
+static int parse_condition(char *input, debug_expr **cond)
+{
+    char *p;
+    const char *err;
+    int len;
+
+    *cond = NULL;
+    p = strstr(input, " if ");
+    if(p == NULL) return 1;
+    *p = '\0';
+    p += 4;
+    len = strlen(p);
+    while(len > 0 && isspace((unsigned char) p[len - 1])) p[--len] = '\0';
+    *cond = debug_expr_compile(p, &err);
+    if(*cond == NULL)
+    {
+	printf("Bad condition: %s.\n", err);
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ * Return the flags of the execution traps at the given address whose
+ * conditions are true.  If counting, execution has just arrived at
+ * the address, so first count a hit on each trap there; the count is
+ * available to conditions as "hits".
+ */
+static int trap_hits(int address, int counting)
+{
+    int i, t = 0;
+
+    if(traps[address] == 0) return 0;
+    for(i = 0; i < MAX_TRAPS; ++i)
+    {
+	if(trap_table[i].valid && trap_table[i].address == address &&
+	   !(trap_table[i].flag & WATCH_FLAGS))
+	{
+	    if(counting) trap_table[i].hits++;
+	    if(trap_table[i].cond == NULL ||
+	       debug_expr_eval(trap_table[i].cond, trap_table[i].hits))
+	    {
+		t |= trap_table[i].flag;
+	    }
+	}
+    }
+    return t;
+}
+
 static void clear_trap(int i)
 {
     if((i < 0) || (i > MAX_TRAPS) || !trap_table[i].valid)
@@ -253,11 +504,29 @@ static void clear_trap(int i)
     }
     else
     {
-	traps[trap_table[i].address] &= ~(trap_table[i].flag);
+	int j;
+
 	trap_table[i].valid = 0;
-	if (trap_table[i].flag == WATCHPOINT_FLAG) {
-	    /* Decrement number of set watchpoints. */
-	    num_watchpoints--;
+	debug_expr_free(trap_table[i].cond);
+	trap_table[i].cond = NULL;
+	if(trap_table[i].flag & WATCH_FLAGS)
+	{
+	    update_watch_maps();
+	}
+	else
+	{
+	    /* Another trap of the same kind may remain at this address */
+	    traps[trap_table[i].address] &= ~(trap_table[i].flag);
+	    for(j = 0; j < MAX_TRAPS; ++j)
+	    {
+		if(trap_table[j].valid &&
+		   trap_table[j].address == trap_table[i].address &&
+		   !(trap_table[j].flag & WATCH_FLAGS))
+		{
+		    traps[trap_table[j].address] |= trap_table[j].flag;
+		}
+	    }
+	    update_exec_trap(trap_table[i].address);
 	}
 	num_traps--;
 	printf("Cleared %s [%d] at %.4x\n",
@@ -271,6 +540,7 @@ static void clear_trap_address(int address, int flag)
     for(i = 0; i < MAX_TRAPS; ++i)
     {
 	if(trap_table[i].valid && (trap_table[i].address == address)
+	   && !(trap_table[i].flag & PORT_WATCH_FLAGS)
 	   && ((flag == 0) || (trap_table[i].flag == flag)))
 	{
 	    clear_trap(i);
@@ -278,6 +548,27 @@ static void clear_trap_address(int address, int flag)
     }
 }
 
+/* Print the instruction at pc; returns the address of the next one */
+int disassemble(unsigned short pc)
+{
+    dis_insn insn;
+    Uchar bytes[4];
+    char text[40];
+    int	i;
+
+    for (i = 0; i < 4; i++)
+	bytes[i] = mem_read((pc + i) & 0xffff);
+    dis_decode(bytes, pc, &insn);
+    dis_format(&insn, text, sizeof(text), NULL, NULL);
+    printf ("%04x  ", pc);
+    for (i = 0; i < insn.length; i++)
+        printf("%02x ", bytes[i]);
+    for (; i < 4; i++)
+	printf("   ");
+    printf(" %s\n", text);
+    return (pc + insn.length) & 0xffff;
+}
+
 void debug_print_registers()
 {
     printf("\n       S Z - H - PV N C   IFF1 IFF2 IM\n");
@@ -321,6 +612,96 @@ void trs_debug()
     trs_skip_next_kbwait();
 }
 
+/*
+ * Called from the memory and I/O access paths when they touch a
+ * watched address or port.  Watchpoints are armed only while the
+ * debugger is running the Z80, so the debugger's own accesses (for
+ * printing memory, disassembling, and so on) do not trigger them.
+ * The writing PC is z80_state.instr_pc, the start of the instruction.
+ */
+void debug_watch_mem(int address, int value, int writing)
+{
+    Uchar *p;
+
+    if(!watch_armed) return;
+    if(writing)
+    {
+	p = mem_pointer(address, 1);
+	if(p != NULL)
+	{
+	    if(*p == (value & 0xff)) return;
+	    printf("Memory location 0x%.4x changed value from 0x%.2x to "
+		   "0x%.2x (pc %.4x).\n", address, *p, value & 0xff,
+		   z80_state.instr_pc);
+	}
+	else
+	{
+	    printf("Memory location 0x%.4x written with 0x%.2x (pc %.4x).\n",
+		   address, value & 0xff, z80_state.instr_pc);
+	}
+    }
+    else
+    {
+	p = mem_pointer(address, 0);
+	if(p != NULL)
+	{
+	    printf("Memory location 0x%.4x read 0x%.2x (pc %.4x).\n",
+		   address, *p, z80_state.instr_pc);
+	}
+	else
+	{
+	    printf("Memory location 0x%.4x read (pc %.4x).\n",
+		   address, z80_state.instr_pc);
+	}
+    }
+    trs_debug();
+}
+
+/*
+ * Called by emulator traps that move a block of bytes between guest
+ * memory and the host without going through mem_read or mem_write.
+ */
+void debug_watch_block(int address, int count, int writing)
+{
+    Uchar *map = writing ? mem_watch_writes : mem_watch_reads;
+    int i, a, first = -1, hits = 0;
+
+    if(!watch_armed || map == NULL) return;
+    for(i = 0; i < count; i++)
+    {
+	a = (address + i) % ADDRESS_SPACE;
+	if(WATCHED(map, a))
+	{
+	    if(first < 0) first = a;
+	    hits++;
+	}
+    }
+    if(hits == 0) return;
+    printf("Emulator trap %s %d watched byte%s from 0x%.4x (pc %.4x).\n",
+	   writing ? "wrote" : "read", hits, hits == 1 ? "" : "s", first,
+	   z80_state.instr_pc);
+    trs_debug();
+}
+
+void debug_watch_io(int port, int value, int output)
+{
+    if(!watch_armed) return;
+    printf("Port 0x%.2x %s 0x%.2x (pc %.4x).\n", port,
+	   output ? "output" : "input", value & 0xff, z80_state.instr_pc);
+    trs_debug();
+}
+
+/* Run the Z80 with watchpoints armed. */
+static int debug_z80_run(int continuous)
+{
+    int ret;
+
+    watch_armed = 1;
+    ret = z80_run(continuous);
+    watch_armed = 0;
+    return ret;
+}
+
 void debug_init()
 {
     int i;
@@ -371,21 +752,32 @@ static void print_memory(Ushort address, int num_bytes)
     }
 }
 
+static void write_trace(char *filename)
+{
+    int n = trs_trace_dump(filename);
+
+    if(n < 0)
+    {
+	printf("Cannot write trace to %s: %s\n", filename, strerror(errno));
+    }
+    else
+    {
+	printf("Wrote %d traced instructions to %s\n", n, filename);
+    }
+}
+
 static void debug_run()
 {
     void (*old_signal_handler)();
     Uchar t;
-    Uchar byte;
     int continuous;
-    int i;
-    int watch_triggered = 0;
 
     /* catch control-c signal */
     old_signal_handler = signal(SIGINT, signal_handler);
 
     stop_signaled = 0;
 
-    t = traps[REG_PC];
+    t = trap_hits(REG_PC, 0);
     while(!stop_signaled)
     {
 	if(t)
@@ -407,13 +799,18 @@ static void debug_run()
 	
 	if(print_instructions) disassemble(REG_PC);
 	
-	continuous = (!print_instructions && num_traps == 0);
-	if (z80_run(continuous)) {
+	/*
+	 * Breakpoints and other execution traps do not need
+	 * single-stepping; z80_run stops by itself on reaching one,
+	 * and watchpoints stop it from the memory and I/O paths.
+	 */
+	continuous = !print_instructions;
+	if (debug_z80_run(continuous)) {
 	  printf("emt_debug instruction executed.\n");
 	  stop_signaled = 1;
 	}
 
-	t = traps[REG_PC];
+	t = trap_hits(REG_PC, 1);
 	if(t & BREAKPOINT_FLAG)
 	{
 	    stop_signaled = 1;
@@ -423,45 +820,10 @@ static void debug_run()
 	    stop_signaled = 1;
 	    clear_trap_address(REG_PC, BREAK_ONCE_FLAG);
 	}
-
-	/*
-	 * Iterate over the trap list looking for watchpoints only if we
-	 * know there are any to be found.
-	 */
-	if (num_watchpoints)
-	{
-	    for (i = 0; i < MAX_TRAPS; ++i)
-	    {
-		if (trap_table[i].valid &&
-		    trap_table[i].flag == WATCHPOINT_FLAG)
-		{
-		    byte = mem_read(trap_table[i].address);
-		    if (byte != trap_table[i].byte)
-		    {
-			/*
-			 * If a watched memory location has changed, report
-			 * it, update the watch entry in the trap table to
-			 * reflect the new value, and set the
-			 * watch_triggered flag so that we stop after all
-			 * watchpoints have been processed.
-			 */
-			printf("Memory location 0x%.4x changed value from "
-			       "0x%.2x to 0x%.2x.\n", trap_table[i].address,
-			       trap_table[i].byte, byte);
-			trap_table[i].byte = byte;
-			watch_triggered = 1;
-		    }
-		}
-	    }
-	    if (watch_triggered)
-	    {
-		stop_signaled = 1;
-	    }
-	}
-
     }
     signal(SIGINT, old_signal_handler);
     printf("Stopped at %.4x\n", REG_PC);
+    if(trs_trace_ring) write_trace(trs_trace_file);
 }
 
 void debug_shell()
@@ -647,7 +1009,7 @@ void debug_shell()
 		    set_trap((REG_PC + 1) % ADDRESS_SPACE, BREAK_ONCE_FLAG);
 		    debug_run();
 		} else {
-		    z80_run((!strcmp(command, "nextint")) ? 0 : -1);
+		    debug_z80_run((!strcmp(command, "nextint")) ? 0 : -1);
 		}
 	    }
 	    else if(!strcmp(command, "quit"))
@@ -738,34 +1100,83 @@ void debug_shell()
 	    }
 	    else if(!strcmp(command, "step"))
 	    {
-		z80_run(-1);
+		debug_z80_run(-1);
 	    }
 	    else if(!strcmp(command, "stepint"))
 	    {
-		z80_run(0);
+		debug_z80_run(0);
 	    }
 	    else if(!strcmp(command, "stop") || !strcmp(command, "break"))
 	    {
 		int address;
+		debug_expr *cond;
 
+		if(!parse_condition(input, &cond)) continue;
 		if(sscanf(input, "stop at %x", &address) != 1 &&
 		   sscanf(input, "break %x", &address) != 1)
 		{
 		    address = REG_PC;
 		}
 		address %= ADDRESS_SPACE;
-		set_trap(address, BREAKPOINT_FLAG);
+		set_trap_range(address, address, BREAKPOINT_FLAG, cond);
 	    }
 	    else if(!strcmp(command, "trace"))
 	    {
 		int address;
+		debug_expr *cond;
 
+		if(!parse_condition(input, &cond)) continue;
 		if(sscanf(input, "trace %x", &address) != 1)
 		{
 		    address = REG_PC;
 		}
 		address %= ADDRESS_SPACE;
-		set_trap(address, TRACE_FLAG);
+		set_trap_range(address, address, TRACE_FLAG, cond);
+	    }
+	    else if(!strcmp(command, "condition"))
+	    {
+		int i, n = 0, len;
+		char *text;
+		debug_expr *cond;
+		const char *err;
+
+		if(sscanf(input, "condition %d %n", &i, &n) < 1 || n == 0)
+		{
+		    printf("A trap must be specified.\n");
+		    continue;
+		}
+		if(i < 0 || i >= MAX_TRAPS || !trap_table[i].valid ||
+		   (trap_table[i].flag & WATCH_FLAGS))
+		{
+		    printf("[%d] is not a valid breakpoint or tracepoint.\n", i);
+		    continue;
+		}
+		text = input + n;
+		len = strlen(text);
+		while(len > 0 && isspace((unsigned char) text[len - 1]))
+		{
+		    text[--len] = '\0';
+		}
+		if(len == 0)
+		{
+		    cond = NULL;
+		}
+		else if((cond = debug_expr_compile(text, &err)) == NULL)
+		{
+		    printf("Bad condition: %s.\n", err);
+		    continue;
+		}
+		debug_expr_free(trap_table[i].cond);
+		trap_table[i].cond = cond;
+		trap_table[i].hits = 0;
+		if(cond)
+		{
+		    printf("Trap [%d] now has condition %s\n", i, text);
+		}
+		else
+		{
+		    printf("Trap [%d] is now unconditional.\n", i);
+		}
 	    }
 	    else if(!strcmp(command, "untrace"))
 	    {
@@ -801,14 +1212,44 @@ void debug_shell()
 	    }
 	    else if(!strcmp(command, "watch"))
 	    {
-		int address;
+		int address, end;
 
-		if(sscanf(input, "watch %x", &address) == 1)
+		if(sscanf(input, "watch %x , %x", &address, &end) == 2)
+		{
+		    set_trap_range(address % ADDRESS_SPACE, end % ADDRESS_SPACE,
+				   WATCHPOINT_FLAG, NULL);
+		}
+		else if(sscanf(input, "watch %x", &address) == 1)
 		{
 		    address %= ADDRESS_SPACE;
 		    set_trap(address, WATCHPOINT_FLAG);
 		}
 	    }
+	    else if(!strcmp(command, "rwatch"))
+	    {
+		int address, end;
+
+		if(sscanf(input, "rwatch %x , %x", &address, &end) == 2)
+		{
+		    set_trap_range(address % ADDRESS_SPACE, end % ADDRESS_SPACE,
+				   READ_WATCH_FLAG, NULL);
+		}
+		else if(sscanf(input, "rwatch %x", &address) == 1)
+		{
+		    address %= ADDRESS_SPACE;
+		    set_trap(address, READ_WATCH_FLAG);
+		}
+	    }
+	    else if(!strcmp(command, "iwatch") || !strcmp(command, "owatch"))
+	    {
+		int port;
+
+		if(sscanf(input, "%*s %x", &port) == 1)
+		{
+		    set_trap(port & 0xff, (command[0] == 'i') ?
+			     IN_WATCH_FLAG : OUT_WATCH_FLAG);
+		}
+	    }
 	    else if(!strcmp(command, "timeroff"))
 	    {
 	        /* Turn off emulated real time clock interrupt */
@@ -823,6 +1264,87 @@ void debug_shell()
 	    {
 		trs_disk_debug();
 	    }
+	    else if(!strcmp(command, "callprofile"))
+	    {
+		int lines = 20;
+		sscanf(input, "callprofile %d", &lines);
+		trs_prof_calls_report(stdout, lines);
+	    }
+	    else if(!strcmp(command, "tracedump"))
+	    {
+		char filename[MAXLINE];
+
+		if(!trs_trace_ring)
+		{
+		    printf("The -tracebuffer option is not enabled.\n");
+		}
+		else if(sscanf(input, "tracedump %s", filename) == 1)
+		{
+		    write_trace(filename);
+		}
+		else
+		{
+		    write_trace(trs_trace_file);
+		}
+	    }
+	    else if(!strcmp(command, "coverage"))
+	    {
+		char filename[MAXLINE];
+		char *name = trs_cover_file;
+		FILE *f;
+
+		if(!trs_cover_map)
+		{
+		    printf("The -coverage option is not enabled.\n");
+		}
+		else
+		{
+		    if(sscanf(input, "coverage %s", filename) == 1)
+		    {
+			name = filename;
+		    }
+		    f = fopen(name, "w");
+		    if(f == NULL)
+		    {
+			printf("Cannot write coverage to %s: %s\n",
+			       name, strerror(errno));
+		    }
+		    else
+		    {
+			trs_cover_dump(f);
+			fclose(f);
+			printf("Wrote coverage to %s\n", name);
+		    }
+		}
+	    }
+	    else if(!strcmp(command, "heatmap"))
+	    {
+		char filename[MAXLINE];
+		FILE *f;
+
+		if(!trs_heat_on)
+		{
+		    printf("The -heatmap option is not enabled.\n");
+		}
+		else if(sscanf(input, "heatmap %s", filename) == 1)
+		{
+		    f = fopen(filename, "w");
+		    if(f == NULL)
+		    {
+			printf("Cannot write heat map to %s: %s\n",
+			       filename, strerror(errno));
+		    }
+		    else
+		    {
+			trs_heat_dump(f);
+			fclose(f);
+		    }
+		}
+		else
+		{
+		    trs_heat_dump(stdout);
+		}
+	    }
 	    else if(!strcmp(command, "diskdebug"))
 	    {
 		trs_disk_debug_flags = 0;
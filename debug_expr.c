@@ -0,0 +1,413 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * debug_expr.c
+ *
+ * Conditions for zbx breakpoints and tracepoints.  A condition is a
+ * C-style integer expression over the Z80 registers, the flags,
+ * memory, and the trap's hit count, for example
+ *
+ *     hl == 0x4400 && (a & 0x80)
+ *     hits >= 10000 && [0x4020] != 0
+ *
+ * The text is parsed once, when the trap is set, into postfix code
+ * for a small stack machine, so evaluating it each time the trap's
+ * address is reached costs no parsing or name lookup.
+ *
+ * Numbers are decimal unless prefixed with 0x.  [x] is the byte at
+ * address x and w[x] the little-endian word.  Register names are
+ * those of the Z80 (a, hl, ix, af', ...); zf, cf, sf, pf (or vf),
+ * hf, and nf are the flags; iff1, iff2, and im are the interrupt
+ * state.  Memory is read with mem_pointer, so evaluating a condition
+ * never has side effects on memory-mapped devices; unmapped and
+ * device addresses read as 0xff.
+ */
+
+#define _XOPEN_SOURCE 500 /* string.h: strdup() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> /* strncasecmp() */
+#include <ctype.h>
+
+#include "z80.h"
+#include "trs.h"
+#include "debug_expr.h"
+
+#define EXPR_MAX_CODE  256
+#define EXPR_MAX_STACK 32
+
+enum {
+  OP_CONST, OP_VAR, OP_PEEK, OP_PEEKW,
+  OP_NEG, OP_NOT, OP_COM,
+  OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+  OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+  OP_AND, OP_XOR, OP_OR, OP_LAND, OP_LOR
+};
+
+enum {
+  V_A, V_F, V_B, V_C, V_D, V_E, V_H, V_L,
+  V_AF, V_BC, V_DE, V_HL, V_IX, V_IY, V_SP, V_PC,
+  V_AF_PRIME, V_BC_PRIME, V_DE_PRIME, V_HL_PRIME,
+  V_IXH, V_IXL, V_IYH, V_IYL, V_I,
+  V_ZF, V_CF, V_SF, V_PF, V_HF, V_NF,
+  V_IFF1, V_IFF2, V_IM, V_HITS
+};
+
+static const struct {
+  const char *name;
+  int var;
+} vars[] = {
+  { "af'", V_AF_PRIME }, { "bc'", V_BC_PRIME },
+  { "de'", V_DE_PRIME }, { "hl'", V_HL_PRIME },
+  { "a", V_A }, { "f", V_F }, { "b", V_B }, { "c", V_C },
+  { "d", V_D }, { "e", V_E }, { "h", V_H }, { "l", V_L },
+  { "af", V_AF }, { "bc", V_BC }, { "de", V_DE }, { "hl", V_HL },
+  { "ix", V_IX }, { "iy", V_IY }, { "sp", V_SP }, { "pc", V_PC },
+  { "ixh", V_IXH }, { "ixl", V_IXL }, { "iyh", V_IYH }, { "iyl", V_IYL },
+  { "i", V_I },
+  { "zf", V_ZF }, { "cf", V_CF }, { "sf", V_SF }, { "pf", V_PF },
+  { "vf", V_PF }, { "hf", V_HF }, { "nf", V_NF },
+  { "iff1", V_IFF1 }, { "iff2", V_IFF2 }, { "im", V_IM },
+  { "hits", V_HITS },
+};
+
+/* Binary operators; where one token is a prefix of another, the
+ * longer one must come first. */
+static const struct {
+  const char *tok;
+  int op;
+  int level;  /* precedence, lowest first, as in C */
+} binops[] = {
+  { "||", OP_LOR, 0 }, { "&&", OP_LAND, 1 },
+  { "|", OP_OR, 2 }, { "^", OP_XOR, 3 }, { "&", OP_AND, 4 },
+  { "==", OP_EQ, 5 }, { "!=", OP_NE, 5 },
+  { "<=", OP_LE, 6 }, { ">=", OP_GE, 6 },
+  { "<<", OP_SHL, 7 }, { ">>", OP_SHR, 7 },
+  { "<", OP_LT, 6 }, { ">", OP_GT, 6 },
+  { "+", OP_ADD, 8 }, { "-", OP_SUB, 8 },
+  { "*", OP_MUL, 9 }, { "/", OP_DIV, 9 }, { "%", OP_MOD, 9 },
+};
+#define NBINOPS (sizeof(binops) / sizeof(binops[0]))
+#define MAX_LEVEL 9
+
+struct debug_expr {
+  char *text;
+  int ncode;
+  int *code;
+};
+
+/* Compiler state */
+static const char *cp;
+static const char *cerr;
+static int ccode[EXPR_MAX_CODE];
+static int cn, cdepth;
+
+static void parse_binary(int level);
+
+static void
+skip_space(void)
+{
+  while (isspace((unsigned char) *cp)) cp++;
+}
+
+static void
+emit(int op, int arg)
+{
+  if (cerr) return;
+  if (cn + 2 > EXPR_MAX_CODE) {
+    cerr = "condition too long";
+    return;
+  }
+  ccode[cn++] = op;
+  switch (op) {
+  case OP_CONST:
+  case OP_VAR:
+    ccode[cn++] = arg;
+    cdepth++;
+    break;
+  case OP_PEEK: case OP_PEEKW: case OP_NEG: case OP_NOT: case OP_COM:
+    break;
+  default:
+    cdepth--;
+    break;
+  }
+  if (cdepth > EXPR_MAX_STACK) cerr = "condition nested too deeply";
+}
+
+static void
+parse_primary(void)
+{
+  int i, len;
+
+  skip_space();
+  if (*cp == '(') {
+    cp++;
+    parse_binary(0);
+    skip_space();
+    if (*cp != ')') {
+      if (!cerr) cerr = "missing )";
+      return;
+    }
+    cp++;
+  } else if (*cp == '[' || ((*cp == 'w' || *cp == 'W') && cp[1] == '[')) {
+    int word = (*cp != '[');
+    cp += word + 1;
+    parse_binary(0);
+    skip_space();
+    if (*cp != ']') {
+      if (!cerr) cerr = "missing ]";
+      return;
+    }
+    cp++;
+    emit(word ? OP_PEEKW : OP_PEEK, 0);
+  } else if (isdigit((unsigned char) *cp)) {
+    char *end;
+    long val;
+    if (cp[0] == '0' && (cp[1] == 'x' || cp[1] == 'X')) {
+      val = strtol(cp + 2, &end, 16);
+      if (end == cp + 2) {
+	cerr = "bad hex number";
+	return;
+      }
+    } else {
+      val = strtol(cp, &end, 10);
+    }
+    cp = end;
+    emit(OP_CONST, (int) val);
+  } else if (isalpha((unsigned char) *cp)) {
+    len = 0;
+    while (isalnum((unsigned char) cp[len]) || cp[len] == '_') len++;
+    if (cp[len] == '\'') len++;
+    for (i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+      if (strlen(vars[i].name) == len &&
+	  strncasecmp(vars[i].name, cp, len) == 0) break;
+    }
+    if (i == sizeof(vars) / sizeof(vars[0])) {
+      cerr = "unknown name";
+      return;
+    }
+    cp += len;
+    emit(OP_VAR, vars[i].var);
+  } else {
+    if (!cerr) cerr = (*cp == '\0') ? "unexpected end" : "syntax error";
+  }
+}
+
+static void
+parse_unary(void)
+{
+  skip_space();
+  switch (*cp) {
+  case '-':
+    cp++;
+    parse_unary();
+    emit(OP_NEG, 0);
+    break;
+  case '!':
+    cp++;
+    parse_unary();
+    emit(OP_NOT, 0);
+    break;
+  case '~':
+    cp++;
+    parse_unary();
+    emit(OP_COM, 0);
+    break;
+  case '+':
+    cp++;
+    parse_unary();
+    break;
+  default:
+    parse_primary();
+    break;
+  }
+}
+
+/* Return the index of the binary operator at cp, or -1 */
+static int
+peek_binop(void)
+{
+  int i;
+  skip_space();
+  for (i = 0; i < NBINOPS; i++) {
+    if (strncmp(cp, binops[i].tok, strlen(binops[i].tok)) == 0) return i;
+  }
+  return -1;
+}
+
+static void
+parse_binary(int level)
+{
+  int i;
+
+  if (level > MAX_LEVEL) {
+    parse_unary();
+    return;
+  }
+  parse_binary(level + 1);
+  while (!cerr && (i = peek_binop()) >= 0 && binops[i].level == level) {
+    cp += strlen(binops[i].tok);
+    parse_binary(level + 1);
+    emit(binops[i].op, 0);
+  }
+}
+
+debug_expr *
+debug_expr_compile(const char *text, const char **err)
+{
+  debug_expr *e;
+
+  cp = text;
+  cerr = NULL;
+  cn = cdepth = 0;
+  parse_binary(0);
+  skip_space();
+  if (!cerr && *cp != '\0') cerr = "syntax error";
+  if (cerr) {
+    *err = cerr;
+    return NULL;
+  }
+
+  e = (debug_expr *) malloc(sizeof(debug_expr));
+  e->text = strdup(text);
+  e->ncode = cn;
+  e->code = (int *) malloc(cn * sizeof(int));
+  memcpy(e->code, ccode, cn * sizeof(int));
+  return e;
+}
+
+static int
+peek(int address)
+{
+  Uchar *p = mem_pointer(address & 0xffff, 0);
+  return p ? *p : 0xff;
+}
+
+static int
+var_value(int var, int hits)
+{
+  switch (var) {
+  case V_A: return REG_A;
+  case V_F: return REG_F;
+  case V_B: return REG_B;
+  case V_C: return REG_C;
+  case V_D: return REG_D;
+  case V_E: return REG_E;
+  case V_H: return REG_H;
+  case V_L: return REG_L;
+  case V_AF: return REG_AF;
+  case V_BC: return REG_BC;
+  case V_DE: return REG_DE;
+  case V_HL: return REG_HL;
+  case V_IX: return REG_IX;
+  case V_IY: return REG_IY;
+  case V_SP: return REG_SP;
+  case V_PC: return REG_PC;
+  case V_AF_PRIME: return REG_AF_PRIME;
+  case V_BC_PRIME: return REG_BC_PRIME;
+  case V_DE_PRIME: return REG_DE_PRIME;
+  case V_HL_PRIME: return REG_HL_PRIME;
+  case V_IXH: return REG_IX_HIGH;
+  case V_IXL: return REG_IX_LOW;
+  case V_IYH: return REG_IY_HIGH;
+  case V_IYL: return REG_IY_LOW;
+  case V_I: return REG_I;
+  case V_ZF: return ZERO_FLAG != 0;
+  case V_CF: return CARRY_FLAG != 0;
+  case V_SF: return SIGN_FLAG != 0;
+  case V_PF: return PARITY_FLAG != 0;
+  case V_HF: return HALF_CARRY_FLAG != 0;
+  case V_NF: return SUBTRACT_FLAG != 0;
+  case V_IFF1: return z80_state.iff1;
+  case V_IFF2: return z80_state.iff2;
+  case V_IM: return z80_state.interrupt_mode;
+  case V_HITS: return hits;
+  }
+  return 0;
+}
+
+int
+debug_expr_eval(debug_expr *e, int hits)
+{
+  int stack[EXPR_MAX_STACK];
+  int *code = e->code, *end = e->code + e->ncode;
+  int sp = 0, b;
+
+  while (code < end) {
+    switch (*code++) {
+    case OP_CONST:
+      stack[sp++] = *code++;
+      continue;
+    case OP_VAR:
+      stack[sp++] = var_value(*code++, hits);
+      continue;
+    case OP_PEEK:
+      stack[sp-1] = peek(stack[sp-1]);
+      continue;
+    case OP_PEEKW:
+      stack[sp-1] = peek(stack[sp-1]) | (peek(stack[sp-1] + 1) << 8);
+      continue;
+    case OP_NEG:
+      stack[sp-1] = -(unsigned) stack[sp-1];
+      continue;
+    case OP_NOT:
+      stack[sp-1] = !stack[sp-1];
+      continue;
+    case OP_COM:
+      stack[sp-1] = ~stack[sp-1];
+      continue;
+    }
+
+    /* Binary operators.  Arithmetic that can overflow is done
+       unsigned, so that it wraps around instead of being undefined;
+       a user can type anything. */
+    b = stack[--sp];
+    switch (code[-1]) {
+    case OP_MUL: stack[sp-1] = (unsigned) stack[sp-1] * b; break;
+    case OP_DIV:
+      if (b == -1) stack[sp-1] = -(unsigned) stack[sp-1];
+      else stack[sp-1] = b ? stack[sp-1] / b : 0;
+      break;
+    case OP_MOD: stack[sp-1] = b && b != -1 ? stack[sp-1] % b : 0; break;
+    case OP_ADD: stack[sp-1] = (unsigned) stack[sp-1] + b; break;
+    case OP_SUB: stack[sp-1] = (unsigned) stack[sp-1] - b; break;
+    case OP_SHL: stack[sp-1] = (unsigned) stack[sp-1] << (b & 31); break;
+    case OP_SHR: stack[sp-1] >>= (b & 31); break;
+    case OP_LT: stack[sp-1] = stack[sp-1] < b; break;
+    case OP_LE: stack[sp-1] = stack[sp-1] <= b; break;
+    case OP_GT: stack[sp-1] = stack[sp-1] > b; break;
+    case OP_GE: stack[sp-1] = stack[sp-1] >= b; break;
+    case OP_EQ: stack[sp-1] = stack[sp-1] == b; break;
+    case OP_NE: stack[sp-1] = stack[sp-1] != b; break;
+    case OP_AND: stack[sp-1] &= b; break;
+    case OP_XOR: stack[sp-1] ^= b; break;
+    case OP_OR: stack[sp-1] |= b; break;
+    case OP_LAND: stack[sp-1] = stack[sp-1] && b; break;
+    case OP_LOR: stack[sp-1] = stack[sp-1] || b; break;
+    }
+  }
+  return stack[0] != 0;
+}
+
+const char *
+debug_expr_text(debug_expr *e)
+{
+  return e->text;
+}
+
+void
+debug_expr_free(debug_expr *e)
+{
+  if (e == NULL) return;
+  free(e->text);
+  free(e->code);
+  free(e);
+}
@@ -0,0 +1,31 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * debug_expr.h
+ *
+ * Conditions for zbx breakpoints and tracepoints.
+ */
+
+#ifndef _DEBUG_EXPR_H
+#define _DEBUG_EXPR_H
+
+typedef struct debug_expr debug_expr;
+
+/* Compile text into a condition.  On a syntax error, returns NULL
+ * and points *err at a message. */
+debug_expr *debug_expr_compile(const char *text, const char **err);
+
+/* Evaluate a condition against the current Z80 state.  hits is the
+ * value of the "hits" variable. */
+int debug_expr_eval(debug_expr *e, int hits);
+
+const char *debug_expr_text(debug_expr *e);
+void debug_expr_free(debug_expr *e);
+
+#endif /*_DEBUG_EXPR_H*/
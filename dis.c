@@ -20,10 +20,13 @@
 
 /*
  * dis.c -- a hacked version of "zdis" which can print out instructions
- * as they are executed.
+ * as they are executed.  The printing is done by disassemble() in
+ * debug.c; this file only decodes and formats, see dis.h.
  */
 
-#include "z80.h"
+#include <stdio.h>
+#include <string.h>
+#include "dis.h"
 
 /* Argument printing */
 #define A_0       0  /* No arguments */
@@ -963,9 +966,9 @@ static struct opcode minor[6][256] = {
 	{ "emt_mouse",		A_0 },		/* ed29 */
 	{ "emt_getdir",		A_0 },		/* ed2a */
 	{ "emt_setdir",		A_0 },		/* ed2b */
-	{ undefined,		A_0 },		/* ed2c */
-	{ undefined,		A_0 },		/* ed2d */
-	{ undefined,		A_0 },		/* ed2e */
+	{ "emt_aio_submit",	A_0 },		/* ed2c */
+	{ "emt_aio_poll",	A_0 },		/* ed2d */
+	{ "emt_aio_wait",	A_0 },		/* ed2e */
 	{ "emt_debug",		A_0 },		/* ed2f */
 
 	{ "emt_open",		A_0 },		/* ed30 */
@@ -2074,59 +2077,252 @@ static struct opcode minor[6][256] = {
     }
 };
 
-int disassemble(unsigned short pc)
+/* T-states for unprefixed instructions, as z80.c counts them;
+   conditional branches are given their not-taken time */
+static unsigned char major_tstates[256] = {
+     4,10, 7, 6, 4, 4, 7, 4, 4,11, 7, 6, 4, 4, 7, 4,	/* 00 */
+     8,10, 7, 6, 4, 4, 7, 4,12,11, 7, 6, 4, 4, 7, 4,	/* 10 */
+     7,10,16, 6, 4, 4, 7, 4, 7,11,16, 6, 4, 4, 7, 4,	/* 20 */
+     7,10,13, 6,11,11,10, 4, 7,11,13, 6, 4, 4, 7, 4,	/* 30 */
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,	/* 40 */
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,	/* 50 */
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,	/* 60 */
+     7, 7, 7, 7, 7, 7, 4, 7, 4, 4, 4, 4, 4, 4, 7, 4,	/* 70 */
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,	/* 80 */
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,	/* 90 */
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,	/* a0 */
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,	/* b0 */
+     5,10,10,10,10,11, 7,11, 5,10,10, 0,10,17, 7,11,	/* c0 */
+     5,10,10,11,10,11, 7,11, 5, 4,10,10,10, 0, 7,11,	/* d0 */
+     5,10,10,19,10,11, 7,11, 5, 4,10, 4,10, 0, 7,11,	/* e0 */
+     5,10,10, 4,10,11, 7,11, 5, 6,10, 4,10, 0, 7,11,	/* f0 */
+};
+
+/* Fill in T-states and flow of control for opcode i in table j
+   (-1 for major) */
+static void
+timing(dis_insn *insn, int j, int i)
+{
+    int taken = 0;
+
+    insn->flow = 0;
+    insn->target = -1;
+    switch (j) {
+      case -1:
+      case 1: /* dd */
+      case 3: /* fd */
+	insn->tstates = major_tstates[i];
+	if ((i & 0xc7) == 0xc0) {		/* ret cc */
+	    insn->flow = DIS_RET|DIS_COND;
+	    taken = 6;
+	} else if ((i & 0xc7) == 0xc2) {	/* jp cc */
+	    insn->flow = DIS_JUMP|DIS_COND;
+	    insn->target = insn->operand;
+	} else if ((i & 0xc7) == 0xc4) {	/* call cc */
+	    insn->flow = DIS_CALL|DIS_COND;
+	    insn->target = insn->operand;
+	    taken = 7;
+	} else if ((i & 0xc7) == 0xc7) {	/* rst */
+	    insn->flow = DIS_CALL;
+	    insn->target = i & 0x38;
+	} else if (i == 0x10 || (i & 0xe7) == 0x20) { /* djnz, jr cc */
+	    insn->flow = DIS_JUMP|DIS_COND;
+	    insn->target = insn->operand;
+	    taken = 5;
+	} else if (i == 0x18) {
+	    insn->flow = DIS_JUMP;
+	    insn->target = insn->operand;
+	} else if (i == 0xc3) {
+	    insn->flow = DIS_JUMP;
+	    insn->target = insn->operand;
+	} else if (i == 0xcd) {
+	    insn->flow = DIS_CALL;
+	    insn->target = insn->operand;
+	} else if (i == 0xc9) {
+	    insn->flow = DIS_RET;
+	} else if (i == 0xe9) {
+	    insn->flow = DIS_JUMP;
+	} else if (i == 0x76) {
+	    insn->flow = DIS_HALT;
+	}
+	if (j != -1) {
+	    /* (ix+d) forms take longer; others pay for the prefix */
+	    if (i == 0x34 || i == 0x35) {
+		insn->tstates = 23;
+	    } else if (i == 0x36 || (i != 0x76 &&
+			((i & 0xc7) == 0x46 || (i & 0xf8) == 0x70 ||
+			 (i & 0xc7) == 0x86))) {
+		insn->tstates = 19;
+	    } else {
+		insn->tstates += 4;
+	    }
+	}
+	break;
+      case 0: /* cb */
+	if ((i & 7) != 6) {
+	    insn->tstates = 8;
+	} else {
+	    insn->tstates = (i & 0xc0) == 0x40 ? 12 : 15;
+	}
+	break;
+      case 2: /* ed */
+	insn->tstates = 8;
+	if (i >= 0x40 && i < 0x80) {
+	    switch (i & 7) {
+	      case 0: insn->tstates = 11; break;
+	      case 1: insn->tstates = 12; break;
+	      case 2: insn->tstates = 15; break;
+	      case 3: insn->tstates = 20; break;
+	      case 5:
+		insn->tstates = 14;
+		insn->flow = DIS_RET;
+		break;
+	      case 7:
+		if (i < 0x60) insn->tstates = 9;
+		else if (i < 0x70) insn->tstates = 18;
+		break;
+	    }
+	} else if (i >= 0xa0 && i < 0xc0 && (i & 4) == 0) {
+	    /* z80.c charges the i/o block instructions a T-state less */
+	    insn->tstates = (i & 2) ? 15 : 16;
+	    if (i >= 0xb0) {			/* ldir, cpir, inir, otir... */
+		insn->flow = DIS_JUMP|DIS_COND;
+		insn->target = insn->pc;
+		taken = 5;
+	    }
+	}
+	break;
+      case 4: /* dd cb */
+      case 5: /* fd cb */
+	insn->tstates = (i & 0xc0) == 0x40 ? 20 : 23;
+	break;
+    }
+    insn->tstates_taken = insn->tstates + taken;
+}
+
+int dis_decode(const Uchar *buf, Ushort pc, dis_insn *insn)
 {
-    int	i, j;
+    int	i, j = -1, n = 0;
     struct opcode	*code;
-    int	addr;
-    
-    addr = pc;
-    i = mem_read(pc++);
+
+    insn->pc = pc;
+    i = buf[n++];
     if (!major[i].name)
     {
 	j = major[i].args;
-	i = mem_read(pc++);
+	i = buf[n++];
 	if (!minor[j][i].name)
 	{
 	    /* dd cb or fd cb; offset comes *before* instruction */
 	    j = minor[j][i].args;
-            pc++; /* skip over offset */
-	    i = mem_read(pc++);
+	    n++; /* skip over offset */
+	    i = buf[n++];
 	}
 	code = &minor[j][i];
+	insn->id = 256 + j * 256 + i;
     }
     else
     {
 	code = &major[i];
+	insn->id = i;
     }
-    printf ("%04x  ", addr);
-    for (i = 0; i < ((pc + arglen(code->args) - addr) & 0xffff); i++)
-        printf("%02x ", mem_read(addr + i));
-    for (; i < 4; i++)
-	printf("   ");
-    printf(" ");
+    insn->operand = insn->operand2 = 0;
     switch (code->args) {
       case A_16: /* 16-bit number */
-	printf (code->name, mem_read(pc + 1), mem_read(pc));
+	insn->operand = buf[n] | (buf[n + 1] << 8);
 	break;
       case A_8X2: /* Two 8-bit numbers */
-	printf (code->name, mem_read(pc), mem_read(pc + 1));
-	break;
+	insn->operand2 = buf[n + 1];
+	/* fall through */
       case A_8:  /* One 8-bit number */
-	printf (code->name, mem_read(pc));
+	insn->operand = buf[n];
 	break;
       case A_8P: /* One 8-bit number before last opcode byte */
-	printf (code->name, mem_read(pc - 2));
-	break;
-      case A_0:  /* No args */
-      case A_0B: /* No args, backskip over last opcode byte */
-	fputs (code->name, stdout);
+	insn->operand = buf[n - 2];
 	break;
       case A_8R: /* One 8-bit relative address */
-	printf (code->name, (pc + 1 + (signed char) mem_read(pc)) & 0xffff);
+	insn->operand = (pc + n + 1 + (signed char) buf[n]) & 0xffff;
 	break;
     }
-    putchar ('\n');
-    pc += arglen(code->args);
-    return pc;  /* return the location of the next instruction */
+    n += arglen(code->args);
+    insn->length = n;
+    memcpy(insn->bytes, buf, 4);
+    if (code->args == A_0B) {
+	/* a prefix that does nothing; the next byte starts over */
+	insn->tstates = insn->tstates_taken = 4;
+	insn->flow = 0;
+	insn->target = -1;
+    } else {
+	timing(insn, j, i);
+    }
+    return n;
+}
+
+static struct opcode *
+lookup(int id)
+{
+    return id < 256 ? &major[id] : &minor[id / 256 - 1][id % 256];
+}
+
+int dis_format(const dis_insn *insn, char *buf, int size,
+	       dis_symbol_func sym, void *arg)
+{
+    struct opcode *code = lookup(insn->id);
+    const char *name = NULL, *pct;
+    int skip = 0;
+
+    if (sym != NULL) {
+	if (code->args == A_16) {
+	    skip = 9; /* %02x%02xh */
+	} else if (code->args == A_8R) {
+	    skip = 5; /* %04xh */
+	}
+	if (skip) name = sym(insn->operand, arg);
+    }
+    if (name != NULL) {
+	pct = strchr(code->name, '%');
+	return snprintf(buf, size, "%.*s%s%s", (int) (pct - code->name),
+			code->name, name, pct + skip);
+    }
+    switch (code->args) {
+      case A_16:
+	return snprintf(buf, size, code->name,
+			insn->operand >> 8, insn->operand & 0xff);
+      case A_8X2:
+	return snprintf(buf, size, code->name, insn->operand, insn->operand2);
+      case A_8:
+      case A_8P:
+      case A_8R:
+	return snprintf(buf, size, code->name, insn->operand);
+      default:
+	return snprintf(buf, size, "%s", code->name);
+    }
+}
+
+int dis_name(int id, char *buf, int size)
+{
+    struct opcode *code = lookup(id);
+    const char *p;
+    char text[40];
+    int n = 0, conv = 0;
+
+    if (code->name == NULL) return -1;
+    for (p = code->name; *p && n < (int) sizeof(text) - 3; p++) {
+	if (*p != '%') {
+	    text[n++] = *p;
+	    continue;
+	}
+	while (*p != 'x') p++;
+	switch (code->args) {
+	  case A_16:  if (conv == 0) { text[n++] = 'n'; text[n++] = 'n'; } break;
+	  case A_8:   text[n++] = 'n'; break;
+	  case A_8P:  text[n++] = 'd'; break;
+	  case A_8R:  text[n++] = 'e'; break;
+	  case A_8X2: text[n++] = conv ? 'n' : 'd'; break;
+	}
+	conv++;
+	if (p[1] == 'h') p++;
+    }
+    text[n] = '\0';
+    return snprintf(buf, size, "%s", text);
 }
@@ -0,0 +1,64 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * dis.h
+ *
+ * Table-driven Z80 disassembler.  dis_decode works on a byte buffer
+ * and keeps no state, so it can be used on trace records, memory
+ * snapshots, or /cmd files as well as on the emulated machine's
+ * memory; dis_format turns the result into text.
+ */
+
+#ifndef _DIS_H
+#define _DIS_H
+
+#include "z80.h"
+
+/* Flow-of-control bits in dis_insn.flow */
+#define DIS_JUMP  1   /* jp, jr, djnz, jp (hl) */
+#define DIS_CALL  2   /* call, rst */
+#define DIS_RET   4   /* ret, reti, retn */
+#define DIS_COND  8   /* may fall through: conditional, djnz, ldir, ... */
+#define DIS_HALT 16
+
+#define DIS_NIDS (7 * 256)  /* number of distinct opcode ids */
+
+typedef struct {
+  Ushort pc;           /* address of the first byte */
+  Uchar bytes[4];      /* the first length bytes are the instruction */
+  int length;          /* 1 to 4 */
+  int id;              /* opcode table entry, 0 to DIS_NIDS-1 */
+  int operand;         /* immediate value, address, or displacement */
+  int operand2;        /* second immediate, for ld (ix+d),n */
+  int tstates;         /* T-states if a DIS_COND branch is not taken */
+  int tstates_taken;   /* T-states if it is; else same as tstates */
+  int flow;            /* DIS_ bits above */
+  int target;          /* branch target, or -1 if none or computed */
+} dis_insn;
+
+/* Return the name for address, or NULL to print it in hex */
+typedef const char *(*dis_symbol_func)(int address, void *arg);
+
+/* Decode the instruction at buf, which was fetched from address pc
+ * and must hold 4 bytes (those beyond the instruction are ignored).
+ * Returns its length. */
+int dis_decode(const Uchar *buf, Ushort pc, dis_insn *insn);
+
+/* Format a decoded instruction into buf (mnemonic, a tab, operands),
+ * looking up 16-bit operands and branch targets with sym if it is not
+ * NULL.  Returns the length the text would have, as snprintf does. */
+int dis_format(const dis_insn *insn, char *buf, int size,
+	       dis_symbol_func sym, void *arg);
+
+/* Format the generic form of opcode id, with n, nn, d, and e standing
+ * for its operands (e.g., "ld\t(ix+d),n").  Returns -1 if id is only
+ * a prefix, else as dis_format. */
+int dis_name(int id, char *buf, int size);
+
+#endif /*_DIS_H*/
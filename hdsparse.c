@@ -0,0 +1,266 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * hdsparse.c
+ *
+ * Reading and writing sparse hard disk images; see hdsparse.h for
+ * the format.  Used by the WD1010 emulation in trs_hard.c and by
+ * mkdisk.
+ */
+
+#define _XOPEN_SOURCE 500 /* unistd.h: pread(), pwrite() */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "z80.h"
+#include "reed.h"
+#include "hdsparse.h"
+
+#define HDS_MAXNBLK (1UL << 24)
+#define HDS_MAXEND 0xffffffffUL  /* largest offset an entry can hold */
+
+unsigned long
+hds_get_nblk(const ReedHardHeader *rhh)
+{
+  return rhh->xnblk[0] | (rhh->xnblk[1] << 8) | (rhh->xnblk[2] << 16) |
+    ((unsigned long) rhh->xnblk[3] << 24);
+}
+
+void
+hds_set_nblk(ReedHardHeader *rhh, unsigned long nblk)
+{
+  rhh->xnblk[0] = nblk;
+  rhh->xnblk[1] = nblk >> 8;
+  rhh->xnblk[2] = nblk >> 16;
+  rhh->xnblk[3] = nblk >> 24;
+}
+
+void
+hds_get_entry(const Uchar *e, unsigned long *offset, int *len, int *method)
+{
+  *offset = e[0] | (e[1] << 8) | (e[2] << 16) | ((unsigned long) e[3] << 24);
+  *len = e[4] | (e[5] << 8);
+  *method = e[6];
+}
+
+void
+hds_set_entry(Uchar *e, unsigned long offset, int len, int method)
+{
+  e[0] = offset;
+  e[1] = offset >> 8;
+  e[2] = offset >> 16;
+  e[3] = offset >> 24;
+  e[4] = len;
+  e[5] = len >> 8;
+  e[6] = method;
+  e[7] = 0;
+}
+
+/* Read the block table of the sparse image open on fd, whose header
+   is rhh.  Returns NULL with errno set if it is unusable. */
+HdSparse *
+hds_open(int fd, const ReedHardHeader *rhh)
+{
+  HdSparse *s;
+  size_t tsize;
+  struct stat st;
+
+  if (rhh->xfmt != HDS_FORMAT ||
+      rhh->xblk < HDS_MINBLKSHIFT || rhh->xblk > HDS_MAXBLKSHIFT ||
+      hds_get_nblk(rhh) == 0 || hds_get_nblk(rhh) > HDS_MAXNBLK) {
+    errno = EINVAL;
+    return NULL;
+  }
+  s = (HdSparse *) calloc(1, sizeof(HdSparse));
+  if (s == NULL) return NULL;
+  s->fd = fd;
+  s->blkshift = rhh->xblk;
+  s->blksize = 1 << s->blkshift;
+  s->nblk = hds_get_nblk(rhh);
+  s->cached = -1;
+  tsize = s->nblk * HDS_ENTRY_SIZE;
+  s->table = (Uchar *) malloc(tsize);
+  s->cache = (Uchar *) malloc(s->blksize);
+  if (s->table == NULL || s->cache == NULL) {
+    hds_close(s);
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (pread(fd, s->table, tsize, sizeof(ReedHardHeader)) != tsize ||
+      fstat(fd, &st) < 0) {
+    hds_close(s);
+    errno = EINVAL;
+    return NULL;
+  }
+  s->end = sizeof(ReedHardHeader) + tsize;
+  if (st.st_size > s->end) s->end = st.st_size;
+  return s;
+}
+
+void
+hds_close(HdSparse *s)
+{
+  free(s->table);
+  free(s->cache);
+  free(s);
+}
+
+/* Decompress block blk into the cache if it is not there already */
+static int
+load_cache(HdSparse *s, unsigned long blk, unsigned long offset, int len)
+{
+#ifdef HAVE_ZLIB
+  Uchar *zbuf;
+  uLongf zlen = s->blksize;
+  int ok;
+
+  if (s->cached == blk) return 0;
+  s->cached = -1;
+  zbuf = (Uchar *) malloc(len);
+  if (zbuf == NULL) return -1;
+  ok = pread(s->fd, zbuf, len, offset) == len &&
+    uncompress(s->cache, &zlen, zbuf, len) == Z_OK && zlen == s->blksize;
+  free(zbuf);
+  if (!ok) {
+    errno = EIO;
+    return -1;
+  }
+  s->cached = blk;
+  return 0;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+/* Read the whole of block blk into buf.  Returns 0 if OK, -1 with
+   errno set on error. */
+int
+hds_read_block(HdSparse *s, unsigned long blk, Uchar *buf)
+{
+  if (hds_read(s, buf, s->blksize, (off_t) blk << s->blkshift) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Read len bytes at offset in the sector array into buf.  Returns
+   len if OK, -1 with errno set on error. */
+ssize_t
+hds_read(HdSparse *s, Uchar *buf, size_t len, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    unsigned long blk = offset >> s->blkshift;
+    int within = offset & (s->blksize - 1);
+    int n = s->blksize - within;
+    unsigned long boff;
+    int blen, method;
+    ssize_t res;
+
+    if (n > len - done) n = len - done;
+    if (blk >= s->nblk) {
+      boff = 0;
+    } else {
+      hds_get_entry(s->table + blk * HDS_ENTRY_SIZE, &boff, &blen, &method);
+    }
+    if (boff == 0) {
+      memset(buf + done, 0, n);
+    } else if (method == HDS_STORED) {
+      res = pread(s->fd, buf + done, n, boff + within);
+      if (res < 0) return -1;
+      if (res < n) memset(buf + done + res, 0, n - res);
+    } else if (method == HDS_DEFLATE) {
+      if (load_cache(s, blk, boff, blen) < 0) return -1;
+      memcpy(buf + done, s->cache + within, n);
+    } else {
+      errno = EINVAL;
+      return -1;
+    }
+    done += n;
+    offset += n;
+  }
+  return len;
+}
+
+/* Write the block in the cache to a new stored block at the end of
+   the file, then point blk's table entry at it */
+static int
+append_block(HdSparse *s, unsigned long blk)
+{
+  Uchar *e = s->table + blk * HDS_ENTRY_SIZE;
+
+  if (s->end + s->blksize > HDS_MAXEND) {
+    errno = ENOSPC;
+    return -1;
+  }
+  if (pwrite(s->fd, s->cache, s->blksize, s->end) != s->blksize) return -1;
+  hds_set_entry(e, s->end, s->blksize, HDS_STORED);
+  if (pwrite(s->fd, e, HDS_ENTRY_SIZE,
+	     sizeof(ReedHardHeader) + blk * HDS_ENTRY_SIZE) != HDS_ENTRY_SIZE) {
+    return -1;
+  }
+  s->end += s->blksize;
+  return 0;
+}
+
+/* Write len bytes from buf at offset in the sector array, allocating
+   blocks as needed.  Returns len if OK, -1 with errno set on error. */
+ssize_t
+hds_write(HdSparse *s, const Uchar *buf, size_t len, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    unsigned long blk = offset >> s->blkshift;
+    int within = offset & (s->blksize - 1);
+    int n = s->blksize - within;
+    unsigned long boff;
+    int blen, method, i;
+
+    if (n > len - done) n = len - done;
+    if (blk >= s->nblk) {
+      errno = ENOSPC;
+      return -1;
+    }
+    hds_get_entry(s->table + blk * HDS_ENTRY_SIZE, &boff, &blen, &method);
+    if (boff == 0) {
+      /* Writing zeros to an unallocated block changes nothing */
+      for (i = 0; i < n && buf[done + i] == 0; i++) ;
+      if (i < n) {
+	memset(s->cache, 0, s->blksize);
+	memcpy(s->cache + within, buf + done, n);
+	s->cached = -1;
+	if (append_block(s, blk) < 0) return -1;
+      }
+    } else if (method == HDS_STORED) {
+      if (pwrite(s->fd, buf + done, n, boff + within) != n) return -1;
+    } else if (method == HDS_DEFLATE) {
+      if (load_cache(s, blk, boff, blen) < 0) return -1;
+      memcpy(s->cache + within, buf + done, n);
+      s->cached = -1;
+      if (append_block(s, blk) < 0) return -1;
+    } else {
+      errno = EINVAL;
+      return -1;
+    }
+    done += n;
+    offset += n;
+  }
+  return len;
+}
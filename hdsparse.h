@@ -0,0 +1,67 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * hdsparse.h
+ *
+ * Sparse hard disk images.  Such an image starts with the usual
+ * 256-byte ReedHardHeader, with xfmt set to HDS_FORMAT.  Instead of
+ * an array of sectors, there follows a block table of xnblk entries,
+ * then the data blocks, each 2**xblk bytes of what would be the
+ * sector array, in any order.  Each table entry is 8 bytes:
+ *
+ *   0 - 3: offset of the block in the file, low byte first;
+ *          0 if the block is not allocated, so reads as zeros
+ *   4 - 5: number of bytes stored in the file, low byte first
+ *      6:  HDS_STORED or HDS_DEFLATE (zlib format)
+ *      7:  reserved, 0
+ *
+ * xtrs itself only writes stored blocks: writing to a deflated block
+ * moves it to a new stored block at the end of the file, abandoning
+ * the old space until mkdisk -K compacts the image.
+ *
+ * Include reed.h before this file.
+ */
+
+#ifndef _HDSPARSE_H
+#define _HDSPARSE_H
+
+#include <sys/types.h>
+
+#define HDS_FORMAT 1        /* value of xfmt */
+#define HDS_BLKSHIFT 12     /* default xblk: 4 KiB blocks */
+#define HDS_MINBLKSHIFT 10  /* largest sector size */
+#define HDS_MAXBLKSHIFT 15  /* largest size that fits in an entry */
+#define HDS_ENTRY_SIZE 8
+
+#define HDS_STORED  0
+#define HDS_DEFLATE 1
+
+typedef struct {
+  int fd;
+  int blkshift;
+  int blksize;
+  unsigned long nblk;
+  Uchar *table;         /* nblk entries, as in the file */
+  off_t end;            /* where the next new block goes */
+  long cached;          /* block decompressed into cache, or -1 */
+  Uchar *cache;
+} HdSparse;
+
+unsigned long hds_get_nblk(const ReedHardHeader *rhh);
+void hds_set_nblk(ReedHardHeader *rhh, unsigned long nblk);
+void hds_get_entry(const Uchar *e, unsigned long *offset, int *len,
+		   int *method);
+void hds_set_entry(Uchar *e, unsigned long offset, int len, int method);
+HdSparse *hds_open(int fd, const ReedHardHeader *rhh);
+void hds_close(HdSparse *s);
+int hds_read_block(HdSparse *s, unsigned long blk, Uchar *buf);
+ssize_t hds_read(HdSparse *s, Uchar *buf, size_t len, off_t offset);
+ssize_t hds_write(HdSparse *s, const Uchar *buf, size_t len, off_t offset);
+
+#endif
@@ -26,6 +26,11 @@
 #include "trs_disk.h"
 #include "trs_hard.h"
 #include "load_cmd.h"
+#include "trs_profile.h"
+#include "trs_trace.h"
+#include "trs_cover.h"
+#include "trs_heat.h"
+#include "trs_metrics.h"
 
 int trs_model = 1;
 int trs_paused = 1;
@@ -127,6 +132,14 @@ int main(int argc, char *argv[])
     trs_disk_init();
     trs_hard_init();
     stringy_init();
+    trs_prof_init();
+    trs_trace_init();
+    trs_cover_init();
+    trs_heat_init();
+    trs_metrics_init();
+#ifdef OPSTATS
+    z80_opstats_init();
+#endif
 
     trs_reset(1);
     if (!debug) {
@@ -22,9 +22,15 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 typedef unsigned char Uchar;
 #include "reed.h"
+#include "hdsparse.h"
+#include "overlay.h"
 ReedHardHeader rhh;
 
 void Usage(char *progname)
@@ -33,9 +39,14 @@ void Usage(char *progname)
 	  "Usage:\t%s -1 [-f] file\n"
 	  "\t%s [-3] [-f] file\n"
 	  "\t%s -k [-s sides] [-d density] [-8] [-i] [-f] file\n"
-	  "\t%s -h [-c cyl] [-s sec] [-g gran] [-d dcyl] [-f] file\n"
+	  "\t%s -h [-c cyl] [-s sec] [-g gran] [-d dcyl] [-t trksec] "
+	  "[-z secsize] [-x] [-f] file\n"
+	  "\t%s -C oldfile [-x] [-Z] [-f] file\n"
+	  "\t%s -K [-Z] file\n"
+	  "\t%s {-M|-D} deltafile\n"
 	  "\t%s {-p|-u} {-1|-3|-k|-h} file\n",
-	  progname, progname, progname, progname, progname);
+	  progname, progname, progname, progname, progname, progname,
+	  progname, progname);
   exit(2);
 }
 
@@ -61,19 +72,320 @@ fopen_w(const char *fname, int overwrite)
   }
 }
 
+/* Set the checksum in a hard drive header */
+void
+hard_cksum(ReedHardHeader *r)
+{
+  Uchar *p = (Uchar *) r;
+  int i, cksum = 0;
+
+  for (i=0; i<=31; i++) {
+    if (i != 3) cksum += p[i];
+  }
+  r->cksum = ((Uchar) cksum) ^ 0x4c;
+}
+
+/* Size in bytes of the array of sectors described by a hard drive
+   header */
+off_t
+hard_size(const ReedHardHeader *r)
+{
+  static const int secsizes[] = { 256, 512, 1024, 128 };
+  int secs;
+
+  if (r->xheads) {
+    secs = r->xheads * (r->xsec ? r->xsec : 32);
+  } else {
+    secs = r->sec ? r->sec : 256;
+  }
+  return (off_t) (r->cyl ? r->cyl : 256) * secs * secsizes[r->xsize & 3];
+}
+
+/*
+ * Copy the hard drive image in file from to file to: as a sparse
+ * image if sparse, compressing each block if compress, or else as an
+ * array of sectors.  Blocks of zeros are left out of a sparse image,
+ * and blocks that are already compressed stay so.  Returns 0 if OK,
+ * else prints a message and returns 1.
+ */
+int
+copy_hard(const char *from, const char *to, int sparse, int compress,
+	  int overwrite, const char *progname)
+{
+  ReedHardHeader r;
+  HdSparse *s = NULL;
+  Uchar *table = NULL, *buf = NULL, *zbuf = NULL;
+  unsigned long i, nblk, boff;
+  off_t len, end;
+  struct stat st;
+  int fd, bs, blen, method, ok = 0;
+  FILE *f = NULL;
+
+  fd = open(from, O_RDONLY);
+  if (fd < 0) {
+    perror(from);
+    return 1;
+  }
+  if (pread(fd, &r, sizeof(r), 0) != sizeof(r) ||
+      r.id1 != 0x56 || r.id2 != 0xcb || r.ver != 0x10) {
+    fprintf(stderr, "%s: %s is not a hard drive image\n", progname, from);
+    goto done;
+  }
+  if (r.xfmt == HDS_FORMAT) {
+    s = hds_open(fd, &r);
+    if (s == NULL) {
+      fprintf(stderr, "%s: %s has an unusable block table\n", progname, from);
+      goto done;
+    }
+    bs = s->blksize;
+    len = (off_t) s->nblk * bs;
+  } else if (r.xfmt == 0) {
+    if (fstat(fd, &st) < 0) {
+      perror(from);
+      goto done;
+    }
+    bs = 1 << HDS_BLKSHIFT;
+    len = st.st_size - sizeof(r);
+    if (len < 0) len = 0;
+  } else {
+    fprintf(stderr, "%s: %s has unknown format %d\n", progname, from, r.xfmt);
+    goto done;
+  }
+
+  /* Cover both the geometry and any data beyond it */
+  if (len < hard_size(&r)) len = hard_size(&r);
+  nblk = (len + bs - 1) / bs;
+  if (sparse) {
+    r.xfmt = HDS_FORMAT;
+    r.xblk = s ? s->blkshift : HDS_BLKSHIFT;
+    hds_set_nblk(&r, nblk);
+  } else {
+    r.xfmt = 0;
+    r.xblk = 0;
+    hds_set_nblk(&r, 0);
+  }
+  hard_cksum(&r);
+
+  table = (Uchar *) calloc(nblk, HDS_ENTRY_SIZE);
+  buf = (Uchar *) malloc(bs);
+  zbuf = (Uchar *) malloc(2 * bs);
+  if (table == NULL || buf == NULL || zbuf == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    goto done;
+  }
+  f = fopen_w(to, overwrite);
+  if (f == NULL) {
+    perror(to);
+    goto done;
+  }
+  fwrite(&r, sizeof(r), 1, f);
+  if (sparse) fwrite(table, HDS_ENTRY_SIZE, nblk, f);
+  end = ftell(f);
+
+  for (i = 0; i < nblk; i++) {
+    blen = 0;
+    if (s) {
+      boff = 0;
+      if (i < s->nblk) {
+	hds_get_entry(s->table + i * HDS_ENTRY_SIZE, &boff, &blen, &method);
+      }
+      if (boff == 0) {
+	if (!sparse) memset(buf, 0, bs);
+      } else if (sparse && method == HDS_DEFLATE) {
+	/* Copy as is */
+	if (pread(fd, zbuf, blen, boff) != blen) {
+	  perror(from);
+	  goto done;
+	}
+      } else {
+	if (hds_read_block(s, i, buf) < 0) {
+	  perror(from);
+	  goto done;
+	}
+	blen = bs;
+	method = HDS_STORED;
+      }
+    } else {
+      ssize_t res = pread(fd, buf, bs, sizeof(r) + (off_t) i * bs);
+      if (res < 0) {
+	perror(from);
+	goto done;
+      }
+      memset(buf + res, 0, bs - res);
+      blen = bs;
+      method = HDS_STORED;
+    }
+
+    if (!sparse) {
+      /* Write the array of sectors out to the length of the original */
+      if (s == NULL && (off_t) (i + 1) * bs > st.st_size - sizeof(r)) {
+	fwrite(buf, 1, st.st_size - sizeof(r) - (off_t) i * bs, f);
+	break;
+      }
+      if (s && boff == 0) {
+	/* Skip it, leaving a hole if more data follows */
+	continue;
+      }
+      fseek(f, end + (off_t) i * bs, SEEK_SET);
+      fwrite(buf, 1, bs, f);
+      continue;
+    }
+
+    if (blen == 0) continue;  /* not allocated */
+    if (method == HDS_STORED) {
+      int j;
+      for (j = 0; j < bs && buf[j] == 0; j++) ;
+      if (j == bs) continue;  /* all zeros */
+#ifdef HAVE_ZLIB
+      if (compress) {
+	uLongf zlen = 2 * bs;
+	if (compress2(zbuf, &zlen, buf, bs, Z_BEST_COMPRESSION) == Z_OK &&
+	    zlen < bs) {
+	  blen = zlen;
+	  method = HDS_DEFLATE;
+	}
+      }
+#endif
+    }
+    fwrite(method == HDS_DEFLATE ? zbuf : buf, 1, blen, f);
+    hds_set_entry(table + i * HDS_ENTRY_SIZE, end, blen, method);
+    end += blen;
+    if (end > 0xffffffffL) {
+      fprintf(stderr, "%s: %s would be too large\n", progname, to);
+      goto done;
+    }
+  }
+
+  if (s && !sparse) {
+    /* Extend over unallocated blocks at the end, so that they read as
+       zeros as they did in the sparse image, not as past the end */
+    if (fflush(f) != 0 ||
+	ftruncate(fileno(f), end + (off_t) nblk * bs) != 0) {
+      perror(to);
+      goto done;
+    }
+  }
+  if (sparse) {
+    fseek(f, sizeof(r), SEEK_SET);
+    fwrite(table, HDS_ENTRY_SIZE, nblk, f);
+  }
+  ok = 1;
+
+ done:
+  if (f) {
+    if (ferror(f) || fclose(f) != 0) {
+      perror(to);
+      ok = 0;
+    }
+  }
+  if (s) hds_close(s);
+  close(fd);
+  free(table);
+  free(buf);
+  free(zbuf);
+  return !ok;
+}
+
+/* Rewrite the sparse image in file fname without unused space and
+   blocks of zeros, compressing each block if compress.  Returns 0 if
+   OK, else prints a message and returns 1. */
+int
+compact_hard(const char *fname, int compress, const char *progname)
+{
+  ReedHardHeader r;
+  struct stat st;
+  char *tmp;
+  int fd;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(fname);
+    return 1;
+  }
+  if (pread(fd, &r, sizeof(r), 0) != sizeof(r) || r.xfmt != HDS_FORMAT) {
+    fprintf(stderr, "%s: %s is not a sparse hard drive image; use -C\n",
+	    progname, fname);
+    close(fd);
+    return 1;
+  }
+  close(fd);
+
+  tmp = (char *) malloc(strlen(fname) + 8);
+  sprintf(tmp, "%s.XXXXXX", fname);
+  fd = mkstemp(tmp);
+  if (fd < 0) {
+    perror(tmp);
+    return 1;
+  }
+  close(fd);
+  if (copy_hard(fname, tmp, 1, compress, 1, progname) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  if (chmod(tmp, st.st_mode & 07777) < 0 || rename(tmp, fname) < 0) {
+    perror(fname);
+    unlink(tmp);
+    return 1;
+  }
+  free(tmp);
+  return 0;
+}
+
+/*
+ * Merge the overlay delta file fname into its base image and remove
+ * it, or just remove it if discard.  Returns the exit status.
+ */
+int
+end_delta(const char *fname, int discard, char *progname)
+{
+  char magic[8];
+  FILE *f;
+  int ok;
+
+  f = fopen(fname, "r");
+  if (f == NULL) {
+    perror(fname);
+    return 1;
+  }
+  ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+    memcmp(magic, OVL_MAGIC, sizeof(magic)) == 0;
+  fclose(f);
+  if (!ok) {
+    fprintf(stderr, "%s: %s is not an overlay delta file\n",
+	    progname, fname);
+    return 1;
+  }
+  if (!discard && overlay_merge(fname) < 0) {
+    if (errno == ESTALE) {
+      fprintf(stderr, "%s: %s: base image has changed since the delta "
+	      "file was made\n", progname, fname);
+    } else {
+      perror(fname);
+    }
+    return 1;
+  }
+  if (unlink(fname) < 0) {
+    perror(fname);
+    return 1;
+  }
+  return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
   int jv1 = 0, jv3 = 0, dmk = 0, hard = 0;
   int cyl = -1, sec = -1, gran = -1, dir = -1, eight = 0, ignden = 0;
+  int trksec = -1, secsize = -1;
   int writeprot = 0, unprot = 0;
-  int i, c, oumask, overwrite;
-  char *fname;
+  int sparse = 0, compress = 0, compact = 0, merge = 0, discard = 0;
+  int i, c, oumask, overwrite = 0;
+  char *fname, *convert = NULL;
   FILE *f;
 
   opterr = 0;
   for (;;) {
-    c = getopt(argc, argv, "13khc:s:g:d:8ipuf");
+    c = getopt(argc, argv, "13khc:s:g:d:t:z:xC:KZMD8ipuf");
     if (c == -1) break;
     switch (c) {
     case '1':
@@ -100,6 +412,30 @@ main(int argc, char *argv[])
     case 'd':
       dir = atoi(optarg);
       break;
+    case 't':
+      trksec = atoi(optarg);
+      break;
+    case 'z':
+      secsize = atoi(optarg);
+      break;
+    case 'x':
+      sparse = 1;
+      break;
+    case 'C':
+      convert = optarg;
+      break;
+    case 'K':
+      compact = 1;
+      break;
+    case 'Z':
+      compress = 1;
+      break;
+    case 'M':
+      merge = 1;
+      break;
+    case 'D':
+      discard = 1;
+      break;
     case '8':
       eight = 1;
       break;
@@ -126,6 +462,48 @@ main(int argc, char *argv[])
 
   fname = argv[optind];
 
+  if (merge || discard) {
+    if (argc != 3) {
+      fprintf(stderr, "%s: -M and -D take no other options\n", argv[0]);
+      exit(2);
+    }
+    exit(end_delta(fname, discard, argv[0]));
+  }
+
+  if (convert || compact) {
+    if (jv1 + jv3 + dmk + hard || writeprot || unprot ||
+	cyl >= 0 || sec >= 0 || gran >= 0 || dir >= 0 ||
+	trksec >= 0 || secsize >= 0 || eight || ignden ||
+	(convert && compact)) {
+      fprintf(stderr,
+	      "%s: -C and -K take no other options but -x, -Z, and -f\n",
+	      argv[0]);
+      exit(2);
+    }
+#ifndef HAVE_ZLIB
+    if (compress) {
+      fprintf(stderr, "%s: -Z needs zlib, which this mkdisk lacks\n",
+	      argv[0]);
+      exit(2);
+    }
+#endif
+    if (convert) {
+      exit(copy_hard(convert, fname, sparse || compress, compress,
+		     overwrite, argv[0]));
+    }
+    exit(compact_hard(fname, compress, argv[0]));
+  }
+
+  if (compress) {
+    fprintf(stderr, "%s: -Z is only meaningful with -C or -K\n", argv[0]);
+    exit(2);
+  }
+
+  if (sparse && !hard) {
+    fprintf(stderr, "%s: -x is only meaningful with -h or -C\n", argv[0]);
+    exit(2);
+  }
+
   if (writeprot || unprot) {
     /* Completely different functionality here */
     struct stat st;
@@ -228,6 +606,11 @@ main(int argc, char *argv[])
     exit(2);
   }
 
+  if (!hard && (trksec >= 0 || secsize >= 0)) {
+    fprintf(stderr, "%s: -t and -z are only meaningful with -h\n", argv[0]);
+    exit(2);
+  }
+
   if (!dmk && (eight || ignden)) {
     fprintf(stderr, "%s: -8 and -i are only meaningful with -k\n", argv[0]);
     exit(2);
@@ -315,14 +698,57 @@ main(int argc, char *argv[])
     */
     time_t tt = time(0);
     struct tm *lt = localtime(&tt);
-    Uchar *rhhp;
-    int cksum;
+    int ext, size;
 
+    /* With -t or -z, record the WD1010 geometry in the xtrs extension
+       fields of the header; then sec can exceed 256 */
+    ext = trksec != -1 || secsize != -1;
+    if (trksec == -1) trksec = 32;
+    if (secsize == -1) secsize = 256;
     if (cyl == -1) cyl = 202;
-    if (sec == -1) sec = 256;
+    if (sec == -1) sec = ext ? 8 * trksec : 256;
     if (gran == -1) gran = 8;
     if (dir == -1) dir = 1;
 
+    switch (secsize) {
+    case 256:
+      size = 0;
+      break;
+    case 512:
+      size = 1;
+      break;
+    case 1024:
+      size = 2;
+      break;
+    case 128:
+      size = 3;
+      break;
+    default:
+      fprintf(stderr, "%s error: secsize must be 128, 256, 512, or 1024\n",
+	      argv[0]);
+      exit(2);
+    }
+    if (trksec < 1) {
+      fprintf(stderr, "%s error: trksec < 1\n", argv[0]);
+      exit(2);
+    }
+    if (trksec > 255) {
+      fprintf(stderr, "%s error: trksec > 255\n", argv[0]);
+      exit(2);
+    }
+    if (ext) {
+      if (sec % trksec != 0) {
+	fprintf(stderr, "%s error: sec %% trksec != 0\n", argv[0]);
+	exit(2);
+      }
+      if (sec / trksec > 8) {
+	fprintf(stderr, "%s error: sec / trksec > 8 heads\n", argv[0]);
+	exit(2);
+      }
+      fprintf(stderr, "%s warning: %s\n", argv[0],
+	      "-t and -z make a drive usable only with WD1010 emulation");
+    }
+
     if (cyl < 3) {
       fprintf(stderr, "%s error: cyl < 3\n", argv[0]);
       exit(2);
@@ -340,11 +766,11 @@ main(int argc, char *argv[])
       fprintf(stderr, "%s error: sec < 4\n", argv[0]);
       exit(2);
     }
-    if (sec > 256) {
+    if (sec > 256 && !ext) {
       fprintf(stderr, "%s error: sec > 256\n", argv[0]);
       exit(2);
     }
-    if ((sec % 32) != 0) {
+    if ((sec % 32) != 0 && !ext) {
       fprintf(stderr, "%s warning: %s\n", argv[0],
 	      "(sec % 32) != 0 is incompatible with WD1000/1010 emulation");
       if (sec > 32) {
@@ -369,7 +795,7 @@ main(int argc, char *argv[])
       fprintf(stderr, "%s error: sec %% gran != 0\n", argv[0]);
       exit(2);
     }
-    if (sec / gran > 32) {
+    if (sec / gran > 32 && sec <= 256) {
       fprintf(stderr, "%s error: sec / gran > 32\n", argv[0]);
       exit(2);
     }
@@ -397,19 +823,24 @@ main(int argc, char *argv[])
     rhh.mm = lt->tm_mon + 1;
     rhh.dd = lt->tm_mday;
     rhh.yy = lt->tm_year;
+    if (ext) {
+      rhh.xsec = trksec;
+      rhh.xsize = size;
+      rhh.xheads = sec / trksec;
+    }
     rhh.dparm = 0;
     rhh.cyl = cyl;
-    rhh.sec = sec;
+    rhh.sec = sec > 256 ? 0 : sec;
     rhh.gran = gran;
     rhh.dcyl = dir;
     strcpy(rhh.label, "xtrshard");
-
-    cksum = 0;
-    rhhp = (Uchar *) &rhh;
-    for (i=0; i<=31; i++) {
-      cksum += rhhp[i];
+    if (sparse) {
+      rhh.xfmt = HDS_FORMAT;
+      rhh.xblk = HDS_BLKSHIFT;
+      hds_set_nblk(&rhh, (hard_size(&rhh) + (1 << HDS_BLKSHIFT) - 1)
+		   >> HDS_BLKSHIFT);
     }
-    rhh.cksum = ((Uchar) cksum) ^ 0x4c;
+    hard_cksum(&rhh);
 
     f = fopen_w(fname, overwrite);
     if (f == NULL) {
@@ -417,6 +848,12 @@ main(int argc, char *argv[])
       exit(1);
     }
     fwrite(&rhh, sizeof(rhh), 1, f);
+    if (sparse) {
+      /* Empty block table */
+      for (i = 0; i < hds_get_nblk(&rhh) * HDS_ENTRY_SIZE; i++) {
+	putc(0, f);
+      }
+    }
   }
   fclose(f);
   return 0;
@@ -0,0 +1,417 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * overlay.c
+ *
+ * Copy-on-write overlays for emulated disk images; see overlay.h for
+ * the delta file format.  The functions here stand in for pread,
+ * pwrite, and ftruncate on the image.  Used by trs_disk.c and
+ * trs_hard.c with -diskoverlay, and by mkdisk to merge a delta back into
+ * its base image.
+ */
+
+#define _XOPEN_SOURCE 700 /* stdlib.h: realpath(); unistd.h: pread() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "overlay.h"
+
+#define OVL_ENTRY_SIZE 8
+#define OVL_MAXNBLK (1UL << 24)
+#define OVL_HEADROOM 64  /* extra table entries in a new delta */
+
+static unsigned long long
+get_ll(const unsigned char *p)
+{
+  unsigned long long v = 0;
+  int i;
+
+  for (i = 7; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+
+static void
+put_ll(unsigned char *p, unsigned long long v)
+{
+  int i;
+
+  for (i = 0; i < 8; i++, v >>= 8) p[i] = v;
+}
+
+/* Name of the delta file in directory dir for image file name.
+   Returned in malloc'd storage. */
+char *
+overlay_name(const char *dir, const char *name)
+{
+  const char *base = strrchr(name, '/');
+  char *p;
+
+  base = base ? base + 1 : name;
+  p = (char *) malloc(strlen(dir) + strlen(base) + sizeof(OVL_SUFFIX) + 1);
+  if (p != NULL) sprintf(p, "%s/%s%s", dir, base, OVL_SUFFIX);
+  return p;
+}
+
+/*
+ * Open the overlay in directory dir for the image file name, which is
+ * open for reading on base, creating its delta file if there is none
+ * yet.  A delta file made for a different base image, or for this one
+ * before it was last changed, is refused with errno ESTALE.  Returns
+ * NULL with errno set on error.
+ */
+Overlay *
+overlay_open(const char *dir, const char *name, int base)
+{
+  unsigned char hdr[OVL_HDR_SIZE];
+  struct stat st, dst;
+  Overlay *o = NULL;
+  char *dname, *full = NULL;
+  size_t tsize;
+  int fd, created = 0, err;
+
+  if (fstat(base, &st) < 0) return NULL;
+  full = realpath(name, NULL);
+  if (full == NULL) return NULL;
+  if (strlen(full) >= OVL_HDR_SIZE - OVL_NAME_OFFSET) {
+    free(full);
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  dname = overlay_name(dir, name);
+  if (dname == NULL) {
+    free(full);
+    return NULL;
+  }
+  fd = open(dname, O_RDWR);
+  if (fd < 0 && errno == ENOENT) {
+    fd = open(dname, O_RDWR|O_CREAT|O_EXCL, 0666);
+    created = 1;
+  }
+  if (fd < 0) goto fail;
+
+  o = (Overlay *) calloc(1, sizeof(Overlay));
+  if (o == NULL) goto fail;
+  o->fd = fd;
+  o->base = base;
+  if (created) {
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, OVL_MAGIC, 8);
+    hdr[8] = o->blkshift = OVL_BLKSHIFT;
+    o->tablepos = OVL_HDR_SIZE;
+    o->nblk = (st.st_size >> OVL_BLKSHIFT) + OVL_HEADROOM;
+    o->size = st.st_size;
+    put_ll(hdr + 16, o->tablepos);
+    put_ll(hdr + 24, o->nblk);
+    put_ll(hdr + 32, o->size);
+    put_ll(hdr + 40, st.st_size);
+    put_ll(hdr + 48, st.st_mtime);
+    strcpy((char *) hdr + OVL_NAME_OFFSET, full);
+    tsize = o->nblk * OVL_ENTRY_SIZE;
+    o->table = (unsigned char *) calloc(o->nblk, OVL_ENTRY_SIZE);
+    if (o->table == NULL ||
+	pwrite(fd, hdr, OVL_HDR_SIZE, 0) != OVL_HDR_SIZE ||
+	pwrite(fd, o->table, tsize, o->tablepos) != tsize) goto fail;
+  } else {
+    if (pread(fd, hdr, OVL_HDR_SIZE, 0) != OVL_HDR_SIZE ||
+	memcmp(hdr, OVL_MAGIC, 8) != 0 ||
+	hdr[8] < OVL_BLKSHIFT || hdr[8] > 16 ||
+	get_ll(hdr + 24) == 0 || get_ll(hdr + 24) > OVL_MAXNBLK) {
+      errno = EINVAL;
+      goto fail;
+    }
+    if (get_ll(hdr + 40) != st.st_size || get_ll(hdr + 48) != st.st_mtime ||
+	strcmp((char *) hdr + OVL_NAME_OFFSET, full) != 0) {
+      errno = ESTALE;
+      goto fail;
+    }
+    o->blkshift = hdr[8];
+    o->tablepos = get_ll(hdr + 16);
+    o->nblk = get_ll(hdr + 24);
+    o->size = get_ll(hdr + 32);
+    tsize = o->nblk * OVL_ENTRY_SIZE;
+    o->table = (unsigned char *) malloc(tsize);
+    if (o->table == NULL) goto fail;
+    if (pread(fd, o->table, tsize, o->tablepos) != tsize) {
+      errno = EINVAL;
+      goto fail;
+    }
+  }
+  o->blksize = 1 << o->blkshift;
+  o->savedsize = o->size;
+  o->buf = (unsigned char *) malloc(o->blksize);
+  if (o->buf == NULL || fstat(fd, &dst) < 0) goto fail;
+  o->end = o->tablepos + tsize;
+  if (dst.st_size > o->end) o->end = dst.st_size;
+  free(dname);
+  free(full);
+  return o;
+
+ fail:
+  err = errno;
+  if (fd >= 0) close(fd);
+  if (created && fd >= 0) unlink(dname);
+  if (o != NULL) {
+    free(o->table);
+    free(o->buf);
+    free(o);
+  }
+  free(dname);
+  free(full);
+  errno = err;
+  return NULL;
+}
+
+/* Write back the size and close the delta file; base stays open */
+void
+overlay_close(Overlay *o)
+{
+  overlay_sync(o);
+  close(o->fd);
+  free(o->table);
+  free(o->buf);
+  free(o);
+}
+
+/* Record the current size of the image in the delta file's header */
+int
+overlay_sync(Overlay *o)
+{
+  unsigned char b[8];
+
+  if (o->size == o->savedsize) return 0;
+  put_ll(b, o->size);
+  if (pwrite(o->fd, b, 8, 32) != 8) return -1;
+  o->savedsize = o->size;
+  return 0;
+}
+
+static off_t
+entry(Overlay *o, unsigned long blk)
+{
+  return blk < o->nblk ? get_ll(o->table + blk * OVL_ENTRY_SIZE) : 0;
+}
+
+/* Read n bytes at within in block blk, from the delta if it has the
+   block and otherwise from the base image */
+static int
+read_part(Overlay *o, unsigned long blk, unsigned char *buf, int within,
+	  int n)
+{
+  off_t off = entry(o, blk);
+  ssize_t res;
+
+  if (off != 0) {
+    res = pread(o->fd, buf, n, off + within);
+  } else {
+    res = pread(o->base, buf, n, ((off_t) blk << o->blkshift) + within);
+  }
+  if (res < 0) return -1;
+  if (res < n) memset(buf + res, 0, n - res);
+  return 0;
+}
+
+ssize_t
+overlay_pread(Overlay *o, void *buf, size_t len, off_t pos)
+{
+  size_t done = 0;
+
+  if (pos >= o->size) return 0;
+  if (len > o->size - pos) len = o->size - pos;
+  while (done < len) {
+    unsigned long blk = pos >> o->blkshift;
+    int within = pos & (o->blksize - 1);
+    int n = o->blksize - within;
+
+    if (n > len - done) n = len - done;
+    if (read_part(o, blk, (unsigned char *) buf + done, within, n) < 0) {
+      return -1;
+    }
+    done += n;
+    pos += n;
+  }
+  return len;
+}
+
+/* Make room in the table for block blk */
+static int
+grow_table(Overlay *o, unsigned long blk)
+{
+  unsigned char *table, b[16];
+  unsigned long nblk = o->nblk;
+  size_t tsize;
+
+  while (nblk <= blk) nblk *= 2;
+  if (nblk > OVL_MAXNBLK) {
+    errno = EFBIG;
+    return -1;
+  }
+  tsize = nblk * OVL_ENTRY_SIZE;
+  table = (unsigned char *) calloc(nblk, OVL_ENTRY_SIZE);
+  if (table == NULL) return -1;
+  memcpy(table, o->table, o->nblk * OVL_ENTRY_SIZE);
+  put_ll(b, o->end);
+  put_ll(b + 8, nblk);
+  if (pwrite(o->fd, table, tsize, o->end) != tsize ||
+      pwrite(o->fd, b, 16, 16) != 16) {
+    free(table);
+    return -1;
+  }
+  free(o->table);
+  o->table = table;
+  o->tablepos = o->end;
+  o->nblk = nblk;
+  o->end += tsize;
+  return 0;
+}
+
+/* Write buf to the image at pos, within its current size or just
+   past it */
+static int
+write_range(Overlay *o, const unsigned char *buf, size_t len, off_t pos)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    unsigned long blk = pos >> o->blkshift;
+    int within = pos & (o->blksize - 1);
+    int n = o->blksize - within;
+    off_t off;
+
+    if (n > len - done) n = len - done;
+    if (blk >= o->nblk && grow_table(o, blk) < 0) return -1;
+    off = entry(o, blk);
+    if (off == 0) {
+      /* First change to this block; copy it into the delta */
+      unsigned char *e = o->table + blk * OVL_ENTRY_SIZE;
+      if (read_part(o, blk, o->buf, 0, o->blksize) < 0) return -1;
+      memcpy(o->buf + within, buf + done, n);
+      if (pwrite(o->fd, o->buf, o->blksize, o->end) != o->blksize) return -1;
+      put_ll(e, o->end);
+      if (pwrite(o->fd, e, OVL_ENTRY_SIZE,
+		 o->tablepos + blk * OVL_ENTRY_SIZE) != OVL_ENTRY_SIZE) {
+	return -1;
+      }
+      o->end += o->blksize;
+    } else {
+      if (pwrite(o->fd, buf + done, n, off + within) != n) return -1;
+    }
+    done += n;
+    pos += n;
+    if (pos > o->size) o->size = pos;
+  }
+  return 0;
+}
+
+/* Write zeros from the current end of the image to len */
+static int
+extend(Overlay *o, off_t len)
+{
+  static const unsigned char zeros[1024];
+
+  while (o->size < len) {
+    size_t n = len - o->size;
+    if (n > sizeof(zeros)) n = sizeof(zeros);
+    if (write_range(o, zeros, n, o->size) < 0) return -1;
+  }
+  return 0;
+}
+
+ssize_t
+overlay_pwrite(Overlay *o, const void *buf, size_t len, off_t pos)
+{
+  if (extend(o, pos) < 0 ||
+      write_range(o, (const unsigned char *) buf, len, pos) < 0) {
+    return -1;
+  }
+  return len;
+}
+
+int
+overlay_truncate(Overlay *o, off_t len)
+{
+  if (len < o->size) {
+    o->size = len;
+    return 0;
+  }
+  return extend(o, len);
+}
+
+/*
+ * Copy the changed blocks in delta file delta into its base image,
+ * and give the base image the size recorded in the delta.  Returns 0
+ * if OK, or -1 with errno set on error; ESTALE means the base image
+ * has changed since the delta was made.
+ */
+int
+overlay_merge(const char *delta)
+{
+  unsigned char hdr[OVL_HDR_SIZE], *table = NULL, *buf = NULL;
+  unsigned long i, nblk;
+  off_t size, off, pos;
+  struct stat st;
+  int fd, base = -1, blksize, n, ok = 0, err;
+  size_t tsize;
+
+  fd = open(delta, O_RDONLY);
+  if (fd < 0) return -1;
+  if (pread(fd, hdr, OVL_HDR_SIZE, 0) != OVL_HDR_SIZE ||
+      memcmp(hdr, OVL_MAGIC, 8) != 0 || hdr[8] < OVL_BLKSHIFT || hdr[8] > 16 ||
+      get_ll(hdr + 24) > OVL_MAXNBLK) {
+    errno = EINVAL;
+    goto done;
+  }
+  hdr[OVL_HDR_SIZE - 1] = 0;
+  base = open((char *) hdr + OVL_NAME_OFFSET, O_RDWR);
+  if (base < 0 || fstat(base, &st) < 0) goto done;
+  if (get_ll(hdr + 40) != st.st_size || get_ll(hdr + 48) != st.st_mtime) {
+    errno = ESTALE;
+    goto done;
+  }
+  blksize = 1 << hdr[8];
+  nblk = get_ll(hdr + 24);
+  size = get_ll(hdr + 32);
+  tsize = nblk * OVL_ENTRY_SIZE;
+  table = (unsigned char *) malloc(tsize);
+  buf = (unsigned char *) malloc(blksize);
+  if (table == NULL || buf == NULL) goto done;
+  if (pread(fd, table, tsize, get_ll(hdr + 16)) != tsize) {
+    errno = EINVAL;
+    goto done;
+  }
+  for (i = 0; i < nblk; i++) {
+    off = get_ll(table + i * OVL_ENTRY_SIZE);
+    pos = (off_t) i * blksize;
+    if (off == 0 || pos >= size) continue;
+    n = size - pos < blksize ? size - pos : blksize;
+    if (pread(fd, buf, n, off) != n || pwrite(base, buf, n, pos) != n) {
+      goto done;
+    }
+  }
+  if (ftruncate(base, size) < 0 || fsync(base) < 0) goto done;
+  ok = 1;
+
+ done:
+  err = errno;
+  if (base >= 0 && close(base) < 0 && ok) {
+    err = errno;
+    ok = 0;
+  }
+  close(fd);
+  free(table);
+  free(buf);
+  errno = err;
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * overlay.h
+ *
+ * Copy-on-write overlays for emulated floppy and hard disk images.
+ * The base image is only read; every change goes to a delta file,
+ * which holds copies of the changed blocks of the image.  The delta
+ * file looks like this, with all numbers low byte first:
+ *
+ *   0 - 7:   OVL_MAGIC
+ *   8:       log2 of block size
+ *   9 - 15:  reserved, 0
+ *   16 - 23: offset of the block table
+ *   24 - 31: number of entries in the block table
+ *   32 - 39: current size of the image
+ *   40 - 47: size of the base image when the delta was made
+ *   48 - 55: modification time of the base image then
+ *   56 - 255: absolute name of the base image, ending in a 0 byte
+ *
+ * Each table entry is the 8-byte offset of a block in the delta file,
+ * or 0 if the block is unchanged from the base image.  When an image
+ * grows past the end of the table, a table twice the size is written
+ * at the end of the file and the header is pointed at it.
+ */
+
+#ifndef _OVERLAY_H
+#define _OVERLAY_H
+
+#include <sys/types.h>
+
+#define OVL_MAGIC "xtrsovl1"
+#define OVL_HDR_SIZE 256
+#define OVL_NAME_OFFSET 56
+#define OVL_BLKSHIFT 8     /* 256-byte blocks: one sector or less */
+#define OVL_SUFFIX ".ovl"
+
+typedef struct {
+  int fd;                 /* delta file */
+  int base;               /* base image, opened for reading */
+  int blkshift;
+  int blksize;
+  off_t tablepos;
+  unsigned long nblk;
+  unsigned char *table;   /* nblk entries, as in the file */
+  off_t end;              /* where the next new block goes */
+  off_t size;             /* current size of the image */
+  off_t savedsize;        /* size as last written to the header */
+  unsigned char *buf;     /* one block, for copying on write */
+} Overlay;
+
+char *overlay_name(const char *dir, const char *name);
+Overlay *overlay_open(const char *dir, const char *name, int base);
+void overlay_close(Overlay *o);
+ssize_t overlay_pread(Overlay *o, void *buf, size_t len, off_t pos);
+ssize_t overlay_pwrite(Overlay *o, const void *buf, size_t len, off_t pos);
+int overlay_truncate(Overlay *o, off_t len);
+int overlay_sync(Overlay *o);
+int overlay_merge(const char *delta);
+
+#endif
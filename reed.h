@@ -31,7 +31,20 @@ typedef struct {
   Uchar mm;        /* 12: Creation month: mm */
   Uchar dd;        /* 13: Creation day: dd */
   Uchar yy;        /* 14: Creation year: yy (offset from 1900) */
-  Uchar res1[12];  /* 15 - 26: reserved */
+  Uchar xsec;      /* 15: xtrs WD1010 emulation only: sectors per
+                          track; 0 = 32 */
+  Uchar xsize;     /* 16: xtrs WD1010 emulation only: sector size
+                          code as in the SDH register; 0 = 256,
+                          1 = 512, 2 = 1024, 3 = 128 */
+  Uchar xheads;    /* 17: xtrs WD1010 emulation only: heads;
+                          0 = sec / sectors per track */
+  Uchar xfmt;      /* 18: xtrs only: layout of the rest of the file;
+                          0 = array of sectors, 1 = sparse (see
+                          hdsparse.h) */
+  Uchar xblk;      /* 19: xtrs sparse only: log2 of block size */
+  Uchar xnblk[4];  /* 20 - 23: xtrs sparse only: number of blocks
+                          in block table, low byte first */
+  Uchar res1[3];   /* 24 - 26: reserved */
   Uchar dparm;     /* 27: Disk parameters:
                           (unused with hard drives)
 		          bit 7: Density: 0 = double, 1 = single
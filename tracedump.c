@@ -0,0 +1,345 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/* Decoder for xtrs -tracebuffer and -tracestream execution traces.
+ *
+ * Usage: tracedump [-flags] tracefile
+ *
+ * Flags: -n n    print only the last n instructions (-tracebuffer)
+ *        -t t    start at T-state t (-tracestream)
+ *        -c n    print at most n instructions
+ *        -i      print the block index instead (-tracestream)
+ *        -r      omit the register columns
+ *
+ * Each line gives a T-state count, the register pairs before the
+ * instruction executed, and the instruction as disassembled by xtrs's
+ * own disassembler.  For -tracebuffer files the count starts from the
+ * first instruction in the file; for -tracestream files it is the
+ * emulator's own T-state counter.
+ *
+ * A stream is a sequence of independently compressed blocks, each
+ * stamped with the T-state of its first instruction, so seeking to a
+ * T-state reads only the block headers up to that point and then
+ * decodes from the block containing it.
+ */
+
+#define _XOPEN_SOURCE /* unistd.h: getopt(), optarg, optind, opterr */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "dis.h"
+#include "trs_trace.h"
+
+#define ARGS "n:t:c:ir"
+
+typedef struct {
+  long offset;                 /* of the block header */
+  unsigned long long first_t;
+  unsigned long method, stored, length, events;
+} BlockInfo;
+
+static int regs = 1;
+static int context = -1;
+static unsigned long max_count = 0;  /* 0 = no limit */
+static unsigned long printed = 0;
+static char *filename;
+
+static unsigned int
+get_word(Uchar *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long
+get_long(Uchar *p)
+{
+  return get_word(p) | ((unsigned long) get_word(p + 2) << 16);
+}
+
+static void
+print_header(void)
+{
+  if (regs) {
+    printf("   T-states   af   bc   de   hl   ix   iy   sp  instruction\n");
+  }
+}
+
+static void
+print_insn(Uchar *rec, unsigned long long tstates)
+{
+  dis_insn insn;
+  char text[40];
+  int i;
+
+  if ((int) get_word(rec + 22) != context) {
+    context = get_word(rec + 22);
+    printf("-- memory context %03x --\n", context);
+  }
+  dis_decode(rec + 2, get_word(rec), &insn);
+  dis_format(&insn, text, sizeof(text), NULL, NULL);
+  printf("%11llu ", tstates);
+  if (regs) {
+    printf("%04x %04x %04x %04x %04x %04x %04x  ",
+	   get_word(rec + 6), get_word(rec + 8), get_word(rec + 10),
+	   get_word(rec + 12), get_word(rec + 14), get_word(rec + 16),
+	   get_word(rec + 18));
+  }
+  printf("%04x  ", insn.pc);
+  for (i = 0; i < 4; i++) {
+    if (i < insn.length) printf("%02x ", insn.bytes[i]);
+    else printf("   ");
+  }
+  printf(" %s\n", text);
+  printed++;
+}
+
+static void
+dump_ring(FILE *f, Uchar *header, unsigned long last)
+{
+  Uchar *rec;
+  unsigned long count, recsize, i, skip;
+  unsigned long long tstates = 0;
+
+  count = get_long(header + 8);
+  recsize = get_long(header + 12);
+  if (recsize < TRACE_RECORD_SIZE) {
+    fprintf(stderr, "%s: bad record size %lu\n", filename, recsize);
+    exit(1);
+  }
+  rec = (Uchar *) malloc(recsize);
+  skip = (last && last < count) ? count - last : 0;
+
+  print_header();
+  for (i = 0; i < count; i++) {
+    if (fread(rec, recsize, 1, f) != 1) {
+      fprintf(stderr, "%s: trace ends early\n", filename);
+      exit(1);
+    }
+    if (i > 0) tstates += get_word(rec + 20);
+    if (i < skip) continue;
+    if (max_count && printed >= max_count) break;
+    print_insn(rec, tstates);
+  }
+  free(rec);
+}
+
+/* Read the headers of all blocks in a stream */
+static BlockInfo *
+read_index(FILE *f, int *nblocks)
+{
+  Uchar hdr[STREAM_BLOCK_HEADER_SIZE];
+  BlockInfo *index = NULL;
+  int n = 0, max = 0;
+  long offset = TRACE_HEADER_SIZE;
+
+  while (fseek(f, offset, SEEK_SET) == 0 &&
+	 fread(hdr, STREAM_BLOCK_HEADER_SIZE, 1, f) == 1) {
+    if (n == max) {
+      max = max ? 2 * max : 1024;
+      index = (BlockInfo *) realloc(index, max * sizeof(BlockInfo));
+      if (index == NULL) {
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+      }
+    }
+    index[n].offset = offset;
+    index[n].method = get_long(hdr);
+    index[n].stored = get_long(hdr + 4);
+    index[n].length = get_long(hdr + 8);
+    index[n].events = get_long(hdr + 12);
+    index[n].first_t = get_long(hdr + 16) |
+      ((unsigned long long) get_long(hdr + 20) << 32);
+    offset += STREAM_BLOCK_HEADER_SIZE + index[n].stored;
+    n++;
+  }
+  *nblocks = n;
+  return index;
+}
+
+static void
+print_index(BlockInfo *index, int nblocks)
+{
+  int i;
+
+  printf(" block      offset        first T-state  events   stored   length\n");
+  for (i = 0; i < nblocks; i++) {
+    printf("%6d %11ld %20llu %7lu %8lu %8lu%s\n", i, index[i].offset,
+	   index[i].first_t, index[i].events, index[i].stored,
+	   index[i].length,
+	   index[i].method == STREAM_DEFLATE ? "" : " (stored)");
+  }
+}
+
+/* Read and decompress one block; returns its events */
+static Uchar *
+read_block(FILE *f, BlockInfo *b)
+{
+  Uchar *stored, *data;
+
+  stored = (Uchar *) malloc(b->stored);
+  data = (Uchar *) malloc(b->length);
+  if (stored == NULL || data == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  if (fseek(f, b->offset + STREAM_BLOCK_HEADER_SIZE, SEEK_SET) != 0 ||
+      fread(stored, b->stored, 1, f) != 1) {
+    fprintf(stderr, "%s: trace ends early\n", filename);
+    exit(1);
+  }
+  if (b->method == STREAM_STORED) {
+    free(data);
+    return stored;
+  }
+#ifdef HAVE_ZLIB
+  if (b->method == STREAM_DEFLATE) {
+    uLongf len = b->length;
+    if (uncompress(data, &len, stored, b->stored) == Z_OK &&
+	len == b->length) {
+      free(stored);
+      return data;
+    }
+    fprintf(stderr, "%s: corrupt block at offset %ld\n", filename, b->offset);
+    exit(1);
+  }
+#endif
+  fprintf(stderr, "%s: unsupported compression method %lu\n",
+	  filename, b->method);
+  exit(1);
+}
+
+static void
+dump_stream(FILE *f, unsigned long long start, int show_index)
+{
+  BlockInfo *index;
+  int nblocks, i, first;
+  unsigned long e;
+  unsigned long long tstates = 0;
+  int seen_insn, printing = 0;
+  Uchar *data, *p;
+
+  index = read_index(f, &nblocks);
+  if (show_index) {
+    print_index(index, nblocks);
+    return;
+  }
+
+  /* The last block that starts at or before the requested T-state */
+  for (first = 0; first + 1 < nblocks; first++) {
+    if (index[first + 1].first_t > start) break;
+  }
+
+  print_header();
+  for (i = first; i < nblocks; i++) {
+    data = read_block(f, &index[i]);
+    seen_insn = 0;
+    p = data;
+    for (e = 0; e < index[i].events; e++) {
+      if (p >= data + index[i].length) break;
+      switch (*p++) {
+      case STREAM_INSN:
+	tstates = seen_insn ? tstates + get_word(p + 20) : index[i].first_t;
+	seen_insn = 1;
+	if (tstates >= start) printing = 1;
+	if (printing) {
+	  if (max_count && printed >= max_count) {
+	    free(data);
+	    return;
+	  }
+	  print_insn(p, tstates);
+	}
+	p += TRACE_RECORD_SIZE;
+	break;
+      case STREAM_MEMW:
+	if (printing) {
+	  printf("%11s ; write %04x <- %02x\n", "", get_word(p), p[2]);
+	}
+	p += 3;
+	break;
+      case STREAM_OUT:
+	if (printing) printf("%11s ; out   %02x <- %02x\n", "", p[0], p[1]);
+	p += 2;
+	break;
+      case STREAM_IN:
+	if (printing) printf("%11s ; in    %02x -> %02x\n", "", p[0], p[1]);
+	p += 2;
+	break;
+      default:
+	fprintf(stderr, "%s: bad event type %d in block %d\n",
+		filename, p[-1], i);
+	exit(1);
+      }
+    }
+    free(data);
+  }
+}
+
+int
+main(int argc, char* argv[])
+{
+  FILE* f;
+  Uchar header[TRACE_HEADER_SIZE];
+  unsigned long last = 0;
+  unsigned long long start = 0;
+  int show_index = 0;
+  int c, errflg = 0;
+
+  optarg = NULL;
+  while (!errflg && (c = getopt(argc, argv, ARGS)) != -1) {
+    switch (c) {
+    case 'n':
+      last = strtoul(optarg, NULL, 0);
+      break;
+    case 't':
+      start = strtoull(optarg, NULL, 0);
+      break;
+    case 'c':
+      max_count = strtoul(optarg, NULL, 0);
+      break;
+    case 'i':
+      show_index = 1;
+      break;
+    case 'r':
+      regs = 0;
+      break;
+    default:
+      errflg++;
+      break;
+    }
+  }
+
+  if (errflg || argc != optind + 1) {
+    fprintf(stderr, "Usage: %s [-%s] tracefile\n", argv[0], ARGS);
+    exit(1);
+  }
+
+  filename = argv[optind];
+  f = fopen(filename, "rb");
+  if (f == NULL) {
+    perror(filename);
+    exit(1);
+  }
+  if (fread(header, TRACE_HEADER_SIZE, 1, f) != 1) {
+    fprintf(stderr, "%s: not an xtrs trace file\n", filename);
+    exit(1);
+  }
+  if (memcmp(header, TRACE_MAGIC, 8) == 0) {
+    dump_ring(f, header, last);
+  } else if (memcmp(header, TRACE_STREAM_MAGIC, 8) == 0) {
+    dump_stream(f, start, show_index);
+  } else {
+    fprintf(stderr, "%s: not an xtrs trace file\n", filename);
+    exit(1);
+  }
+  return 0;
+}
@@ -112,6 +112,7 @@ void trs_timer_init(void);
 void trs_timer_off(void);
 void trs_timer_on(void);
 void trs_timer_speed(int flag);
+extern long lost_timer_interrupts;
 void trs_cassette_rise_interrupt(int dummy);
 void trs_cassette_fall_interrupt(int dummy);
 void trs_cassette_clear_interrupts(void);
@@ -124,16 +125,17 @@ void trs_cassette_reset(void);
 const char *trs_disk_get_name(int drive);
 int trs_disk_set_name(int drive, const char *newname);
 int trs_disk_create(const char *newname);
-void trs_disk_change_all(void);
+void trs_disk_change_all(int force);
 void trs_disk_debug(void);
 int trs_disk_motoroff(void);
 
-void trs_change_all(void);
+void trs_change_all(int force);
 
 void mem_video_page(int which);
 void mem_bank(int which);
 void mem_map(int which);
 void mem_romin(int state);
+int mem_context(void);
 
 void trs_debug(void);
 
@@ -177,7 +179,7 @@ int stringy_create(const char *name);
 int stringy_in(int unit);
 void stringy_out(int unit, int value);
 void stringy_reset(void);
-void stringy_change_all(void);
+void stringy_change_all(int force);
 
 int put_twobyte(Ushort n, FILE* f);
 int put_fourbyte(Uint n, FILE* f);
@@ -0,0 +1,253 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_aio.c
+ *
+ * Thread pool for asynchronous host file I/O; see trs_aio.h.  The
+ * threads are started on the first request.  Requests are started in
+ * the order they were submitted, but with several threads they can
+ * finish in any order, just as with POSIX aio.  All request state is
+ * guarded by aio_lock.
+ */
+
+#define _XOPEN_SOURCE 500 /* unistd.h: pread(), pwrite() */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trs_aio.h"
+
+/* Request states */
+#define AIO_FREE    0
+#define AIO_QUEUED  1
+#define AIO_RUNNING 2
+#define AIO_DONE    3
+
+typedef struct {
+  int state;
+  int op;
+  int fd;
+  unsigned char *buf;
+  size_t len;
+  off_t offset;
+  unsigned long seq;     /* order of submission */
+  ssize_t res;
+  int err;
+} AioRequest;
+
+static AioRequest aio[AIO_MAX];
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t aio_finished = PTHREAD_COND_INITIALIZER;
+static unsigned long aio_seq;
+static int aio_started;
+
+/* Oldest queued request, or NULL */
+static AioRequest *
+next_request(void)
+{
+  AioRequest *r = NULL;
+  int i;
+
+  for (i = 0; i < AIO_MAX; i++) {
+    if (aio[i].state == AIO_QUEUED && (r == NULL || aio[i].seq < r->seq)) {
+      r = &aio[i];
+    }
+  }
+  return r;
+}
+
+static void *
+aio_thread(void *arg)
+{
+  AioRequest *r;
+  ssize_t res;
+
+  pthread_mutex_lock(&aio_lock);
+  for (;;) {
+    while ((r = next_request()) == NULL) {
+      pthread_cond_wait(&aio_queued, &aio_lock);
+    }
+    r->state = AIO_RUNNING;
+    pthread_mutex_unlock(&aio_lock);
+
+    switch (r->op) {
+    case AIO_READ:
+      res = pread(r->fd, r->buf, r->len, r->offset);
+      break;
+    case AIO_WRITE:
+      res = pwrite(r->fd, r->buf, r->len, r->offset);
+      break;
+    default:
+      res = fsync(r->fd);
+      break;
+    }
+
+    pthread_mutex_lock(&aio_lock);
+    r->res = res;
+    r->err = res < 0 ? errno : 0;
+    r->state = AIO_DONE;
+    pthread_cond_broadcast(&aio_finished);
+  }
+  return NULL;
+}
+
+/* Let writes in progress finish before xtrs exits */
+static void
+aio_exit(void)
+{
+  int i;
+
+  pthread_mutex_lock(&aio_lock);
+  for (i = 0; i < AIO_MAX; i++) {
+    while (aio[i].state == AIO_QUEUED || aio[i].state == AIO_RUNNING) {
+      pthread_cond_wait(&aio_finished, &aio_lock);
+    }
+  }
+  pthread_mutex_unlock(&aio_lock);
+}
+
+static int
+aio_start(void)
+{
+  pthread_t thread;
+  int i, n = 0;
+
+  for (i = 0; i < AIO_THREADS; i++) {
+    if (pthread_create(&thread, NULL, aio_thread, NULL) == 0) {
+      pthread_detach(thread);
+      n++;
+    }
+  }
+  if (n == 0) return -1;
+  atexit(aio_exit);
+  aio_started = 1;
+  return 0;
+}
+
+/*
+ * Queue an operation on host file descriptor fd: for AIO_WRITE, write
+ * len bytes from data at offset; for AIO_READ, read up to len bytes
+ * at offset; for AIO_FSYNC, len and offset are unused.  Returns the
+ * request id, or -1 with errno set (EAGAIN if AIO_MAX requests are
+ * already in flight).
+ */
+int
+trs_aio_submit(int op, int fd, const void *data, size_t len, off_t offset)
+{
+  AioRequest *r;
+  unsigned char *buf = NULL;
+  int i;
+
+  if (op != AIO_READ && op != AIO_WRITE && op != AIO_FSYNC) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (op != AIO_FSYNC) {
+    buf = (unsigned char *) malloc(len ? len : 1);
+    if (buf == NULL) return -1;
+    if (op == AIO_WRITE) memcpy(buf, data, len);
+  }
+  pthread_mutex_lock(&aio_lock);
+  if (!aio_started && aio_start() < 0) {
+    pthread_mutex_unlock(&aio_lock);
+    free(buf);
+    errno = EAGAIN;
+    return -1;
+  }
+  for (i = 0; i < AIO_MAX && aio[i].state != AIO_FREE; i++) ;
+  if (i == AIO_MAX) {
+    pthread_mutex_unlock(&aio_lock);
+    free(buf);
+    errno = EAGAIN;
+    return -1;
+  }
+  r = &aio[i];
+  r->op = op;
+  r->fd = fd;
+  r->buf = buf;
+  r->len = len;
+  r->offset = offset;
+  r->seq = aio_seq++;
+  r->state = AIO_QUEUED;
+  pthread_cond_signal(&aio_queued);
+  pthread_mutex_unlock(&aio_lock);
+  return i + 1;
+}
+
+/*
+ * Check whether request id, or any request if id is 0, has finished,
+ * waiting for it if wait.  Returns the id of the finished request, 0
+ * if it is still in progress, or -1 with errno EINVAL if there is no
+ * such request (for id 0, no request in flight at all).
+ */
+int
+trs_aio_done(int id, int wait)
+{
+  int i, found;
+
+  if (id < 0 || id > AIO_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&aio_lock);
+  for (;;) {
+    found = 0;
+    for (i = 0; i < AIO_MAX; i++) {
+      if ((id == 0 || id == i + 1) && aio[i].state != AIO_FREE) {
+	found = 1;
+	if (aio[i].state == AIO_DONE) {
+	  pthread_mutex_unlock(&aio_lock);
+	  return i + 1;
+	}
+      }
+    }
+    if (!found) {
+      pthread_mutex_unlock(&aio_lock);
+      errno = EINVAL;
+      return -1;
+    }
+    if (!wait) break;
+    pthread_cond_wait(&aio_finished, &aio_lock);
+  }
+  pthread_mutex_unlock(&aio_lock);
+  return 0;
+}
+
+/*
+ * Outcome of finished request id: the count or -1 that pread, pwrite,
+ * or fsync returned, with its errno in *err.  For AIO_READ, *buf is
+ * set to the data read; otherwise to NULL.  Valid until
+ * trs_aio_free.
+ */
+ssize_t
+trs_aio_result(int id, int *err, unsigned char **buf)
+{
+  AioRequest *r = &aio[id - 1];
+
+  /* A finished request is no longer touched by the threads */
+  *err = r->err;
+  *buf = r->op == AIO_READ ? r->buf : NULL;
+  return r->res;
+}
+
+void
+trs_aio_free(int id)
+{
+  AioRequest *r = &aio[id - 1];
+
+  pthread_mutex_lock(&aio_lock);
+  free(r->buf);
+  r->buf = NULL;
+  r->state = AIO_FREE;
+  pthread_mutex_unlock(&aio_lock);
+}
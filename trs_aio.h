@@ -0,0 +1,38 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_aio.h
+ *
+ * Host file I/O done by a pool of threads, so that the emulator can
+ * go on running while it waits; used by the emt_aio emulator traps
+ * in trs_imp_exp.c.  Each request has its own buffer: the data to
+ * write is copied when the request is submitted, and data read stays
+ * in the buffer until the emulator thread collects it.
+ */
+
+#ifndef _TRS_AIO_H
+#define _TRS_AIO_H
+
+#include <sys/types.h>
+
+#define AIO_MAX     16   /* requests in flight; ids are 1..AIO_MAX */
+#define AIO_THREADS 4
+
+/* Operations */
+#define AIO_READ  0      /* pread */
+#define AIO_WRITE 1      /* pwrite */
+#define AIO_FSYNC 2
+
+int trs_aio_submit(int op, int fd, const void *data, size_t len,
+		   off_t offset);
+int trs_aio_done(int id, int wait);
+ssize_t trs_aio_result(int id, int *err, unsigned char **buf);
+void trs_aio_free(int id);
+
+#endif
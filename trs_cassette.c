@@ -59,6 +59,7 @@
 
 #include "trs.h"
 #include "z80.h"
+#include "trs_metrics.h"
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
@@ -318,6 +319,7 @@ get_fourbyte(Uint *pp, FILE* f)
 static void
 put_sample(Uchar sample, int convert, FILE* f)
 {
+  trs_metrics.cassette_samples++;
   if (convert) {
 #if HAVE_OSS
     switch (cassette_afmt) {
@@ -342,6 +344,7 @@ put_sample(Uchar sample, int convert, FILE* f)
 static int
 get_sample(int convert, FILE* f)
 {
+  trs_metrics.cassette_samples++;
 #if HAVE_OSS
   if (convert) {
     int ret = 0;
@@ -0,0 +1,190 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_cover.c
+ *
+ * Code coverage.  Each memory context gets an 8K bitmap with one bit
+ * per address, allocated the first time the context is seen.
+ * trs_memory.c calls trs_cover_remap whenever the mapping changes,
+ * so z80_run only has to set a bit in the current bitmap.
+ *
+ * With -coverbranches, each conditional branch (jr cc, jp cc, call
+ * cc, ret cc, djnz) is resolved at the start of the next instruction
+ * by comparing the new PC, or for ret cc the new SP, with the two
+ * possible outcomes.  If neither matches, an interrupt intervened and
+ * the outcome is not recorded.  The repeating block instructions are
+ * not counted as branches, since z80.c runs each to completion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "z80.h"
+#include "trs.h"
+#include "dis.h"
+#include "trs_cover.h"
+
+#define COVER_CONTEXTS 4096   /* mem_context() is 12 bits */
+#define COVER_MAP_SIZE (0x10000 / 8)
+
+char *trs_cover_file = NULL;
+int trs_cover_branches = 0;
+Uchar *trs_cover_map = NULL;
+
+typedef struct {
+  Uchar *exec;
+  Uchar *taken;        /* branch went to its target */
+  Uchar *fell;         /* branch fell through */
+} CoverMaps;
+
+static CoverMaps maps[COVER_CONTEXTS];
+static CoverMaps *cur_maps;
+
+/* Length of each unprefixed conditional branch; 0 if not one */
+static Uchar cond_length[256];
+
+/* The conditional branch awaiting its outcome, if any */
+static CoverMaps *br_maps;
+static Ushort br_pc, br_next, br_sp;
+static int br_target;  /* -1 for ret cc */
+
+static Uchar *
+cover_alloc(void)
+{
+  Uchar *map = (Uchar *) calloc(COVER_MAP_SIZE, 1);
+  if (map == NULL) fatal("out of memory in code coverage");
+  return map;
+}
+
+void
+trs_cover_remap(void)
+{
+  if (trs_cover_file == NULL) return;
+  cur_maps = &maps[mem_context() % COVER_CONTEXTS];
+  if (cur_maps->exec == NULL) {
+    cur_maps->exec = cover_alloc();
+    if (trs_cover_branches) {
+      cur_maps->taken = cover_alloc();
+      cur_maps->fell = cover_alloc();
+    }
+  }
+  trs_cover_map = cur_maps->exec;
+}
+
+static void
+cover_exit(void)
+{
+  FILE *f;
+
+  f = fopen(trs_cover_file, "w");
+  if (f == NULL) {
+    error("could not write coverage %s", trs_cover_file);
+    return;
+  }
+  trs_cover_dump(f);
+  fclose(f);
+}
+
+void
+trs_cover_init(void)
+{
+  Uchar op[4] = { 0, 0, 0, 0 };
+  dis_insn insn;
+  int i;
+
+  if (trs_cover_file == NULL) return;
+  for (i = 0; i < 256; i++) {
+    op[0] = i;
+    dis_decode(op, 0, &insn);
+    if (insn.flow & DIS_COND) cond_length[i] = insn.length;
+  }
+  trs_cover_remap();
+  atexit(cover_exit);
+}
+
+static int
+cover_byte(int address)
+{
+  /* Avoid mem_read here; it could disturb a memory-mapped device */
+  Uchar *p = mem_pointer(address & 0xffff, 0);
+  return p ? *p : -1;
+}
+
+void
+trs_cover_branch(void)
+{
+  Ushort pc = REG_PC;
+  int op, taken;
+
+  if (br_maps != NULL) {
+    if (br_target < 0) {
+      taken = (REG_SP == ((br_sp + 2) & 0xffff)) ? 1 :
+	(REG_SP == br_sp && pc == br_next) ? 0 : -1;
+    } else {
+      taken = (pc == br_target) ? 1 : (pc == br_next) ? 0 : -1;
+    }
+    if (taken == 1) {
+      br_maps->taken[br_pc >> 3] |= 1 << (br_pc & 7);
+    } else if (taken == 0) {
+      br_maps->fell[br_pc >> 3] |= 1 << (br_pc & 7);
+    }
+    br_maps = NULL;
+  }
+
+  op = cover_byte(pc);
+  if (op < 0 || cond_length[op] == 0) return;
+  br_maps = cur_maps;
+  br_pc = pc;
+  br_next = pc + cond_length[op];
+  br_sp = REG_SP;
+  if ((op & 0xc7) == 0xc0) {
+    br_target = -1;
+  } else if (cond_length[op] == 2) {
+    br_target = (br_next + (signed char) cover_byte(pc + 1)) & 0xffff;
+  } else {
+    br_target = cover_byte(pc + 1) | (cover_byte(pc + 2) << 8);
+  }
+}
+
+static int
+cover_test(Uchar *map, int address)
+{
+  return map != NULL && (map[address >> 3] & (1 << (address & 7)));
+}
+
+/* Write one line per executed address: context and address in hex,
+   then for a conditional branch T if it was taken and/or N if it
+   fell through. */
+void
+trs_cover_dump(FILE *f)
+{
+  int ctx, addr;
+  unsigned long count;
+
+  fprintf(f, "# xtrs coverage: context address [T][N]\n");
+  for (ctx = 0; ctx < COVER_CONTEXTS; ctx++) {
+    if (maps[ctx].exec == NULL) continue;
+    count = 0;
+    for (addr = 0; addr < 0x10000; addr++) {
+      if (cover_test(maps[ctx].exec, addr)) count++;
+    }
+    fprintf(f, "# context %03x: %lu addresses\n", ctx, count);
+    for (addr = 0; addr < 0x10000; addr++) {
+      if (!cover_test(maps[ctx].exec, addr)) continue;
+      fprintf(f, "%03x %04x", ctx, addr);
+      if (cover_test(maps[ctx].taken, addr) ||
+	  cover_test(maps[ctx].fell, addr)) {
+	fprintf(f, " %s%s", cover_test(maps[ctx].taken, addr) ? "T" : "",
+		cover_test(maps[ctx].fell, addr) ? "N" : "");
+      }
+      fputc('\n', f);
+    }
+  }
+}
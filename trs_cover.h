@@ -0,0 +1,39 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_cover.h
+ *
+ * Code coverage of emulated Z80 programs: which addresses were
+ * executed as the start of an instruction, and optionally which
+ * conditional branches were taken and which fell through, kept
+ * separately for each memory context (see mem_context).
+ */
+
+#ifndef _TRS_COVER_H
+#define _TRS_COVER_H
+
+#include <stdio.h>
+#include "z80.h"
+
+extern char *trs_cover_file;       /* NULL if coverage is off */
+extern int trs_cover_branches;     /* option: also record branches */
+
+/* The executed-address bitmap for the current memory context, or
+   NULL if coverage is off.  z80_run sets one bit per instruction. */
+extern Uchar *trs_cover_map;
+
+#define COVER_EXEC(pc) \
+    (trs_cover_map[(pc) >> 3] |= 1 << ((pc) & 7))
+
+void trs_cover_init(void);
+void trs_cover_remap(void);   /* after any change to mem_context() */
+void trs_cover_branch(void);  /* before each instruction, if branches */
+void trs_cover_dump(FILE *f);
+
+#endif /*_TRS_COVER_H*/
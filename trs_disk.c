@@ -34,6 +34,9 @@
 #include "trs.h"
 #include "trs_disk.h"
 #include "trs_hard.h"
+#include "trs_metrics.h"
+#include "overlay.h"
+#include "trs_watch.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <time.h>
@@ -43,6 +46,9 @@
 #include <unistd.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "crc.c"
 
@@ -62,6 +68,12 @@ char *trs_disk_dir = DISKDIR;
 static int trs_disk_needchange = 0;
 float trs_disk_holewidth = 0.01;
 int trs_disk_truedam = 0;
+static tstate_t trs_disk_spun = 0; /* rotation skipped by fast disk */
+int trs_disk_mmap = 0;
+int trs_disk_msync = TRSDISK_MSYNC_NONE;
+int trs_disk_ram = 0;
+int trs_disk_ram_interval = TRSDISK_RAM_INTERVAL;
+char *trs_disk_overlay = NULL;
 int trs_disk_debug_flags = 0;
 char *trs_disk_name[NDRIVES];
 
@@ -119,6 +131,10 @@ FDCState state, other_state;
 #define GAP1ANGLE 0.020 
 #define GAP4ANGLE 0.050
 
+/* With fast disk, the delay (T-states) that replaces seek times and
+   rotational waits, so that the guest still sees BUSY briefly */
+#define FAST_TSTATES 64
+
 /* How long does emulated motor stay on after drive selected? (us of
    emulated time) */
 #define MOTOR_USEC 2000000
@@ -268,8 +284,29 @@ typedef struct {
 #define dmk_incr(d) \
   (((d)->u.dmk.ignden || (d)->u.dmk.sden || state.density) ? 1 : 2)
 
+/* Tracks cached per DMK drive */
+#define DMK_CACHE_TRACKS  16
+
+/* An ID found by parsing a DMK track header; see dmk_index */
+typedef struct {
+  unsigned char track, side, sector, size;
+  unsigned short crc;             /* 0 if the ID's CRC is good */
+  short slot;                     /* index of its pointer in the header */
+  short data;                     /* index in buf of the byte after the ID */
+} DMKSector;
+
+typedef struct {
+  int track, side;                /* -1/-1 if unused */
+  int dirty;                      /* buf differs from the file */
+  unsigned long used;             /* LRU clock value at last use */
+  int nsecs[2];                   /* IDs in secs[density], or -1 if stale */
+  DMKSector secs[2][DMK_TKHDR_SIZE / 2];
+  unsigned char buf[DMK_TRACKLEN_MAX];
+} DMKTrack;
+
 typedef struct {
   int ntracks;                    /* max number of tracks formatted */
+  int filetracks;                 /* ntracks in the file's header */
   int tracklen;                   /* bytes reserved per track in file */
   int nsides;                     /* 1 or 2 (single-sided flag in header) */
   int sden;                       /* single-density-only flag in header */
@@ -277,7 +314,10 @@ typedef struct {
   int curtrack, curside;          /* track/side in track buffer, or -1/-1 */
   int curbyte;                    /* index in buf for current op */
   int nextidam;                   /* index in buf to put next idam */
-  unsigned char buf[DMK_TRACKLEN_MAX];
+  unsigned char *buf;             /* cur->buf */
+  DMKTrack *cur;                  /* cache entry for curtrack/curside */
+  DMKTrack *cache;                /* DMK_CACHE_TRACKS entries */
+  unsigned long clock;
 } DMKState;
 
 typedef struct {
@@ -286,8 +326,25 @@ typedef struct {
   int emutype;
   int inches;                     /* 5 or 8, as seen by TRS-80 */
   int real_step;                  /* 1=normal, 2=double-step if REAL */
+  int fast;                       /* skip seek and rotational delays */
   char *name;
   FILE* file;
+  int backend;                    /* how file is accessed; see below */
+  int mapprot;                    /* PROT_READ, plus PROT_WRITE if r+ */
+  unsigned char *map;             /* first maplen bytes of file, or NULL */
+  off_t maplen;
+  unsigned char *ram;             /* whole image if DISK_RAM */
+  off_t ramcap;                   /* bytes allocated for ram */
+  char *ramname;                  /* file to write ram back to, with
+				     symbolic links resolved */
+  mode_t rammode;                 /* its permissions */
+  ino_t ramino;                   /* inode and mtime as last written back */
+  time_t rammtime;
+  int dirty;                      /* ram changed since written back */
+  Overlay *ov;                    /* if DISK_OVERLAY */
+  int watch;                      /* trs_watch handle for name */
+  off_t size;                     /* current file size if not stdio */
+  off_t pos;                      /* current file position if not stdio */
   union {
     JV3State jv3;                 /* valid if emutype = JV3 */
     RealState real;               /* valid if emutype = REAL */
@@ -295,6 +352,12 @@ typedef struct {
   } u;
 } DiskState;
 
+/* Values for backend above */
+#define DISK_STDIO 0
+#define DISK_MMAP  1              /* -diskmmap */
+#define DISK_RAM   2              /* -diskram */
+#define DISK_OVERLAY 3            /* -diskoverlay */
+
 DiskState disk[NDRIVES];
 
 /* Emulate interleave in JV1 mode */
@@ -311,6 +374,654 @@ void real_readtrk();
 void real_writetrk();
 int real_check_empty(DiskState *d);
 
+/*
+ * Image file access.  Normally these are just the stdio calls on
+ * d->file.  With -diskmmap, emulated images are instead mapped
+ * MAP_SHARED once they are opened, so that reading or writing a byte
+ * of sector data is a memory access rather than a stdio call, and the
+ * fflush after each sector write becomes an msync as selected by
+ * -diskmsync.  Since the mapping is shared, bytes written to it are in
+ * the host's page cache at once, just as after an fflush.  If an
+ * image grows (JV3 sectors added or DMK tracks formatted), the bytes
+ * beyond the mapping are read and written with pread and pwrite, and
+ * the mapping is extended on the next seek.
+ *
+ * With -diskram, the whole image is instead read into memory when it
+ * is opened, and all later reads and writes are served from there.
+ * A modified image is written back every -diskraminterval seconds by
+ * a background thread, and also when the disk is changed and when
+ * xtrs exits.  Each write-back goes to a temporary file that is then
+ * renamed over the image, so a crash leaves either the old image or
+ * the new one, never a mixture.  If the drive's name is a symbolic
+ * link, the file it points to is the one replaced.  ram_lock must be
+ * held to store into an image and set dirty, to resize or free an
+ * image, or to copy it and clear dirty; the lock is only contended
+ * while the writer is copying.
+ *
+ * With -diskoverlay, the image file is only opened for reading, and all
+ * access goes through a copy-on-write overlay (see overlay.c) whose
+ * delta file holds the changed blocks.  The other two options do not
+ * apply then.
+ */
+static pthread_mutex_t ram_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ram_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t ram_thread;
+static int ram_started;
+
+static void
+disk_unmap(DiskState *d)
+{
+  if (d->map != NULL) {
+    munmap(d->map, d->maplen);
+    d->map = NULL;
+  }
+  d->maplen = 0;
+}
+
+static int
+disk_map(DiskState *d)
+{
+  void *map;
+
+  disk_unmap(d);
+  if (d->size == 0) return 0;
+  map = mmap(NULL, d->size, d->mapprot, MAP_SHARED, fileno(d->file), 0);
+  if (map == MAP_FAILED) {
+    error("could not map %s: %s; using stdio", d->name, strerror(errno));
+    d->backend = DISK_STDIO;
+    return -1;
+  }
+  d->map = (unsigned char *) map;
+  d->maplen = d->size;
+  return 0;
+}
+
+/* Write the in-memory image back to its file if it has changed.
+   Called from either thread.  Returns -1 if it could not be written. */
+static int
+ram_writeback(DiskState *d)
+{
+  unsigned char *copy;
+  char *name, *tmp;
+  struct stat st;
+  off_t len, done;
+  mode_t mode;
+  ssize_t res;
+  int fd, ok;
+
+  pthread_mutex_lock(&ram_io_lock);
+  pthread_mutex_lock(&ram_lock);
+  if (d->backend != DISK_RAM || !d->dirty ||
+      (copy = (unsigned char *) malloc(d->size + 1)) == NULL) {
+    ok = d->backend != DISK_RAM || !d->dirty;
+    pthread_mutex_unlock(&ram_lock);
+    pthread_mutex_unlock(&ram_io_lock);
+    return ok ? 0 : -1;
+  }
+  d->dirty = 0;
+  len = d->size;
+  memcpy(copy, d->ram, len);
+  name = d->ramname;
+  mode = d->rammode;
+  pthread_mutex_unlock(&ram_lock);
+
+  /* The name cannot change or be freed while we hold ram_io_lock */
+  tmp = (char *) malloc(strlen(name) + 5);
+  sprintf(tmp, "%s.tmp", name);
+  fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+  ok = fd >= 0;
+  for (done = 0; ok && done < len; done += res) {
+    res = write(fd, copy + done, len - done);
+    if (res <= 0) ok = 0;
+  }
+  if (ok) ok = fchmod(fd, mode & 07777) == 0 && fsync(fd) == 0;
+  if (ok && fstat(fd, &st) == 0) {
+    /* Recorded before the rename, so that trs_disk_change_all can
+       never see the new file without knowing it is ours */
+    pthread_mutex_lock(&ram_lock);
+    d->ramino = st.st_ino;
+    d->rammtime = st.st_mtime;
+    pthread_mutex_unlock(&ram_lock);
+  }
+  if (fd >= 0 && close(fd) != 0) ok = 0;
+  if (ok) ok = rename(tmp, name) == 0;
+  if (!ok) {
+    error("could not write back %s: %s", name, strerror(errno));
+    if (fd >= 0) unlink(tmp);
+    pthread_mutex_lock(&ram_lock);
+    d->dirty = 1;
+    pthread_mutex_unlock(&ram_lock);
+  }
+  free(tmp);
+  free(copy);
+  pthread_mutex_unlock(&ram_io_lock);
+  return ok ? 0 : -1;
+}
+
+static void *
+ram_writer(void *arg)
+{
+  int i;
+
+  for (;;) {
+    sleep(trs_disk_ram_interval);
+    for (i = 0; i < NDRIVES; i++) {
+      ram_writeback(&disk[i]);
+    }
+  }
+  return NULL;
+}
+
+static void
+ram_start(void)
+{
+  sigset_t all, old;
+
+  ram_started = 1;
+  if (trs_disk_ram_interval <= 0) return;
+
+  /* The writer thread must not take the emulator's signals */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  if (pthread_create(&ram_thread, NULL, ram_writer, NULL) != 0) {
+    error("can't start disk write-back thread; "
+	  "writing back only on disk change and exit");
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Read a whole image into memory; on failure leave it on stdio */
+static void
+disk_ram_open(DiskState *d)
+{
+  struct stat st;
+  unsigned char *ram;
+  char *target;
+  off_t done;
+  ssize_t res;
+
+  /* Write back to the image itself, not over a link to it */
+  target = realpath(d->name, NULL);
+  if (target == NULL) {
+    error("could not load %s into memory; using stdio", d->name);
+    return;
+  }
+  if (fstat(fileno(d->file), &st) < 0 ||
+      (ram = (unsigned char *) malloc(st.st_size + 1)) == NULL) {
+    error("could not load %s into memory; using stdio", d->name);
+    free(target);
+    return;
+  }
+  for (done = 0; done < st.st_size; done += res) {
+    res = pread(fileno(d->file), ram + done, st.st_size - done, done);
+    if (res <= 0) {
+      error("could not load %s into memory; using stdio", d->name);
+      free(ram);
+      free(target);
+      return;
+    }
+  }
+  pthread_mutex_lock(&ram_lock);
+  d->ram = ram;
+  d->ramcap = st.st_size + 1;
+  d->ramname = target;
+  d->rammode = st.st_mode;
+  d->ramino = 0;
+  d->rammtime = 0;
+  d->dirty = 0;
+  d->size = st.st_size;
+  d->pos = 0;
+  d->backend = DISK_RAM;
+  pthread_mutex_unlock(&ram_lock);
+  if (!ram_started) ram_start();
+}
+
+/* Store len bytes at d->pos, growing the image if needed */
+static size_t
+ram_store(DiskState *d, const void *ptr, size_t len)
+{
+  off_t end = d->pos + len, cap;
+  unsigned char *ram;
+
+  pthread_mutex_lock(&ram_lock);
+  if (end > d->ramcap) {
+    for (cap = d->ramcap * 2; cap < end; cap *= 2) ;
+    ram = (unsigned char *) realloc(d->ram, cap);
+    if (ram == NULL) {
+      pthread_mutex_unlock(&ram_lock);
+      return 0;
+    }
+    d->ram = ram;
+    d->ramcap = cap;
+  }
+  if (d->pos > d->size) memset(d->ram + d->size, 0, d->pos - d->size);
+  memcpy(d->ram + d->pos, ptr, len);
+  d->pos = end;
+  if (end > d->size) d->size = end;
+  d->dirty = 1;
+  pthread_mutex_unlock(&ram_lock);
+  return len;
+}
+
+/* Switch an open emulated image over to the selected backend */
+static void
+disk_backend_open(DiskState *d, int rdonly)
+{
+  struct stat st;
+
+  if (d->backend == DISK_OVERLAY) return;
+  d->backend = DISK_STDIO;
+  if (trs_disk_ram) {
+    disk_ram_open(d);
+  } else if (trs_disk_mmap && fstat(fileno(d->file), &st) == 0) {
+    d->backend = DISK_MMAP;
+    d->mapprot = rdonly ? PROT_READ : PROT_READ|PROT_WRITE;
+    d->size = st.st_size;
+    d->pos = 0;
+    disk_map(d);
+  }
+}
+
+/* Write back and release an image before its file is closed */
+static int
+disk_backend_close(DiskState *d)
+{
+  int res = 0;
+
+  if (d->backend == DISK_RAM) {
+    res = ram_writeback(d);
+    pthread_mutex_lock(&ram_io_lock);
+    pthread_mutex_lock(&ram_lock);
+    free(d->ram);
+    free(d->ramname);
+    d->ram = NULL;
+    d->ramname = NULL;
+    d->ramcap = 0;
+    d->backend = DISK_STDIO;
+    pthread_mutex_unlock(&ram_lock);
+    pthread_mutex_unlock(&ram_io_lock);
+  } else if (d->backend == DISK_MMAP) {
+    disk_unmap(d);
+  } else if (d->backend == DISK_OVERLAY) {
+    res = overlay_sync(d->ov);
+    overlay_close(d->ov);
+    d->ov = NULL;
+  }
+  d->backend = DISK_STDIO;
+  return res;
+}
+
+static void
+disk_seek(DiskState *d, off_t pos)
+{
+  switch (d->backend) {
+  case DISK_MMAP:
+    if (d->size != d->maplen && disk_map(d) < 0) break;
+    /* fall through */
+  case DISK_RAM:
+  case DISK_OVERLAY:
+    d->pos = pos;
+    return;
+  }
+  fseek(d->file, pos, 0);
+}
+
+static int
+disk_getc(DiskState *d)
+{
+  unsigned char c;
+
+  switch (d->backend) {
+  case DISK_RAM:
+    if (d->pos >= d->size) return EOF;
+    return d->ram[d->pos++];
+  case DISK_MMAP:
+    if (d->pos < d->maplen) return d->map[d->pos++];
+    if (pread(fileno(d->file), &c, 1, d->pos) != 1) return EOF;
+    d->pos++;
+    return c;
+  case DISK_OVERLAY:
+    if (overlay_pread(d->ov, &c, 1, d->pos) != 1) return EOF;
+    d->pos++;
+    return c;
+  }
+  return getc(d->file);
+}
+
+static int
+disk_putc(int c, DiskState *d)
+{
+  unsigned char b = c;
+
+  switch (d->backend) {
+  case DISK_RAM:
+    return ram_store(d, &b, 1) == 1 ? b : EOF;
+  case DISK_MMAP:
+    if (d->pos < d->maplen) {
+      d->map[d->pos++] = b;
+      return b;
+    }
+    if (pwrite(fileno(d->file), &b, 1, d->pos) != 1) return EOF;
+    if (++d->pos > d->size) d->size = d->pos;
+    return b;
+  case DISK_OVERLAY:
+    if (overlay_pwrite(d->ov, &b, 1, d->pos) != 1) return EOF;
+    d->pos++;
+    return b;
+  }
+  return putc(c, d->file);
+}
+
+static size_t
+disk_read(void *ptr, size_t size, size_t n, DiskState *d)
+{
+  size_t len = size * n, done = 0;
+  ssize_t res;
+
+  switch (d->backend) {
+  case DISK_RAM:
+    if (d->pos < d->size) {
+      done = d->size - d->pos;
+      if (done > len) done = len;
+      memcpy(ptr, d->ram + d->pos, done);
+      d->pos += done;
+    }
+    return done / size;
+  case DISK_MMAP:
+    if (d->pos < d->maplen) {
+      done = d->maplen - d->pos;
+      if (done > len) done = len;
+      memcpy(ptr, d->map + d->pos, done);
+    }
+    if (done < len) {
+      res = pread(fileno(d->file), (char *) ptr + done, len - done,
+		  d->pos + done);
+      if (res > 0) done += res;
+    }
+    d->pos += done;
+    return done / size;
+  case DISK_OVERLAY:
+    res = overlay_pread(d->ov, ptr, len, d->pos);
+    if (res > 0) done = res;
+    d->pos += done;
+    return done / size;
+  }
+  return fread(ptr, size, n, d->file);
+}
+
+static size_t
+disk_write(const void *ptr, size_t size, size_t n, DiskState *d)
+{
+  size_t len = size * n, done = 0;
+  ssize_t res;
+
+  switch (d->backend) {
+  case DISK_RAM:
+    return ram_store(d, ptr, len) / size;
+  case DISK_MMAP:
+    if (d->pos < d->maplen) {
+      done = d->maplen - d->pos;
+      if (done > len) done = len;
+      memcpy(d->map + d->pos, ptr, done);
+    }
+    if (done < len) {
+      res = pwrite(fileno(d->file), (const char *) ptr + done, len - done,
+		   d->pos + done);
+      if (res > 0) done += res;
+    }
+    d->pos += done;
+    if (d->pos > d->size) d->size = d->pos;
+    return done / size;
+  case DISK_OVERLAY:
+    res = overlay_pwrite(d->ov, ptr, len, d->pos);
+    if (res > 0) done = res;
+    d->pos += done;
+    return done / size;
+  }
+  return fwrite(ptr, size, n, d->file);
+}
+
+static int
+disk_flush(DiskState *d)
+{
+  switch (d->backend) {
+  case DISK_RAM:
+    return 0;
+  case DISK_MMAP:
+    if (d->map == NULL) return 0;
+    if (trs_disk_msync == TRSDISK_MSYNC_ASYNC &&
+	msync(d->map, d->maplen, MS_ASYNC) < 0) return EOF;
+    if (trs_disk_msync == TRSDISK_MSYNC_SYNC &&
+	(msync(d->map, d->maplen, MS_SYNC) < 0 ||
+	 (d->size > d->maplen && fdatasync(fileno(d->file)) < 0))) return EOF;
+    return 0;
+  case DISK_OVERLAY:
+    return overlay_sync(d->ov) < 0 ? EOF : 0;
+  }
+  return fflush(d->file);
+}
+
+static int
+disk_truncate(DiskState *d, off_t len)
+{
+  int res;
+
+  switch (d->backend) {
+  case DISK_RAM:
+    pthread_mutex_lock(&ram_lock);
+    if (len < d->size) d->size = len;
+    d->dirty = 1;
+    pthread_mutex_unlock(&ram_lock);
+    return 0;
+  case DISK_MMAP:
+    res = ftruncate(fileno(d->file), len);
+    if (res == 0) {
+      /* Do not leave pages past the end mapped */
+      d->size = len;
+      if (d->maplen > len) disk_map(d);
+    }
+    return res;
+  case DISK_OVERLAY:
+    return overlay_truncate(d->ov, len);
+  }
+  rewind(d->file);
+  return ftruncate(fileno(d->file), len);
+}
+
+/*
+ * DMK track cache.  Each DMK drive keeps its DMK_CACHE_TRACKS most
+ * recently used tracks in memory, so that stepping between the
+ * directory and the data tracks does not re-read them.  Writes change
+ * only the cached track; it is written back to the file when it is
+ * evicted, when the disk is changed, and when xtrs exits.  For each
+ * cached track, the IDs its header points to are parsed once per
+ * density into a table for search() to scan.  d->u.dmk.buf points to
+ * the buffer of the track under the head.
+ */
+
+/* Old contents of a track being formatted, for a partial format */
+static unsigned char dmk_oldtrack[DMK_TRACKLEN_MAX];
+
+/* Write a cached track back to the file if it has changed */
+static int
+dmk_writeback(DiskState *d, DMKTrack *t)
+{
+  int res = 0;
+
+  if (!t->dirty) return 0;
+  t->dirty = 0;
+  if (t->side >= d->u.dmk.nsides) return 0; /* no place for it in file */
+  disk_seek(d, DMK_HDR_SIZE +
+	    (t->track * d->u.dmk.nsides + t->side) * d->u.dmk.tracklen);
+  if (disk_write(t->buf, d->u.dmk.tracklen, 1, d) != 1) res = -1;
+  if (t->track >= d->u.dmk.filetracks) {
+    d->u.dmk.filetracks = t->track + 1;
+    disk_seek(d, DMK_NTRACKS);
+    if (disk_putc(d->u.dmk.filetracks, d) == EOF) res = -1;
+  }
+  if (disk_flush(d) == EOF) res = -1;
+  if (res < 0) {
+    error("could not write track %d side %d of %s",
+	  t->track, t->side, d->name);
+  }
+  return res;
+}
+
+static int
+dmk_flush(DiskState *d)
+{
+  int i, res = 0;
+
+  for (i = 0; i < DMK_CACHE_TRACKS; i++) {
+    if (dmk_writeback(d, &d->u.dmk.cache[i]) < 0) res = -1;
+  }
+  return res;
+}
+
+static void
+dmk_cache_open(DiskState *d)
+{
+  int i;
+
+  d->u.dmk.cache = (DMKTrack *) calloc(DMK_CACHE_TRACKS, sizeof(DMKTrack));
+  if (d->u.dmk.cache == NULL) fatal("out of memory for DMK track cache");
+  for (i = 0; i < DMK_CACHE_TRACKS; i++) {
+    d->u.dmk.cache[i].track = d->u.dmk.cache[i].side = -1;
+  }
+  d->u.dmk.cur = NULL;
+  d->u.dmk.buf = NULL;
+  d->u.dmk.clock = 0;
+  d->u.dmk.filetracks = d->u.dmk.ntracks;
+}
+
+static int
+dmk_cache_close(DiskState *d)
+{
+  int res;
+
+  if (d->u.dmk.cache == NULL) return 0;
+  res = dmk_flush(d);
+  free(d->u.dmk.cache);
+  d->u.dmk.cache = NULL;
+  d->u.dmk.cur = NULL;
+  d->u.dmk.buf = NULL;
+  return res;
+}
+
+/* Note that the current track's buffer has been changed */
+static void
+dmk_modified(DiskState *d, int dirty)
+{
+  d->u.dmk.cur->nsecs[0] = d->u.dmk.cur->nsecs[1] = -1;
+  if (dirty) d->u.dmk.cur->dirty = 1;
+}
+
+/* Get the on-disk track data from the current track/side into the buffer */
+void
+dmk_get_track(DiskState* d)
+{
+  DMKTrack *t, *victim;
+  int i, res;
+
+  if (d->u.dmk.cur != NULL && d->phytrack == d->u.dmk.curtrack &&
+      state.curside == d->u.dmk.curside) {
+    d->u.dmk.cur->used = ++d->u.dmk.clock;
+    return;
+  }
+  d->u.dmk.curtrack = d->phytrack;
+  d->u.dmk.curside = state.curside;
+
+  victim = t = d->u.dmk.cache;
+  for (i = 0; i < DMK_CACHE_TRACKS; i++, t++) {
+    if (t->track == d->u.dmk.curtrack && t->side == d->u.dmk.curside) {
+      goto found;
+    }
+    if (t->used < victim->used) victim = t;
+  }
+  t = victim;
+  dmk_writeback(d, t);
+  t->track = d->u.dmk.curtrack;
+  t->side = d->u.dmk.curside;
+  t->nsecs[0] = t->nsecs[1] = -1;
+  if (t->track >= d->u.dmk.ntracks || (t->side && d->u.dmk.nsides == 1)) {
+    memset(t->buf, 0, sizeof(t->buf));
+  } else {
+    disk_seek(d, (DMK_HDR_SIZE +
+		  (t->track * d->u.dmk.nsides + t->side)
+		  * d->u.dmk.tracklen));
+    res = disk_read(t->buf, d->u.dmk.tracklen, 1, d);
+    if (res != 1) {
+      memset(t->buf, 0, sizeof(t->buf));
+    }
+  }
+ found:
+  t->used = ++d->u.dmk.clock;
+  d->u.dmk.cur = t;
+  d->u.dmk.buf = t->buf;
+}
+
+/* Parse the IDs on the current track as seen in the current density */
+static void
+dmk_index(DiskState *d)
+{
+  DMKTrack *t = d->u.dmk.cur;
+  int dens = state.density;
+  int incr = dmk_incr(d);
+  DMKSector *sec = t->secs[dens];
+  int i, j, n = 0;
+
+  for (i = 0; i < DMK_TKHDR_SIZE; i+=2) {
+    unsigned char *p;
+    unsigned short crc;
+
+    /* fetch index of next IDAM */
+    int idamp = t->buf[i] + (t->buf[i+1] << 8);
+
+    /* stop if no more IDAMs */
+    if (idamp == 0) break;
+
+    /* skip IDAM if wrong density */
+    if (!d->u.dmk.ignden && dens != ((idamp & DMK_DDEN_FLAG) != 0)) continue;
+
+    /* stop if IDAM out of range */
+    idamp &= DMK_IDAMP_BITS;
+    if (idamp + 7 * incr > DMK_TRACKLEN_MAX) break;
+
+    /* sanity check; is this an IDAM at all? */
+    p = &t->buf[idamp];
+    if (*p != 0xfe) continue;
+
+    /* CRC of the IDAM, ID, and CRC field; result should be 0 */
+    crc = dens ? 0xcdb4 /* CRC of a1 a1 a1 */ : 0xffff;
+    for (j = 0; j < 7; j++) {
+      crc = calc_crc1(crc, p[j * incr]);
+    }
+    sec[n].track = p[1 * incr];
+    sec[n].side = p[2 * incr];
+    sec[n].sector = p[3 * incr];
+    sec[n].size = p[4 * incr];
+    sec[n].crc = crc;
+    sec[n].slot = i;
+    sec[n].data = idamp + 7 * incr;
+    n++;
+  }
+  t->nsecs[dens] = n;
+}
+
+/* Write back cached DMK tracks, in-memory images, and overlay sizes
+   at exit */
+static void
+disk_exit(void)
+{
+  int i;
+
+  for (i = 0; i < NDRIVES; i++) {
+    if (disk[i].file != NULL && disk[i].emutype == DMK) dmk_flush(&disk[i]);
+    ram_writeback(&disk[i]);
+    if (disk[i].backend == DISK_OVERLAY) overlay_sync(disk[i].ov);
+  }
+}
+
 /* Entry point for the zbx debugger */
 void
 trs_disk_debug()
@@ -335,8 +1046,9 @@ trs_disk_debug()
   for (i=0; i<NDRIVES; i++) {
     DiskState *d = &disk[i];
     printf("Drive %d state: "
-	   "writeprot %d, phytrack %d (0x%02x), inches %d, step %d, type ",
-	   i, d->writeprot, d->phytrack, d->phytrack, d->inches, d->real_step);
+	   "writeprot %d, phytrack %d (0x%02x), inches %d, step %d, fast %d, "
+	   "type ", i, d->writeprot, d->phytrack, d->phytrack, d->inches,
+	   d->real_step, d->fast);
     if (d->file == NULL) {
       printf("EMPTY\n");
     } else {
@@ -387,6 +1099,13 @@ trs_disk_setstep(int unit, int value)
   disk[unit].real_step = (value == 2) ? 2 : 1;
 }
 
+void
+trs_disk_setfast(int unit, int value)
+{
+  if (unit < 0 || unit > 7) return;
+  disk[unit].fast = (value != 0);
+}
+
 int
 trs_disk_getsize(int unit)
 {
@@ -401,6 +1120,13 @@ trs_disk_getstep(int unit)
   return disk[unit].real_step;
 }
 
+int
+trs_disk_getfast(int unit)
+{
+  if (unit < 0 || unit > 7) return 0;
+  return disk[unit].fast;
+}
+
 void
 trs_sigusr1(int signo)
 {
@@ -430,6 +1156,8 @@ trs_disk_init(void)
   sigaddset(&sa.sa_mask, SIGUSR1);
   sa.sa_flags = SA_RESTART;
   sigaction(SIGUSR1, &sa, NULL);
+
+  atexit(disk_exit);
 }
 
 /* Reset floppy controller hardware */
@@ -509,6 +1237,19 @@ trs_disk_unimpl(unsigned char cmd, char* more)
   error("trs_disk_command(0x%02x) not implemented - %s", cmd, more);
 }
 
+/* Return the delay in T-states before completing a command that
+   takes tstates on a real drive, whether stepping the head or waiting
+   for the disk to rotate.  If the current drive is fast, return only
+   FAST_TSTATES, and spin the disk forward by the time saved so that
+   angle() advances as if the wait had happened. */
+static int
+trs_disk_delay(int tstates)
+{
+  if (!disk[state.curdrive].fast || tstates <= FAST_TSTATES) return tstates;
+  trs_disk_spun += tstates - FAST_TSTATES;
+  return FAST_TSTATES;
+}
+
 /* Sort first by track, second by side, third by position in emulated-disk
    sector array (i.e., physical sector order on track).  */
 static int
@@ -614,10 +1355,10 @@ idoffset(DiskState *d, int id_index)
       if (d->u.jv3.nblocks == 1) {
         /* Initialize new block of ids */
 	int c;
-	fseek(d->file, idstart2, 0);
-        c = fwrite((void*)&d->u.jv3.id[JV3_SECSPERBLK], JV3_SECSTART, 1, d->file);
+	disk_seek(d, idstart2);
+        c = disk_write((void*)&d->u.jv3.id[JV3_SECSPERBLK], JV3_SECSTART, 1, d);
 	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
-	c = fflush(d->file);
+	c = disk_flush(d);
 	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	d->u.jv3.nblocks = 2;
       }	
@@ -665,8 +1406,8 @@ jv3_free_sector(DiskState *d, int id_index)
   d->u.jv3.id[id_index].sector = JV3_FREE;
   d->u.jv3.id[id_index].flags =
     (d->u.jv3.id[id_index].flags | JV3_FREEF) ^ JV3_SIZE;
-  fseek(d->file, idoffset(d, id_index), 0);
-  c = fwrite(&d->u.jv3.id[id_index], sizeof(SectorId), 1, d->file);
+  disk_seek(d, idoffset(d, id_index));
+  c = disk_write(&d->u.jv3.id[id_index], sizeof(SectorId), 1, d);
   if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 
   if (id_index == d->u.jv3.last_used_id) {
@@ -674,16 +1415,15 @@ jv3_free_sector(DiskState *d, int id_index)
     while (d->u.jv3.id[d->u.jv3.last_used_id].track == JV3_FREE) {
       d->u.jv3.last_used_id--;
     }
-    c = fflush(d->file);
+    c = disk_flush(d);
     if (c == EOF) state.status |= TRSDISK_WRITEFLT;
-    rewind(d->file);
     if (d->u.jv3.last_used_id >= 0) {
       newlen = offset(d, d->u.jv3.last_used_id) +
 	id_index_to_size(d, d->u.jv3.last_used_id);
     } else {
       newlen = offset(d, 0);
     }
-    c = ftruncate(fileno(d->file), newlen);
+    c = disk_truncate(d, newlen);
     if (c == EOF) state.status |= TRSDISK_WRITEFLT;
   }
 }
@@ -697,23 +1437,23 @@ trs_disk_emutype(DiskState *d)
   char fmt[4];
   int count;
 
-  fseek(d->file, 0, 0);
-  c = getc(d->file);
+  disk_seek(d, 0);
+  c = disk_getc(d);
   if (c == -1) {
     d->emutype = JV1;
     return;
   }
   if (c == 0 || c == 0xff) {
-    fseek(d->file, DMK_FORMAT, 0);
-    count = fread(fmt, 1, DMK_FORMAT_SIZE, d->file);
+    disk_seek(d, DMK_FORMAT);
+    count = disk_read(fmt, 1, DMK_FORMAT_SIZE, d);
     if (count != DMK_FORMAT_SIZE) {
       d->emutype = JV1;
       return;
     }
     if (fmt[0] == 0 && fmt[1] == 0 && fmt[2] == 0 && fmt[3] == 0) {
-      fseek(d->file, DMK_TRACKLEN, 0);
-      count = (unsigned char) getc(d->file);
-      count += (unsigned char) getc(d->file) << 8;
+      disk_seek(d, DMK_TRACKLEN);
+      count = (unsigned char) disk_getc(d);
+      count += (unsigned char) disk_getc(d) << 8;
       if (count >= 16 && count <= DMK_TRACKLEN_MAX) {
 	d->emutype = DMK;
 	d->writeprot = d->writeprot || (c == 0xff);
@@ -723,20 +1463,21 @@ trs_disk_emutype(DiskState *d)
     if (fmt[0] == 0x78 && fmt[1] == 0x56 && fmt[2] == 0x34 && fmt[3] == 0x12) {
       error("Real disk specifier file from DMK emulator not supported");
       d->emutype = NONE;
+      disk_backend_close(d);
       fclose(d->file);
       d->file = NULL;
       return;
     }
   }
   if (c == 0) {
-    fseek(d->file, 1, 0);
-    if (getc(d->file) == 0xfe) {
+    disk_seek(d, 1);
+    if (disk_getc(d) == 0xfe) {
       d->emutype = JV1;
       return;
     }
   }
-  fseek(d->file, JV3_SECSPERBLK*sizeof(SectorId), 0);
-  c = getc(d->file);
+  disk_seek(d, JV3_SECSPERBLK*sizeof(SectorId));
+  c = disk_getc(d);
   if (c == 0 || c == 0xff) {
     d->emutype = JV3;
     d->writeprot = d->writeprot || (c == 0);
@@ -751,13 +1492,19 @@ trs_disk_change(int drive)
 {
   DiskState *d = &disk[drive];  
   struct stat st;
-  int c, res;
+  int c, res, rdonly = 0;
 
   if (d->file != NULL) {
+    if (d->emutype == DMK && dmk_cache_close(d) < 0) {
+      state.status |= TRSDISK_WRITEFLT;
+    }
+    c = disk_backend_close(d);
+    if (c < 0) state.status |= TRSDISK_WRITEFLT;
     c = fclose(d->file);
     if (c == EOF) state.status |= TRSDISK_WRITEFLT;
     d->file = NULL;
   }
+  d->watch = trs_watch_start(d->watch, d->name);
   if (d->name == NULL) {
     return 0;
   }
@@ -794,14 +1541,33 @@ trs_disk_change(int drive)
     }
   } else
 #endif
-  {
+  if (trs_disk_overlay != NULL) {
+    /* Writes go to the delta file, so the image itself can be
+       read-only */
+    d->file = fopen(d->name, "r");
+    if (d->file == NULL) return errno;
+    d->ov = overlay_open(trs_disk_overlay, d->name, fileno(d->file));
+    if (d->ov == NULL) {
+      res = errno;
+      error("could not open overlay for %s: %s", d->name,
+	    res == ESTALE ? "image has changed since the delta file was made"
+	    : strerror(res));
+      fclose(d->file);
+      d->file = NULL;
+      return res;
+    }
+    d->backend = DISK_OVERLAY;
+    d->pos = 0;
+    d->writeprot = 0;
+    trs_disk_emutype(d);
+  } else {
     d->file = fopen(d->name, "r+");
     if (d->file == NULL) {
       if (errno == EACCES || errno == EROFS) {
 	d->file = fopen(d->name, "r");
       }
       if (d->file == NULL) return errno;
-      d->writeprot = 1;
+      d->writeprot = rdonly = 1;
     } else {
       d->writeprot = 0;
     }
@@ -814,8 +1580,8 @@ trs_disk_change(int drive)
     memset((void*)d->u.jv3.id, JV3_FREE, sizeof(d->u.jv3.id));
 
     /* Read first block of ids */
-    fseek(d->file, JV3_IDSTART, 0);
-    n = fread((void*)&d->u.jv3.id[0], 3, JV3_SECSPERBLK, d->file);
+    disk_seek(d, JV3_IDSTART);
+    n = disk_read((void*)&d->u.jv3.id[0], 3, JV3_SECSPERBLK, d);
 
     /* Scan to find their offsets */
     ofst = JV3_SECSTART;
@@ -825,8 +1591,8 @@ trs_disk_change(int drive)
     }
 
     /* Read second block of ids, if any */
-    fseek(d->file, ofst, 0);
-    n = fread((void*)&d->u.jv3.id[JV3_SECSPERBLK], 3, JV3_SECSPERBLK, d->file);
+    disk_seek(d, ofst);
+    n = disk_read((void*)&d->u.jv3.id[JV3_SECSPERBLK], 3, JV3_SECSPERBLK, d);
     d->u.jv3.nblocks = n > 0 ? 2 : 1;
 
     /* Scan to find their offsets */
@@ -853,15 +1619,16 @@ trs_disk_change(int drive)
     }
     jv3_sort_ids(drive);
   } else if (d->emutype == DMK) {
-    fseek(d->file, DMK_NTRACKS, 0);
-    d->u.dmk.ntracks = (unsigned char) getc(d->file);
-    d->u.dmk.tracklen = (unsigned char) getc(d->file);
-    d->u.dmk.tracklen += ((unsigned char) getc(d->file)) << 8;
-    c = getc(d->file);
+    disk_seek(d, DMK_NTRACKS);
+    d->u.dmk.ntracks = (unsigned char) disk_getc(d);
+    d->u.dmk.tracklen = (unsigned char) disk_getc(d);
+    d->u.dmk.tracklen += ((unsigned char) disk_getc(d)) << 8;
+    c = disk_getc(d);
     d->u.dmk.nsides = (c & DMK_SSIDE_OPT) ? 1 : 2;
     d->u.dmk.sden = (c & DMK_SDEN_OPT) != 0;
     d->u.dmk.ignden = (c & DMK_IGNDEN_OPT) != 0;
     d->u.dmk.curtrack = d->u.dmk.curside = -1;
+    dmk_cache_open(d);
 
     if (trs_disk_debug_flags & DISKDEBUG_DMK) {
       debug("DMK drv=%d wp=%d #tk=%d tklen=0x%x nsides=%d sden=%d ignden=%d\n",
@@ -871,15 +1638,38 @@ trs_disk_change(int drive)
   } else if (d->emutype == NONE) {
     return -1;
   }
+  if (d->emutype != REAL) disk_backend_open(d, rdonly);
   return 0;
 }
 
+/* Is the image file still the one ram_writeback last wrote?  Then
+   the changes its watch saw were only our own write-backs. */
+static int
+ram_written_back(DiskState *d)
+{
+  struct stat st;
+  int ours;
+
+  if (d->backend != DISK_RAM || stat(d->name, &st) < 0) return 0;
+  pthread_mutex_lock(&ram_lock);
+  ours = d->ramino != 0 && st.st_ino == d->ramino &&
+    st.st_mtime == d->rammtime;
+  pthread_mutex_unlock(&ram_lock);
+  return ours;
+}
+
+/* Reopen the drives whose images have changed, or all if force */
 void
-trs_disk_change_all(void)
+trs_disk_change_all(int force)
 {
   int i;
   for (i=0; i<NDRIVES; i++) {
-    trs_disk_change(i);
+    if (!force && trs_watch_changed(disk[i].watch) &&
+	ram_written_back(&disk[i])) {
+      /* Watch the new file that ram_writeback renamed into place */
+      disk[i].watch = trs_watch_start(disk[i].watch, disk[i].name);
+    }
+    if (force || trs_watch_changed(disk[i].watch)) trs_disk_change(i);
   }
 }
 
@@ -959,31 +1749,6 @@ trs_disk_motoroff()
   return stopped;
 }
 
-/* Get the on-disk track data from the current track/side into the buffer */
-void
-dmk_get_track(DiskState* d)
-{
-  int res;
-  if (d->phytrack == d->u.dmk.curtrack &&
-      state.curside == d->u.dmk.curside) return;
-  d->u.dmk.curtrack = d->phytrack;
-  d->u.dmk.curside = state.curside;
-  if (d->u.dmk.curtrack >= d->u.dmk.ntracks ||
-      (d->u.dmk.curside && d->u.dmk.nsides == 1)) {
-    memset(d->u.dmk.buf, 0, sizeof(d->u.dmk.buf));
-    return;
-  }
-  fseek(d->file, (DMK_HDR_SIZE +
-		  (d->u.dmk.curtrack * d->u.dmk.nsides + d->u.dmk.curside)
-		  * d->u.dmk.tracklen), 0);
-  res = fread(d->u.dmk.buf, d->u.dmk.tracklen, 1, d->file);
-  if (res != 1) {
-    memset(d->u.dmk.buf, 0, sizeof(d->u.dmk.buf));
-    return;
-  }    
-}
-
-
 /* Search for a sector on the current physical track.  For JV1 or JV3,
    return its index within the emulated disk's array of sectors.  For
    DMK, get the track into the buffer, return the index of the next
@@ -1037,66 +1802,25 @@ search(int sector, int side)
     /* !!maybe someday start at a point determined by angle() and wrap
        back.  would deal more realistically with disks that have more
        than one of the same sector. */
-    int i;
-    int incr = dmk_incr(d);
+    DMKSector *sec;
+    int i, n;
 
-    /* get current phytrack into buffer */
+    /* get current phytrack into buffer, and its IDs */
     dmk_get_track(d);
+    if (d->u.dmk.cur->nsecs[state.density] < 0) dmk_index(d);
+    sec = d->u.dmk.cur->secs[state.density];
+    n = d->u.dmk.cur->nsecs[state.density];
 
-    /* loop through IDAMs in track */
-    for (i = 0; i < DMK_TKHDR_SIZE; i+=2) {
-      unsigned char *p;
-
-      /* fetch index of next IDAM */
-      int idamp = d->u.dmk.buf[i] + (d->u.dmk.buf[i+1] << 8);
-
-      /* fail if no more IDAMs */
-      if (idamp == 0) break;
-
-      /* skip IDAM if wrong density */
-      if (!d->u.dmk.ignden &&
-	  state.density != ((idamp & DMK_DDEN_FLAG) != 0)) continue;
-
-      /* point p to IDAM */
-      idamp &= DMK_IDAMP_BITS;
-      p = &d->u.dmk.buf[idamp];
-
-      /* fail if IDAM out of range */
-      if (idamp >= DMK_TRACKLEN_MAX) break;
-
-      /* initialize ID CRC */
-      state.crc = state.density ? 0xcdb4 /* CRC of a1 a1 a1 */ : 0xffff;
-
-      /* sanity check; is this an IDAM at all? */
-      if (*p != 0xfe) continue;
-      state.crc = calc_crc1(state.crc, *p);
-      p += incr;
-
-      /* compare track field of ID */
-      if (*p != state.track) continue;
-      state.crc = calc_crc1(state.crc, *p);
-      p += incr;
-
-      /* compare side field of ID if desired */
-      if ((*p & 1) != side && side != -1) continue;
-      state.crc = calc_crc1(state.crc, *p);
-      p += incr;
-
-      /* compare sector field of ID if desired */
-      if (*p != sector && sector != -1) continue;
-      state.crc = calc_crc1(state.crc, *p);
-      p += incr;
+    /* loop through IDs in track */
+    for (i = 0; i < n; i++, sec++) {
+      /* compare track, side if desired, and sector if desired */
+      if (sec->track != state.track) continue;
+      if ((sec->side & 1) != side && side != -1) continue;
+      if (sec->sector != sector && sector != -1) continue;
 
       /* save size code field of ID; caller converts to actual byte count */
-      state.bytecount = *p;
-      state.crc = calc_crc1(state.crc, *p);
-      p += incr;
-
-      /* fold CRC field into computation; result should be 0 */
-      state.crc = calc_crc1(state.crc, *p);
-      p += incr;
-      state.crc = calc_crc1(state.crc, *p);
-      p += incr;
+      state.bytecount = sec->size;
+      state.crc = sec->crc;
 
       if (state.crc != 0) {
 	/* set CRC error flag and look for another ID that matches */
@@ -1108,8 +1832,8 @@ search(int sector, int side)
       }
 
       /* Found an ID that matches */
-      d->u.dmk.nextidam = i + 2; /* remember where the next one is */
-      return p - d->u.dmk.buf;
+      d->u.dmk.nextidam = sec->slot + 2; /* remember where the next one is */
+      return sec->data;
     }
     state.status |= TRSDISK_NOTFOUND;
     return -1;
@@ -1181,7 +1905,7 @@ angle()
   /* Minor bug: there will be a glitch when t_count wraps around on
      a 32-bit machine */
   int revt = (int)(revus * z80_state.clockMHz);
-  a = ((float)(z80_state.t_count % revt)) / ((float)revt);
+  a = ((float)((z80_state.t_count + trs_disk_spun) % revt)) / ((float)revt);
 #else
   /* Old way: lock revolution rate to real time */
   struct timeval tv;
@@ -1317,7 +2041,7 @@ trs_disk_select_write(unsigned char data)
        expand it to call trs_change_all() -- and should accept
        it somewhere better than here! */
     if (trs_disk_needchange) {
-      trs_disk_change_all();
+      trs_disk_change_all(1);
       trs_disk_needchange = 0;
     }
 
@@ -1423,7 +2147,7 @@ trs_disk_data_read(void)
 	state.crc = calc_crc1(state.crc, c);
 	d->u.dmk.curbyte += dmk_incr(d);
       } else {
-	c = getc(d->file);
+	c = disk_getc(d);
 	if (c == EOF) {
 	  c = 0xe5;
 	  if (d->emutype == JV1) {
@@ -1577,6 +2301,80 @@ trs_disk_data_read(void)
   return state.data;
 }
 
+/* Fast path for the block I/O instructions on the data port: return
+   how many bytes trs_disk_data_read_block (if writing is 0) or
+   trs_disk_data_write_block (if 1) can move now.  This is all of the
+   sector being read or written but the last byte, which must go
+   through trs_disk_data_read or trs_disk_data_write so that it ends
+   the command; 0 if there is no such transfer in progress. */
+int
+trs_disk_data_block_limit(int writing)
+{
+  DiskState *d = &disk[state.curdrive];
+  int cmd = state.currcommand & TRSDISK_CMDMASK;
+
+  if (d->emutype == REAL || (trs_disk_debug_flags & DISKDEBUG_FDCREG)) {
+    return 0;
+  }
+  if (writing ? cmd != TRSDISK_WRITE :
+      (cmd != TRSDISK_READ || !(state.status & TRSDISK_DRQ))) {
+    return 0;
+  }
+  return state.bytecount > 1 ? state.bytecount - 1 : 0;
+}
+
+/* Read n bytes of the sector into buf, as n calls to
+   trs_disk_data_read would; n must be within the limit above. */
+void
+trs_disk_data_read_block(unsigned char *buf, int n)
+{
+  DiskState *d = &disk[state.curdrive];
+  int i, got;
+
+  if (d->emutype == DMK) {
+    for (i = 0; i < n; i++) {
+      buf[i] = d->u.dmk.buf[d->u.dmk.curbyte];
+      state.crc = calc_crc1(state.crc, buf[i]);
+      d->u.dmk.curbyte += dmk_incr(d);
+    }
+  } else {
+    got = disk_read(buf, 1, n, d);
+    if (got < n) {
+      memset(buf + got, 0xe5, n - got);
+      if (d->emutype == JV1) {
+	state.status &= ~TRSDISK_RECTYPE;
+	state.status |= (state.controller == TRSDISK_P1771) ?
+	  TRSDISK_1771_FB : TRSDISK_1791_FB;
+      }
+    }
+  }
+  state.data = buf[n - 1];
+  state.bytecount -= n;
+}
+
+/* Write n bytes of the sector from buf, as n calls to
+   trs_disk_data_write would */
+void
+trs_disk_data_write_block(const unsigned char *buf, int n)
+{
+  DiskState *d = &disk[state.curdrive];
+  int i;
+
+  if (d->emutype == DMK) {
+    for (i = 0; i < n; i++) {
+      d->u.dmk.buf[d->u.dmk.curbyte++] = buf[i];
+      if (dmk_incr(d) == 2) {
+	d->u.dmk.buf[d->u.dmk.curbyte++] = buf[i];
+      }
+      state.crc = calc_crc1(state.crc, buf[i]);
+    }
+  } else {
+    if ((int) disk_write(buf, 1, n, d) != n) state.status |= TRSDISK_WRITEFLT;
+  }
+  state.data = buf[n - 1];
+  state.bytecount -= n;
+}
+
 void
 trs_disk_data_write(unsigned char data)
 {
@@ -1598,38 +2396,29 @@ trs_disk_data_write(unsigned char data)
 	}
 	break;
       }
-      c = putc(data, d->file);
-      if (c == EOF) state.status |= TRSDISK_WRITEFLT;
       if (d->emutype == DMK) {
 	d->u.dmk.buf[d->u.dmk.curbyte++] = data;
 	if (dmk_incr(d) == 2) {
 	  d->u.dmk.buf[d->u.dmk.curbyte++] = data;
-	  c = putc(data, d->file);
-	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	}
 	state.crc = calc_crc1(state.crc, data);
-      }	
+      } else {
+	c = disk_putc(data, d);
+	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
+      }
       state.bytecount--;
       if (state.bytecount <= 0) {
 	if (d->emutype == DMK) {
 	  int idamp, i, j;
 	  c = state.crc >> 8;
 	  d->u.dmk.buf[d->u.dmk.curbyte++] = c;
-	  c = putc(c, d->file);
-	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  if (dmk_incr(d) == 2) {
 	    d->u.dmk.buf[d->u.dmk.curbyte++] = c;
-	    c = putc(c, d->file);
-	    if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  }
 	  c = state.crc & 0xff;
 	  d->u.dmk.buf[d->u.dmk.curbyte++] = c;
-	  c = putc(c, d->file);
-	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  if (dmk_incr(d) == 2) {
 	    d->u.dmk.buf[d->u.dmk.curbyte++] = c;
-	    c = putc(c, d->file);
-	    if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  }
 	  /* Check if we smashed one or more following IDAMs; can
 	     happen with weird "protected" formats */
@@ -1656,11 +2445,7 @@ trs_disk_data_write(unsigned char data)
 	    while (j < DMK_TKHDR_SIZE) {
 	      d->u.dmk.buf[j++] = 0;
 	    }
-	    fseek(d->file, DMK_HDR_SIZE +
-		  (d->phytrack * d->u.dmk.nsides + state.curside) *
-		  d->u.dmk.tracklen, 0);
-	    c = fwrite(d->u.dmk.buf, DMK_TKHDR_SIZE, 1, d->file);
-	    if (c != 1) state.status |= TRSDISK_WRITEFLT;
+	    dmk_modified(d, 1);
 	  }
 	}
 	state.bytecount = 0;
@@ -1670,7 +2455,7 @@ trs_disk_data_write(unsigned char data)
 	  trs_cancel_event();
 	}
 	trs_schedule_event(trs_disk_done, 0, 64);
-	c = fflush(d->file);
+	c = disk_flush(d);
 	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
       }
     }
@@ -1686,19 +2471,11 @@ trs_disk_data_write(unsigned char data)
 	  }
 	  state.format = FMT_DONE;
 	  state.status &= ~TRSDISK_DRQ;
-	  /* Done: write modified track */
-	  fseek(d->file, DMK_HDR_SIZE +
-		(d->phytrack * d->u.dmk.nsides + state.curside) *
-		d->u.dmk.tracklen, 0);
-	  c = fwrite(d->u.dmk.buf, d->u.dmk.tracklen, 1, d->file);
-	  if (c != 1) state.status |= TRSDISK_WRITEFLT;
+	  /* Done: mark track to be written back */
+	  dmk_modified(d, 1);
 	  if (d->phytrack >= d->u.dmk.ntracks) {
 	    d->u.dmk.ntracks = d->phytrack + 1;
-	    fseek(d->file, DMK_NTRACKS, 0);
-	    putc(d->u.dmk.ntracks, d->file);
 	  }
-	  c = fflush(d->file);
-	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  trs_disk_drq_interrupt(0);
 	  if (trs_event_scheduled() == trs_disk_lostdata) {
 	    trs_cancel_event();
@@ -1806,9 +2583,9 @@ trs_disk_data_write(unsigned char data)
 	  error("warning: recording false sector ID as CRC error");
 
 	  /* Write the sector id */
-	  fseek(d->file, idoffset(d, state.format_sec), 0);
-	  c = fwrite(&d->u.jv3.id[state.format_sec],
-		     sizeof(SectorId), 1, d->file);
+	  disk_seek(d, idoffset(d, state.format_sec));
+	  c = disk_write(&d->u.jv3.id[state.format_sec],
+			 sizeof(SectorId), 1, d);
 	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	}
       } else if (state.format != FMT_GAP3) {
@@ -1837,7 +2614,7 @@ trs_disk_data_write(unsigned char data)
       if (d->emutype == REAL) {
 	real_writetrk();
       } else {
-	c = fflush(d->file);
+	c = disk_flush(d);
 	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
       }
       trs_disk_drq_interrupt(0);
@@ -2056,7 +2833,7 @@ trs_disk_data_write(unsigned char data)
 	}
 	if (d->emutype == JV3) {
 	  /* Prepare to write the data */
-	  fseek(d->file, offset(d, state.format_sec), 0);
+	  disk_seek(d, offset(d, state.format_sec));
 	  state.format_bytecount = id_index_to_size(d, state.format_sec);
 	} else if (d->emutype == JV1) {
 	  state.format_bytecount = JV1_SECSIZE;
@@ -2076,8 +2853,8 @@ trs_disk_data_write(unsigned char data)
 	  d->u.jv3.id[state.format_sec].flags |= JV3_ERROR;
 
 	  /* Write the sector id */
-	  fseek(d->file, idoffset(d, state.format_sec), 0);
-	  c = fwrite(&d->u.jv3.id[state.format_sec], sizeof(SectorId), 1, d->file);
+	  disk_seek(d, idoffset(d, state.format_sec));
+	  c = disk_write(&d->u.jv3.id[state.format_sec], sizeof(SectorId), 1, d);
 	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	}
 	goto got_idam2;
@@ -2098,9 +2875,9 @@ trs_disk_data_write(unsigned char data)
 		  d->u.jv3.id[state.format_sec].sector);
 	  }
 	  /* Write the sector id */
-	  fseek(d->file, idoffset(d, state.format_sec), 0);
-	  c = fwrite(&d->u.jv3.id[state.format_sec],
-		     sizeof(SectorId), 1, d->file);
+	  disk_seek(d, idoffset(d, state.format_sec));
+	  c = disk_write(&d->u.jv3.id[state.format_sec],
+			 sizeof(SectorId), 1, d);
 	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  goto got_idam;
 	} else {
@@ -2108,7 +2885,7 @@ trs_disk_data_write(unsigned char data)
 	}
       }
       if (d->emutype == JV3) {
-	c = putc(data, d->file);
+	c = disk_putc(data, d);
 	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
       } else if (d->emutype == REAL) {
 	d->u.real.fmt_fill = data;
@@ -2130,8 +2907,8 @@ trs_disk_data_write(unsigned char data)
       }
       if (d->emutype == JV3) {
 	/* Write the sector id */
-	fseek(d->file, idoffset(d, state.format_sec), 0);
-	c = fwrite(&d->u.jv3.id[state.format_sec], sizeof(SectorId), 1, d->file);
+	disk_seek(d, idoffset(d, state.format_sec));
+	c = disk_write(&d->u.jv3.id[state.format_sec], sizeof(SectorId), 1, d);
 	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
       }
       state.format = FMT_GAP3;
@@ -2207,69 +2984,53 @@ trs_disk_command_write(unsigned char cmd)
   }
 
   /* Handle DMK partial track reformat */
-  if (d->emutype == DMK &&
+  if (d->emutype == DMK && d->u.dmk.cur != NULL &&
       (state.currcommand & ~TRSDISK_EBIT) == TRSDISK_WRITETRK &&
       state.format != FMT_DONE) {
-    /* Interrupted format: must write out partial track */
-    unsigned char oldtkhdr[DMK_TKHDR_SIZE];
-    int c, i, j, idamp;
+    /* Interrupted format: rest of track keeps its old contents */
+    unsigned char *oldtkhdr = dmk_oldtrack;
+    int i, j, idamp;
 
     if (trs_disk_debug_flags & DISKDEBUG_DMK) {
       debug("partial track format dens %d tk %d side %d\n",
 	    state.density, d->phytrack, state.curside);
     }
 
-    /* Fetch old IDAM pointers if any */
-    fseek(d->file, DMK_HDR_SIZE +
-	  (d->phytrack * d->u.dmk.nsides + state.curside) *
-	  d->u.dmk.tracklen, 0);
-    c = fread(oldtkhdr, DMK_TKHDR_SIZE, 1, d->file);
-    if (c == 1) {
-      /* Copy any pointers to IDAMs that are not being overwritten */
-      i = 0;
-      j = d->u.dmk.nextidam;
-      while (i < DMK_TKHDR_SIZE) {
-	idamp = (oldtkhdr[i] + (oldtkhdr[i+1] << 8)) & DMK_IDAMP_BITS;
-	if (idamp == 0 || idamp == DMK_IDAMP_BITS) break;
-	if (idamp < d->u.dmk.curbyte) {
-	  /* IDAM overwritten; don't copy */
-	  i += 2;
-	  if (trs_disk_debug_flags & DISKDEBUG_DMK) {
-	    debug("  discarding physec %d\n", i);
-	  }
-	} else {
-	  /* IDAM not overwritten; need to copy in */
-	  if (j >= DMK_TKHDR_SIZE) {
-	    /* No room */
-	    error("DMK reformatting adds too many sectors to track");
-	    break;
-	  }
-	  d->u.dmk.buf[j++] = oldtkhdr[i++];
-	  d->u.dmk.buf[j++] = oldtkhdr[i++];
-	  if (trs_disk_debug_flags & DISKDEBUG_DMK) {
-	    debug("  preserving physec %d as %d\n", i, j);
-	  }
+    /* Copy any pointers to old IDAMs that are not being overwritten */
+    i = 0;
+    j = d->u.dmk.nextidam;
+    while (i < DMK_TKHDR_SIZE) {
+      idamp = (oldtkhdr[i] + (oldtkhdr[i+1] << 8)) & DMK_IDAMP_BITS;
+      if (idamp == 0 || idamp == DMK_IDAMP_BITS) break;
+      if (idamp < d->u.dmk.curbyte) {
+	/* IDAM overwritten; don't copy */
+	i += 2;
+	if (trs_disk_debug_flags & DISKDEBUG_DMK) {
+	  debug("  discarding physec %d\n", i);
+	}
+      } else {
+	/* IDAM not overwritten; need to copy in */
+	if (j >= DMK_TKHDR_SIZE) {
+	  /* No room */
+	  error("DMK reformatting adds too many sectors to track");
+	  break;
+	}
+	d->u.dmk.buf[j++] = oldtkhdr[i++];
+	d->u.dmk.buf[j++] = oldtkhdr[i++];
+	if (trs_disk_debug_flags & DISKDEBUG_DMK) {
+	  debug("  preserving physec %d as %d\n", i, j);
 	}
       }
-    } else {
-      if (trs_disk_debug_flags & DISKDEBUG_FDCREG) {
-	debug("  no existing sectors\n");
-      }
     }
-    /* Write modified portion of track only */
-    fseek(d->file, DMK_HDR_SIZE +
-	  (d->phytrack * d->u.dmk.nsides + state.curside) *
-	  d->u.dmk.tracklen, 0);
-    fwrite(d->u.dmk.buf, d->u.dmk.curbyte, 1, d->file);
+    if (d->u.dmk.curbyte < d->u.dmk.tracklen) {
+      memcpy(d->u.dmk.buf + d->u.dmk.curbyte,
+	     dmk_oldtrack + d->u.dmk.curbyte,
+	     d->u.dmk.tracklen - d->u.dmk.curbyte);
+    }
+    dmk_modified(d, 1);
     if (d->phytrack >= d->u.dmk.ntracks) {
       d->u.dmk.ntracks = d->phytrack + 1;
-      fseek(d->file, DMK_NTRACKS, 0);
-      putc(d->u.dmk.ntracks, d->file);
     }
-    fflush(d->file);
-
-    /* Invalidate buffer since not all data is here */
-    d->u.dmk.curtrack = d->u.dmk.curside = -1;
     state.format = FMT_DONE;
   }
 
@@ -2294,7 +3055,7 @@ trs_disk_command_write(unsigned char cmd)
     if (d->emutype == REAL) real_restore(state.curdrive);
     /* Should this set lastdirection? */
     if (cmd & TRSDISK_VBIT) verify();
-    trs_schedule_event(trs_disk_done, 0, 2000);
+    trs_schedule_event(trs_disk_done, 0, trs_disk_delay(2000));
     break;
 
   case TRSDISK_SEEK:
@@ -2314,7 +3075,7 @@ trs_disk_command_write(unsigned char cmd)
     if (d->emutype == REAL) real_seek();
     /* Should this set lastdirection? */
     if (cmd & TRSDISK_VBIT) verify();
-    trs_schedule_event(trs_disk_done, 0, 2000);
+    trs_schedule_event(trs_disk_done, 0, trs_disk_delay(2000));
     break;
 
   case TRSDISK_STEP:
@@ -2339,7 +3100,7 @@ trs_disk_command_write(unsigned char cmd)
     }
     if (d->emutype == REAL) real_seek();
     if (cmd & TRSDISK_VBIT) verify();
-    trs_schedule_event(trs_disk_done, 0, 2000);
+    trs_schedule_event(trs_disk_done, 0, trs_disk_delay(2000));
     break;
 
   case TRSDISK_STEPIN:
@@ -2358,6 +3119,7 @@ trs_disk_command_write(unsigned char cmd)
 	    state.curdrive, state.curside, d->phytrack,
 	    state.track, state.sector, state.density ? "d" : "s");
     }
+    trs_metrics.floppy_sectors[state.curdrive]++;
     state.last_readadr = -1;
     state.status = 0;
     non_ibm = 0;
@@ -2393,7 +3155,7 @@ trs_disk_command_write(unsigned char cmd)
     id_index = search(state.sector, goal_side);
     if (id_index == -1) {
       state.status |= TRSDISK_BUSY;
-      trs_schedule_event(trs_disk_done, 0, 512);
+      trs_schedule_event(trs_disk_done, 0, trs_disk_delay(512));
     } else {
       if (d->emutype == JV1) {
 
@@ -2405,7 +3167,7 @@ trs_disk_command_write(unsigned char cmd)
 	  }
 	}
 	state.bytecount = JV1_SECSIZE;
-	fseek(d->file, offset(d, id_index), 0);
+	disk_seek(d, offset(d, id_index));
 
       } else if (d->emutype == JV3) {
 
@@ -2464,7 +3226,7 @@ trs_disk_command_write(unsigned char cmd)
 	} else {
 	  state.bytecount = id_index_to_size(d, id_index);
 	}
-	fseek(d->file, offset(d, id_index), 0);
+	disk_seek(d, offset(d, id_index));
 
       } else /* d->emutype == DMK */ {
 
@@ -2492,7 +3254,8 @@ trs_disk_command_write(unsigned char cmd)
 	if (damlimit < 0) {
 	  /* found ID with good CRC but no following DAM; fail */
 	  state.status |= TRSDISK_BUSY;
-	  trs_schedule_event(trs_disk_done, TRSDISK_NOTFOUND, 512);
+	  trs_schedule_event(trs_disk_done, TRSDISK_NOTFOUND,
+			     trs_disk_delay(512));
 	  break;
 	}
 
@@ -2561,6 +3324,7 @@ trs_disk_command_write(unsigned char cmd)
 	    cmd, state.curdrive, state.curside, d->phytrack,
 	    state.track, state.sector, state.density ? "d" : "s");
     }
+    trs_metrics.floppy_sectors[state.curdrive]++;
     state.last_readadr = -1;
     state.status = 0;
     non_ibm = 0;
@@ -2603,7 +3367,7 @@ trs_disk_command_write(unsigned char cmd)
     id_index = search(state.sector, goal_side);
     if (id_index == -1) {
       state.status |= TRSDISK_BUSY;
-      trs_schedule_event(trs_disk_done, 0, 512);
+      trs_schedule_event(trs_disk_done, 0, trs_disk_delay(512));
     } else {
       int jv3dam = 0, dam = 0;
       if (state.controller == TRSDISK_P1771) {
@@ -2669,7 +3433,7 @@ trs_disk_command_write(unsigned char cmd)
 	  break;
 	}
 	state.bytecount = JV1_SECSIZE;
-	fseek(d->file, offset(d, id_index), 0);
+	disk_seek(d, offset(d, id_index));
 
       } else if (d->emutype == JV3) {
 	SectorId *sid = &d->u.jv3.id[id_index];
@@ -2678,11 +3442,11 @@ trs_disk_command_write(unsigned char cmd)
 	newflags |= jv3dam;
 	if (newflags != sid->flags) {
 	  int c;
-	  fseek(d->file, idoffset(d, id_index) 
-		         + ((char *) &sid->flags) - ((char *) sid), 0);
-	  c = putc(newflags, d->file);
+	  disk_seek(d, idoffset(d, id_index)
+		       + ((char *) &sid->flags) - ((char *) sid));
+	  c = disk_putc(newflags, d);
 	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
-	  c = fflush(d->file);
+	  c = disk_flush(d);
 	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  sid->flags = newflags;
 	}
@@ -2701,7 +3465,7 @@ trs_disk_command_write(unsigned char cmd)
 		      state.track, i, j);
 	      }
 	      jv3_free_sector(d, j);
-	      c = fflush(d->file);
+	      c = disk_flush(d);
 	      if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	    }	      
 	    /* Smash only one for non-IBM write */
@@ -2715,10 +3479,10 @@ trs_disk_command_write(unsigned char cmd)
 	} else {
 	  state.bytecount = id_index_to_size(d, id_index);
 	}
-	fseek(d->file, offset(d, id_index), 0);
+	disk_seek(d, offset(d, id_index));
 
       } else /* d->emutype == DMK */ {
-	int c, nzeros, i;
+	int nzeros, i;
 	
 	/* DMK search dumps the size code into state.bytecount; adjust
            to real bytecount here */
@@ -2730,30 +3494,20 @@ trs_disk_command_write(unsigned char cmd)
 
 	/* Skip initial part of gap, per 1771 and 179x data sheets */
 	id_index += 11 * (state.density ? 2 : 1) * dmk_incr(d);
-	fseek(d->file, (DMK_HDR_SIZE +
-			(d->u.dmk.curtrack*d->u.dmk.nsides + d->u.dmk.curside)
-			* d->u.dmk.tracklen + id_index), 0);
+	dmk_modified(d, 1);
 
 	/* Write remaining gap (per data sheets) and DAM */
 	nzeros = 6 * (state.density ? 2 : 1) * dmk_incr(d);
 	for (i=0; i<nzeros; i++) {
-	  c = putc(0, d->file);
-	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  d->u.dmk.buf[id_index++] = 0;
 	}
 	if (state.density) {
 	  for (i=0; i<3; i++) {
-	    c = putc(0xa1, d->file);
-	    if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	    d->u.dmk.buf[id_index++] = 0xa1;
 	  }	    
 	}
-	c = putc(dam, d->file);
-	if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	d->u.dmk.buf[id_index++] = dam;
 	if (dmk_incr(d) == 2) {
-	  c = putc(dam, d->file);
-	  if (c == EOF) state.status |= TRSDISK_WRITEFLT;
 	  d->u.dmk.buf[id_index++] = dam;
 	}
 
@@ -2805,7 +3559,7 @@ trs_disk_command_write(unsigned char cmd)
 	state.status = TRSDISK_BUSY;
 	state.bytecount = 0;
 	trs_schedule_event(trs_disk_done, TRSDISK_NOTFOUND,
-			   1000000*z80_state.clockMHz);
+			   trs_disk_delay(1000000*z80_state.clockMHz));
 	break;
       }
       /* Compute how long it should have taken for this sector to come
@@ -2854,7 +3608,7 @@ trs_disk_command_write(unsigned char cmd)
 	  state.status = TRSDISK_BUSY;
 	  state.bytecount = 0;
 	  trs_schedule_event(trs_disk_done, TRSDISK_NOTFOUND,
-			     1000000*z80_state.clockMHz);
+			     trs_disk_delay(1000000*z80_state.clockMHz));
 	  break;
 	}
 	/* Which sector header is next?  Use a rough assumption that
@@ -2889,7 +3643,7 @@ trs_disk_command_write(unsigned char cmd)
       state.status = TRSDISK_BUSY;
       state.last_readadr = i;
       state.bytecount = 6;
-      trs_schedule_event(trs_disk_firstdrq, 0, ts);
+      trs_schedule_event(trs_disk_firstdrq, 0, trs_disk_delay(ts));
       if (trs_disk_debug_flags & DISKDEBUG_READADR) {
 	debug("readadr phytrack %d angle %f i %d ts %d\n",
 	      d->phytrack, a, i, ts);
@@ -2928,7 +3682,7 @@ trs_disk_command_write(unsigned char cmd)
       state.status = TRSDISK_BUSY;
       state.bytecount = 0;
       trs_schedule_event(trs_disk_done, TRSDISK_NOTFOUND,
-			 1000000*z80_state.clockMHz);
+			 trs_disk_delay(1000000*z80_state.clockMHz));
       break;
     found:
       /* Convert dden byte count to t-states */
@@ -2943,7 +3697,7 @@ trs_disk_command_write(unsigned char cmd)
 			     : 0xffff),
 			    d->u.dmk.buf[idamp]);
       d->u.dmk.curbyte = idamp + dmk_incr(d);
-      trs_schedule_event(trs_disk_firstdrq, 0, ts);
+      trs_schedule_event(trs_disk_firstdrq, 0, trs_disk_delay(ts));
       if (trs_disk_debug_flags & DISKDEBUG_READADR) {
 	debug("readadr phytrack %d angle %f i %d ts %d\n",
 	      d->phytrack, a, i, ts);
@@ -3035,9 +3789,10 @@ trs_disk_command_write(unsigned char cmd)
 	  error("DMK disk created as single sided only");
 	  state.status |= TRSDISK_WRITEFLT;
 	}
-	d->u.dmk.curtrack = d->phytrack;
-	d->u.dmk.curside = state.curside;
-	memset(d->u.dmk.buf, 0, sizeof(d->u.dmk.buf));
+	dmk_get_track(d);
+	memcpy(dmk_oldtrack, d->u.dmk.buf, DMK_TRACKLEN_MAX);
+	memset(d->u.dmk.buf, 0, DMK_TRACKLEN_MAX);
+	dmk_modified(d, 0);
 	d->u.dmk.curbyte = DMK_TKHDR_SIZE;
 	d->u.dmk.nextidam = 0;
       }
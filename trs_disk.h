@@ -19,6 +19,9 @@ unsigned char trs_disk_sector_read(void);
 void trs_disk_sector_write(unsigned char data);
 unsigned char trs_disk_data_read(void);
 void trs_disk_data_write(unsigned char data);
+int trs_disk_data_block_limit(int writing);
+void trs_disk_data_read_block(unsigned char *buf, int n);
+void trs_disk_data_write_block(const unsigned char *buf, int n);
 unsigned char trs_disk_status_read(void);
 void trs_disk_command_write(unsigned char cmd);
 unsigned char trs_disk_interrupt_read(void); /* M3 only */
@@ -28,11 +31,18 @@ void trs_disk_setstep(int unit, int value);
 int trs_disk_getstep(int unit);
 void trs_disk_setsize(int unit, int value);
 int trs_disk_getsize(int unit);
+void trs_disk_setfast(int unit, int value);
+int trs_disk_getfast(int unit);
 
 extern int trs_disk_doubler;
 extern char* trs_disk_dir;
 extern unsigned short trs_changecount;
 extern int trs_disk_truedam;
+extern int trs_disk_mmap;
+extern int trs_disk_msync;
+extern int trs_disk_ram;
+extern int trs_disk_ram_interval;
+extern char *trs_disk_overlay;
 
 /* Values for trs_disk_doubler flag word */
 #define TRSDISK_NODOUBLER 0
@@ -40,6 +50,14 @@ extern int trs_disk_truedam;
 #define TRSDISK_TANDY     2
 #define TRSDISK_BOTH      3
 
+/* Values for trs_disk_msync: what to do after a write with -diskmmap */
+#define TRSDISK_MSYNC_NONE  0  /* leave writeback to the host */
+#define TRSDISK_MSYNC_ASYNC 1  /* start writeback */
+#define TRSDISK_MSYNC_SYNC  2  /* wait for writeback */
+
+/* Default seconds between write-backs with -diskram */
+#define TRSDISK_RAM_INTERVAL 5
+
 /* Model I drive select register -- address bits 0,1 not decoded */
 #define TRSDISK_SELECT(addr) (((addr)&~3) == 0x37e0)
 #define TRSDISK_0       0x1
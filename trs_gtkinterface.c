@@ -44,6 +44,11 @@
 #include "trs_disk.h"
 #include "trs_uart.h"
 #include "keyrepeat.h"
+#include "trs_profile.h"
+#include "trs_trace.h"
+#include "trs_cover.h"
+#include "trs_heat.h"
+#include "trs_metrics.h"
 
 /*#define MOUSEDEBUG 6*/
 /*#define KDEBUG 1*/
@@ -77,6 +82,8 @@ GtkWidget *main_window;
 GtkWidget *about_dialog;
 GtkWidget *quit_dialog;
 GtkWidget *drawing_area;
+GtkWidget *overlay_label;
+GtkWidget *overlay_menu_item;
 GdkPixmap *trs_screen_pixmap;
 GdkGC     *gc;
 GdkGC     *gc_inv;
@@ -293,6 +300,8 @@ char *opt_romfile4p = NULL;
 int opt_stepdefault = 1;
 char *opt_stepmap = NULL;
 char *opt_sizemap = NULL;
+int opt_fastdefault = 0;
+char *opt_fastmap = NULL;
 
 struct option options[] = {
   /* Name, takes argument?, store int value at, value to store */
@@ -336,6 +345,9 @@ struct option options[] = {
   {"nodoublestep",   FALSE, &opt_stepdefault,  1     },
   {"stepmap",        TRUE,  NULL,              0     },
   {"sizemap",        TRUE,  NULL,              0     },
+  {"fastdisk",       FALSE, &opt_fastdefault,  1     },
+  {"nofastdisk",     FALSE, &opt_fastdefault,  0     },
+  {"fastmap",        TRUE,  NULL,              0     },
   {"truedam",        FALSE, &trs_disk_truedam, TRUE  },
   {"notruedam",      FALSE, &trs_disk_truedam, FALSE },
   {"samplerate",     TRUE,  NULL,              0     },
@@ -343,6 +355,31 @@ struct option options[] = {
   {"switches",       TRUE,  NULL,              0     },
   {"emtsafe",        FALSE, &trs_emtsafe,      TRUE  },
   {"noemtsafe",      FALSE, &trs_emtsafe,      FALSE },
+  {"callprofile",    TRUE,  NULL,              0     },
+  {"sampleprofile",  TRUE,  NULL,              0     },
+  {"sampleinterval", TRUE,  NULL,              0     },
+  {"tracebuffer",    TRUE,  NULL,              0     },
+  {"tracefile",      TRUE,  NULL,              0     },
+  {"tracestream",    TRUE,  NULL,              0     },
+  {"tracelimit",     TRUE,  NULL,              0     },
+  {"traceio",        FALSE, &trs_trace_stream_io, TRUE  },
+  {"notraceio",      FALSE, &trs_trace_stream_io, FALSE },
+  {"coverage",       TRUE,  NULL,              0     },
+  {"coverbranches",  FALSE, &trs_cover_branches, TRUE  },
+  {"nocoverbranches", FALSE, &trs_cover_branches, FALSE },
+  {"heatmap",        TRUE,  NULL,              0     },
+  {"metrics",        TRUE,  NULL,              0     },
+  {"metricsinterval", TRUE, NULL,              0     },
+  {"overlay",        FALSE, &trs_metrics_overlay, TRUE  },
+  {"nooverlay",      FALSE, &trs_metrics_overlay, FALSE },
+  {"diskmmap",       FALSE, &trs_disk_mmap,    TRUE  },
+  {"nodiskmmap",     FALSE, &trs_disk_mmap,    FALSE },
+  {"diskmsync",      TRUE,  NULL,              0     },
+  {"diskram",        FALSE, &trs_disk_ram,     TRUE  },
+  {"nodiskram",      FALSE, &trs_disk_ram,     FALSE },
+  {"diskraminterval", TRUE, NULL,              0     },
+  {"hardsync",       TRUE,  NULL,              0     },
+  {"diskoverlay",    TRUE,  NULL,              0     },
   {NULL, 0, 0, 0}
 };
 
@@ -445,12 +482,60 @@ trs_parse_command_line(int argc, char **argv, int *debug)
       opt_stepmap = optarg;
     } else if (strcmp(name, "sizemap") == 0) {
       opt_sizemap = optarg;
+    } else if (strcmp(name, "fastmap") == 0) {
+      opt_fastmap = optarg;
     } else if (strcmp(name, "samplerate") == 0) {
       cassette_default_sample_rate = strtol(optarg, NULL, 0);
     } else if (strcmp(name, "serial") == 0) {
       trs_uart_name = strdup(optarg);
     } else if (strcmp(name, "switches") == 0) {
       trs_uart_switches = strtol(optarg, NULL, 0);
+    } else if (strcmp(name, "callprofile") == 0) {
+      trs_prof_calls_file = strdup(optarg);
+    } else if (strcmp(name, "sampleprofile") == 0) {
+      trs_prof_sample_file = strdup(optarg);
+    } else if (strcmp(name, "sampleinterval") == 0) {
+      trs_prof_sample_interval = strtol(optarg, NULL, 0);
+    } else if (strcmp(name, "tracebuffer") == 0) {
+      trs_trace_size = strtol(optarg, NULL, 0);
+    } else if (strcmp(name, "tracefile") == 0) {
+      trs_trace_file = strdup(optarg);
+    } else if (strcmp(name, "tracestream") == 0) {
+      trs_trace_stream_file = strdup(optarg);
+    } else if (strcmp(name, "tracelimit") == 0) {
+      trs_trace_stream_limit = strtol(optarg, NULL, 0);
+    } else if (strcmp(name, "coverage") == 0) {
+      trs_cover_file = strdup(optarg);
+    } else if (strcmp(name, "heatmap") == 0) {
+      trs_heat_file = strdup(optarg);
+    } else if (strcmp(name, "metrics") == 0) {
+      trs_metrics_file = strdup(optarg);
+    } else if (strcmp(name, "metricsinterval") == 0) {
+      trs_metrics_interval = strtol(optarg, NULL, 0);
+    } else if (strcmp(name, "diskmsync") == 0) {
+      if (strcmp(optarg, "none") == 0) {
+	trs_disk_msync = TRSDISK_MSYNC_NONE;
+      } else if (strcmp(optarg, "async") == 0) {
+	trs_disk_msync = TRSDISK_MSYNC_ASYNC;
+      } else if (strcmp(optarg, "sync") == 0) {
+	trs_disk_msync = TRSDISK_MSYNC_SYNC;
+      } else {
+	fatal("unrecognized msync policy %s\n", optarg);
+      }
+    } else if (strcmp(name, "diskraminterval") == 0) {
+      trs_disk_ram_interval = strtol(optarg, NULL, 0);
+    } else if (strcmp(name, "hardsync") == 0) {
+      if (strcmp(optarg, "none") == 0) {
+	trs_hard_sync = TRS_HARD_SYNC_NONE;
+      } else if (strcmp(optarg, "data") == 0) {
+	trs_hard_sync = TRS_HARD_SYNC_DATA;
+      } else if (strcmp(optarg, "full") == 0) {
+	trs_hard_sync = TRS_HARD_SYNC_FULL;
+      } else {
+	fatal("unrecognized hard disk sync policy %s\n", optarg);
+      }
+    } else if (strcmp(name, "diskoverlay") == 0) {
+      trs_disk_overlay = strdup(optarg);
     }
   }
   if (optind != argc) {
@@ -561,6 +646,21 @@ trs_parse_command_line(int argc, char **argv, int *debug)
     }
   }
 
+  for (i = 0; i <= 7; i++) {
+    s[i] = opt_fastdefault;
+  }
+  if (opt_fastmap) {
+    sscanf(opt_fastmap, "%d,%d,%d,%d,%d,%d,%d,%d",
+	   &s[0], &s[1], &s[2], &s[3], &s[4], &s[5], &s[6], &s[7]);
+  }
+  for (i = 0; i <= 7; i++) {
+    if (s[i] != 0 && s[i] != 1) {
+      fatal("bad value %d for disk %d fast flag", s[i], i);
+    } else {
+      trs_disk_setfast(i, s[i]);
+    }
+  }
+
   return 1;
 }
 
@@ -655,6 +755,10 @@ trs_screen_init(void)
 						   "about_dialog"));
   quit_dialog = GTK_WIDGET(gtk_builder_get_object(builder,
 						  "quit_dialog"));
+  overlay_label = GTK_WIDGET(gtk_builder_get_object(builder,
+						    "overlay_label"));
+  overlay_menu_item = GTK_WIDGET(gtk_builder_get_object(builder,
+							"overlay_menu_item"));
 
   /*
    * Work around glade-3 not letting me connect to the delete-event
@@ -669,6 +773,11 @@ trs_screen_init(void)
   gtk_builder_connect_signals(builder, NULL);
   g_object_unref(G_OBJECT(builder));
 
+  if (trs_metrics_overlay) {
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(overlay_menu_item),
+				   TRUE);
+  }
+
   if (trs_model >= 3 && !resize) {
     cur_screen_width = cur_char_width * 80 + 2 * border_width;
     left_margin = cur_char_width * (80 - row_chars) / 2 + border_width;
@@ -772,6 +881,7 @@ trs_screen_write_char(int position, int char_index)
 {
   int row, col, destx, desty, expanded, width, height;
 
+  trs_metrics.screen_updates++;
   trs_screen[position] = char_index;
   if (position >= screen_chars) {
     return;
@@ -851,6 +961,7 @@ trs_screen_refresh()
   int i;
   int srcx, srcy, dunx, duny;
 
+  trs_metrics.screen_updates++;
   if (grafyx_enable && !grafyx_overlay) {
     srcx = cur_char_width * grafyx_xoffset;
     srcy = scale_y * grafyx_yoffset;
@@ -902,6 +1013,7 @@ void trs_screen_scroll()
 {
   int i = 0;
 
+  trs_metrics.screen_updates++;
   for (i = row_chars; i < screen_chars; i++)
     trs_screen[i - row_chars] = trs_screen[i];
 
@@ -1026,7 +1138,9 @@ void trs_get_event(int wait)
     (void)trs_uart_check_avail();
   }
   if (wait) {
+    trs_metrics_idle_begin();
     pause();
+    trs_metrics_idle_end();
     trs_paused = 1;
   }
   do {
@@ -1054,7 +1168,7 @@ void
 on_disk_change_menu_item_activate(GtkMenuItem *menuitem,
 				  gpointer user_data)
 {
-  trs_change_all();
+  trs_change_all(1);
 }
 
 
@@ -1208,6 +1322,54 @@ on_about_dialog_response(GtkMenuItem *dialog,
 }
 
 
+/*
+ * Performance overlay: a status line below the emulated screen with
+ * the speed, host CPU use, speed-control delay, and an activity light
+ * for each disk drive.
+ */
+void
+on_overlay_menu_item_toggled(GtkCheckMenuItem *menuitem,
+			     gpointer user_data)
+{
+  if (gtk_check_menu_item_get_active(menuitem)) {
+    trs_metrics_set_overlay(1);
+    gtk_label_set_markup(GTK_LABEL(overlay_label),
+			 "<tt>speed   --  cpu   --</tt>");
+    gtk_widget_show(overlay_label);
+  } else {
+    trs_metrics_set_overlay(0);
+    gtk_widget_hide(overlay_label);
+  }
+}
+
+
+static char *
+overlay_lights(char *p, const char *label, const double *sectors, int n)
+{
+  int i;
+
+  p += sprintf(p, "  %s ", label);
+  for (i = 0; i < n; i++) {
+    p += sprintf(p, "%s", sectors[i] > 0 ? "\xe2\x97\x8f" : "\xe2\x97\x8b");
+  }
+  return p;
+}
+
+
+void
+trs_screen_overlay(const trs_metrics_rates *r)
+{
+  char buf[256], *p = buf;
+
+  p += sprintf(p, "<tt>speed %3.0f%%  cpu %3.0f%%  delay %d ",
+	       r->speed * 100, r->host_cpu * 100, r->delay);
+  p = overlay_lights(p, "fd", r->floppy_sectors, METRICS_FLOPPIES);
+  p = overlay_lights(p, "hd", r->hard_sectors, METRICS_HARDS);
+  strcpy(p, "</tt>");
+  gtk_label_set_markup(GTK_LABEL(overlay_label), buf);
+}
+
+
 gboolean
 on_drawing_area_expose_event(GtkWidget *widget,
 			     GdkEventExpose  *event,
@@ -1295,7 +1457,7 @@ on_drawing_area_key_press_event(GtkWidget *widget,
     keysym = 0;
     break;
   case GDK_F7:
-    trs_change_all();
+    trs_change_all(1);
     keysym = 0;
     break;
   default:
@@ -19,9 +19,15 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "trs.h"
 #include "trs_hard.h"
+#include "trs_metrics.h"
 #include "reed.h"
+#include "hdsparse.h"
+#include "overlay.h"
+#include "trs_watch.h"
 
 /*#define HARDDEBUG1 1*/  /* show detail on all port i/o */
 /*#define HARDDEBUG2 1*/  /* show all commands */
@@ -32,12 +38,22 @@
 /* Structure describing one drive */
 typedef struct {
   char *name;
-  FILE *file;
+  int fd;    /* -1 if not open */
+  HdSparse *sparse; /* NULL unless a sparse image is open */
+  Overlay *ov;      /* NULL unless opened with -diskoverlay */
+  int watch;        /* trs_watch handle for name */
   /* Values decoded from rhh */
   int writeprot;
   int cyls;  /* cyls per drive */
   int heads; /* tracks per cyl */
   int secs;  /* secs per track */
+  int size;  /* sector size code, as in the SDH register */
+  int secsize; /* bytes per sector */
+  int xgeom; /* geometry came from our header extension */
+  /* 0 or 1: whether the driver numbers sectors from 1, or -1 if it
+     has not shown yet; needed to find the end of a track in multiple
+     sector commands */
+  int secbase;
 } Drive;
 
 /* Structure describing controller state */
@@ -54,18 +70,28 @@ typedef struct {
   Ushort cyl;
   Uchar drive;
   Uchar head;
+  Uchar size;
   Uchar status;
   Uchar command;
 
   /* Number of bytes already done in current read/write */
   int bytesdone;
 
+  /* Current sector: its offset and size in the image, and its data,
+     read when a read command reaches it and written when the last
+     byte of a write arrives */
+  off_t offset;
+  int secsize;
+  Uchar buf[TRS_HARD_MAXSECSIZE];
+
   /* Drive geometries and files */
   Drive d[TRS_HARD_MAXDRIVES];
 } State;
 
 static State state;
 
+int trs_hard_sync = TRS_HARD_SYNC_NONE;
+
 /* Forward */
 static int hard_data_in();
 static void hard_data_out(int value);
@@ -78,7 +104,13 @@ static void hard_init(int cmd);
 static void hard_seek(int cmd);
 static int open_drive(int drive);
 static int find_sector(int newstatus);
-static void set_dir_cyl(int cyl);
+static void write_sector(void);
+static int set_dir_cyl(int cyl);
+static void read_sector(void);
+static void next_sector(void);
+
+/* Bytes per sector for each SDH size code */
+static const int secsizes[] = { 256, 512, 1024, 128 };
 
 /* xtrs one-time initialization */
 void trs_hard_init(void)
@@ -92,11 +124,17 @@ void trs_hard_init(void)
     } else {
       sprintf(d->name, "%s/hard%d-%d", trs_disk_dir, trs_model, i);
     }
-    state.d[i].file = NULL;
+    state.d[i].fd = -1;
+    state.d[i].sparse = NULL;
+    state.d[i].ov = NULL;
     state.d[i].writeprot = 0;
     state.d[i].cyls = 0;
     state.d[i].heads = 0;
     state.d[i].secs = 0;
+    state.d[i].size = 0;
+    state.d[i].secsize = TRS_HARD_SECSIZE;
+    state.d[i].xgeom = 0;
+    state.d[i].secbase = -1;
   }
 }
 
@@ -136,17 +174,19 @@ void trs_hard_reset(void)
   state.cyl = 0;
   state.drive = 0;
   state.head = 0;
+  state.size = 0;
   state.status = 0;
   state.command = 0;
 }
 
-/* Check for media change */
-void trs_hard_change_all(void)
+/* Check for media change, reopening all drives if force */
+void trs_hard_change_all(int force)
 {
   int i;
   state.present = 0; // if no drives, emulate controller not present
   for (i=0; i<TRS_HARD_MAXDRIVES; i++) {
-    if (open_drive(i) == 0) state.present = 1;
+    if (force || trs_watch_changed(state.d[i].watch)) open_drive(i);
+    if (state.d[i].fd >= 0) state.present = 1;
   }
 }
 
@@ -160,7 +200,7 @@ int trs_hard_in(int port)
       int i;
       v = 0;
       for (i=0; i<TRS_HARD_MAXDRIVES; i++) {
-	open_drive(i);
+	if (trs_watch_changed(state.d[i].watch)) open_drive(i);
 	if (state.d[i].writeprot) {
 	  v |= TRS_HARD_WPBIT(i) | TRS_HARD_WPSOME;
 	}
@@ -188,7 +228,8 @@ int trs_hard_in(int port)
       v = (state.cyl >> 8) & 0xff;
       break;
     case TRS_HARD_SDH:
-      v = (state.drive << 3) | state.head;
+      v = (state.size << TRS_HARD_SIZESHIFT) |
+	(state.drive << TRS_HARD_DRIVESHIFT) | state.head;
       break;
     case TRS_HARD_STATUS:
       v = state.status;
@@ -221,7 +262,7 @@ void trs_hard_out(int port, int value)
       trs_hard_reset();
     }
     if (value & TRS_HARD_DEVICE_ENABLE) {
-      trs_hard_change_all();
+      trs_hard_change_all(0);
     }
     state.control = value;
     break;
@@ -243,10 +284,7 @@ void trs_hard_out(int port, int value)
     state.cyl = (state.cyl & 0x00ff) | ((value << 8) & 0xff00);
     break;
   case TRS_HARD_SDH:
-    if (value & TRS_HARD_SIZEMASK) {
-      error("trs_hard: size bits set to nonzero value (0x%02x)",
-	    value & TRS_HARD_SIZEMASK);
-    }
+    state.size = (value & TRS_HARD_SIZEMASK) >> TRS_HARD_SIZESHIFT;
     state.drive = (value & TRS_HARD_DRIVEMASK) >> TRS_HARD_DRIVESHIFT;
     state.head = (value & TRS_HARD_HEADMASK) >> TRS_HARD_HEADSHIFT;
 #if 0
@@ -311,13 +349,10 @@ static void hard_read(int cmd)
   debug("hard_read drive %d cyl %d hd %d sec %d\n",
 	state.drive, state.cyl, state.head, state.secnum);
 #endif
-  if (cmd & TRS_HARD_MULTI) {
-    error("trs_hard: multi-sector read not supported (0x%02x)", cmd);
-    state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
-    state.error = TRS_HARD_ABRTERR;
-    return;
+  trs_metrics.hard_sectors[state.drive]++;
+  if (find_sector(TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_DRQ)) {
+    read_sector();
   }
-  find_sector(TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_DRQ);
 }
 
 static void hard_write(int cmd)
@@ -326,12 +361,7 @@ static void hard_write(int cmd)
   debug("hard_write drive %d cyl %d hd %d sec %d\n",
 	state.drive, state.cyl, state.head, state.secnum);
 #endif
-  if (cmd & TRS_HARD_MULTI) {
-    error("trs_hard: multi-sector write not supported (0x%02x)", cmd);
-    state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
-    state.error = TRS_HARD_ABRTERR;
-    return;
-  }
+  trs_metrics.hard_sectors[state.drive]++;
   find_sector(TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_DRQ);
 }
 
@@ -346,15 +376,20 @@ static void hard_verify(int cmd)
 
 static void hard_format(int cmd)
 {
+  Drive *d = &state.d[state.drive];
+  int secs = d->fd >= 0 ? d->secs : TRS_HARD_SEC_PER_TRK;
+  int secsize = d->fd >= 0 ? d->secsize : TRS_HARD_SECSIZE;
+
 #if HARDDEBUG2
   debug("hard_format drive %d cyl %d hd %d\n",
 	state.drive, state.cyl, state.head);
 #endif
-  if (state.seccnt != TRS_HARD_SEC_PER_TRK) {
+  if (state.seccnt != (secs & 0xff)) {
     error("trs_hard: can only do %d sectors/track, not %d",
-	  TRS_HARD_SEC_PER_TRK, state.seccnt);
+	  secs, state.seccnt);
   }
-  if (state.secnum != TRS_HARD_SECSIZE_CODE) {
+  if (secsize == TRS_HARD_SECSIZE &&
+      state.secnum != TRS_HARD_SECSIZE_CODE) {
     error("trs_hard: can only do %d bytes/sectors (code %d), not code %d",
 	  TRS_HARD_SECSIZE, TRS_HARD_SECSIZE_CODE, state.secnum);
   }
@@ -382,6 +417,19 @@ static void hard_seek(int cmd)
   find_sector(TRS_HARD_READY | TRS_HARD_SEEKDONE);
 }
 
+/* Read or write the image file, through its overlay if it has one */
+static ssize_t image_pread(Drive *d, void *buf, size_t len, off_t pos)
+{
+  if (d->ov) return overlay_pread(d->ov, buf, len, pos);
+  return pread(d->fd, buf, len, pos);
+}
+
+static ssize_t image_pwrite(Drive *d, const void *buf, size_t len, off_t pos)
+{
+  if (d->ov) return overlay_pwrite(d->ov, buf, len, pos);
+  return pwrite(d->fd, buf, len, pos);
+}
+
 /* 
  * (Re)open the specified drive.
  *
@@ -399,36 +447,64 @@ static int open_drive(int drive)
 {
   Drive *d = &state.d[drive];
   ReedHardHeader rhh;
-  size_t res;
+  ssize_t res;
   int err = 0;
 
-  if (d->file != NULL) {
-    fclose(d->file);
-    d->file = NULL;
+  if (d->sparse) {
+    hds_close(d->sparse);
+    d->sparse = NULL;
+  }
+  if (d->ov) {
+    overlay_close(d->ov);
+    d->ov = NULL;
   }
+  if (d->fd >= 0) {
+    close(d->fd);
+    d->fd = -1;
+  }
+  d->watch = trs_watch_start(d->watch, d->name);
   if (d->name == NULL) {
     goto fail;
   }
 
-  /* First try opening for reading and writing */
-  d->file = fopen(d->name, "r+");
-  if (d->file == NULL) {
-    if (errno == EACCES || errno == EROFS) {
-      /* No luck, try for reading only */
-      d->file = fopen(d->name, "r");
+  if (trs_disk_overlay != NULL) {
+    /* Writes go to the delta file, so the image need only be read */
+    d->fd = open(d->name, O_RDONLY);
+    if (d->fd < 0) {
+      err = errno;
+      goto fail;
     }
-    if (d->file == NULL) {
+    d->ov = overlay_open(trs_disk_overlay, d->name, d->fd);
+    if (d->ov == NULL) {
       err = errno;
+      error("trs_hard: could not open overlay for %s: %s", d->name,
+	    err == ESTALE ? "image has changed since the delta file was made"
+	    : strerror(err));
       goto fail;
     }
-    d->writeprot = 1;
-  } else {
     d->writeprot = 0;
+  } else {
+    /* First try opening for reading and writing */
+    d->fd = open(d->name, O_RDWR);
+    if (d->fd < 0) {
+      if (errno == EACCES || errno == EROFS) {
+	/* No luck, try for reading only */
+	d->fd = open(d->name, O_RDONLY);
+      }
+      if (d->fd < 0) {
+	err = errno;
+	goto fail;
+      }
+      d->writeprot = 1;
+    } else {
+      d->writeprot = 0;
+    }
   }
 
   /* Read in the Reed header and check some basic magic numbers (not all) */
-  res = fread(&rhh, sizeof(rhh), 1, d->file);
-  if (res != 1 || rhh.id1 != 0x56 || rhh.id2 != 0xcb || rhh.ver != 0x10) {
+  res = image_pread(d, &rhh, sizeof(rhh), 0);
+  if (res != sizeof(rhh) ||
+      rhh.id1 != 0x56 || rhh.id2 != 0xcb || rhh.ver != 0x10) {
     err = -1;
     goto fail;
   }
@@ -437,41 +513,80 @@ static int open_drive(int drive)
   /* Use the number of cylinders specified in the header */
   d->cyls = rhh.cyl ? rhh.cyl : 256;
 
-  /* Use the number of secs/track that RSHARD requires */
-  d->secs = TRS_HARD_SEC_PER_TRK;
+  /* Use the number of secs/track that RSHARD requires, unless
+     mkdisk -t recorded another in our extension to the header */
+  d->secs = rhh.xsec ? rhh.xsec : TRS_HARD_SEC_PER_TRK;
+  d->size = rhh.xsize & (TRS_HARD_SIZEMASK >> TRS_HARD_SIZESHIFT);
+  d->secsize = secsizes[d->size];
+  d->xgeom = rhh.xsec != 0 || rhh.xsize != 0 || rhh.xheads != 0;
 
   /* Header gives only secs/cyl.  Compute number of heads from 
-     this and the assumed number of secs/track. */
-  d->heads = (rhh.sec ? rhh.sec : 256) / d->secs;
+     this and the assumed number of secs/track, again unless the
+     extension gives it. */
+  if (rhh.xheads) {
+    d->heads = rhh.xheads;
+  } else if (((rhh.sec ? rhh.sec : 256) % d->secs) != 0) {
+    d->heads = 0;
+  } else {
+    d->heads = (rhh.sec ? rhh.sec : 256) / d->secs;
+  }
 
-  if ((rhh.sec % d->secs) != 0 ||
-      d->heads <= 0 || d->heads > TRS_HARD_MAXHEADS) {
+  if (d->heads <= 0 || d->heads > TRS_HARD_MAXHEADS) {
     error("trs_hard: unusable geometry in image %s", d->name);
     err = -1;
     goto fail;
   }
 
+  if (rhh.xfmt == HDS_FORMAT && d->ov != NULL) {
+    error("trs_hard: cannot use an overlay on sparse image %s", d->name);
+    err = -1;
+    goto fail;
+  } else if (rhh.xfmt == HDS_FORMAT) {
+    d->sparse = hds_open(d->fd, &rhh);
+    if (d->sparse == NULL) {
+      error("trs_hard: unusable block table in image %s", d->name);
+      err = -1;
+      goto fail;
+    }
+  } else if (rhh.xfmt != 0) {
+    error("trs_hard: unknown format %d in image %s", rhh.xfmt, d->name);
+    err = -1;
+    goto fail;
+  }
+
   state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE;
   return 0;
 
  fail:
-  if (d->file) fclose(d->file);
-  d->file = NULL;
+  if (d->sparse) hds_close(d->sparse);
+  d->sparse = NULL;
+  if (d->ov) overlay_close(d->ov);
+  d->ov = NULL;
+  if (d->fd >= 0) close(d->fd);
+  d->fd = -1;
   state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
   state.error = TRS_HARD_NFERR;
   return err;
 }    
 
 /*
- * Check whether the current position is in bounds for the geometry.
- * If not, return 0 and set the controller error status.  If so, fseek
- * the file to the start of the current sector, return 1, and set
- * the controller status to newstatus.
+ * Check whether the current position is in bounds for the geometry,
+ * and the sector size in the SDH register is the drive's.  If not,
+ * return 0 and set the controller error status.  If so, set
+ * state.offset and state.secsize to the start and size of the current
+ * sector in the image file, return 1, and set the controller status
+ * to newstatus.  The image
+ * is opened if it is not open already; it stays open until the next
+ * disk change, so that each command does not reopen it.
  */
 static int find_sector(int newstatus)
 {
   Drive *d = &state.d[state.drive];
-  if (open_drive(state.drive) < 0) return 0;
+  if (d->fd < 0 && open_drive(state.drive) != 0) {
+    state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
+    state.error = TRS_HARD_NFERR;
+    return 0;
+  }
   if (/**state.cyl >= d->cyls ||**/ /* ignore this limit */
       state.head >= d->heads ||
       state.secnum > d->secs /* allow 0-origin or 1-origin */ ) {
@@ -481,24 +596,35 @@ static int find_sector(int newstatus)
     state.error = TRS_HARD_NFERR;
     return 0;
   }
-  fseek(d->file,
-	sizeof(ReedHardHeader) +
-	TRS_HARD_SECSIZE * (state.cyl * d->heads * d->secs +
-			    state.head * d->secs +
-			    (state.secnum % d->secs)),
-	0);
+  /* Drivers for standard images may leave anything in the size bits */
+  if (d->xgeom && state.size != d->size) {
+    error("trs_hard: requested %d byte sectors; drive %d has %d",
+	  secsizes[state.size], state.drive, d->secsize);
+    state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
+    state.error = TRS_HARD_NFERR;
+    return 0;
+  }
+  if (state.secnum == 0) {
+    d->secbase = 0;
+  } else if (state.secnum == d->secs) {
+    d->secbase = 1;
+  }
+  state.secsize = d->secsize;
+  state.offset = sizeof(ReedHardHeader) +
+    (off_t) d->secsize * ((off_t) state.cyl * d->heads * d->secs +
+			  state.head * d->secs +
+			  (state.secnum % d->secs));
   state.status = newstatus;
   return 1;
 }
 
 static int hard_data_in()
 {
-  Drive *d = &state.d[state.drive];
   if ((state.command & TRS_HARD_CMDMASK) == TRS_HARD_READ &&
       (state.status & TRS_HARD_ERR) == 0) {
-    if (state.bytesdone < TRS_HARD_SECSIZE) {
-      state.data = getc(d->file);
-      state.bytesdone++;
+    if (state.bytesdone < state.secsize) {
+      state.data = state.buf[state.bytesdone++];
+      if (state.bytesdone == state.secsize) next_sector();
     }
   }
   return state.data;
@@ -506,39 +632,159 @@ static int hard_data_in()
 
 static void hard_data_out(int value)
 {
-  Drive *d = &state.d[state.drive];
-  int res = 0;
   state.data = value;
   if ((state.command & TRS_HARD_CMDMASK) == TRS_HARD_WRITE &&
       (state.status & TRS_HARD_ERR) == 0) {
-    if (state.bytesdone < TRS_HARD_SECSIZE) {
-      if (state.cyl == 0 && state.head == 0 &&
-	  state.secnum == 0 && state.bytesdone == 2) {
-	set_dir_cyl(value);
-      }
-      res = putc(state.data, d->file);
-      state.bytesdone++;
-      if (res != EOF && state.bytesdone == TRS_HARD_SECSIZE) {
-	res = fflush(d->file);
+    if (state.bytesdone < state.secsize) {
+      state.buf[state.bytesdone++] = value;
+      if (state.bytesdone == state.secsize) {
+	write_sector();
+	next_sector();
       }
     }
   }
-  if (res == EOF) {
+}
+
+/* Read the current sector from the image into the buffer */
+static void read_sector(void)
+{
+  Drive *d = &state.d[state.drive];
+  ssize_t res;
+
+  if (d->sparse) {
+    res = hds_read(d->sparse, state.buf, state.secsize,
+		   state.offset - sizeof(ReedHardHeader));
+  } else {
+    res = image_pread(d, state.buf, state.secsize, state.offset);
+  }
+  if (res < 0) {
+    error("trs_hard: errno %d while reading drive %d", errno, state.drive);
+    state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
+    state.error = TRS_HARD_DATAERR; /* arbitrary choice */
+  } else if (res < state.secsize) {
+    /* Past end of image; reads as 0xff bytes */
+    memset(state.buf + res, 0xff, state.secsize - res);
+  }
+}
+
+/*
+ * The last byte of a sector has been transferred.  In a multiple
+ * sector read or write, count the sector off and, if any remain, move
+ * to the next one, going on to the next head and then the next
+ * cylinder at the end of a track.  The real WD1010 stops at the end
+ * of the track with an error instead, but no driver can depend on
+ * that, and going on lets it move a whole cylinder or more in one
+ * command.  We do stop if we cannot yet tell where the track ends,
+ * rather than guess and put the data in the wrong sector.
+ */
+static void next_sector(void)
+{
+  Drive *d = &state.d[state.drive];
+  int secnum;
+
+  if (!(state.command & TRS_HARD_MULTI) || (state.status & TRS_HARD_ERR)) {
+    return;
+  }
+  if (--state.seccnt == 0) return;
+  secnum = state.secnum + 1;
+  if (secnum == d->secs && d->secbase < 0) {
+    error("trs_hard: end of track reached before sector numbering known");
+    state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
+    state.error = TRS_HARD_NFERR;
+    return;
+  }
+  if (secnum >= d->secs + (d->secbase > 0)) {
+    secnum = d->secbase;
+    if (++state.head >= d->heads) {
+      state.head = 0;
+      state.cyl++;
+    }
+  }
+  state.secnum = secnum;
+  state.bytesdone = 0;
+  trs_metrics.hard_sectors[state.drive]++;
+  if (find_sector(TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_DRQ) &&
+      (state.command & TRS_HARD_CMDMASK) == TRS_HARD_READ) {
+    read_sector();
+  }
+}
+
+/* Write the buffered sector to the image, as -hardsync requires */
+static void write_sector(void)
+{
+  Drive *d = &state.d[state.drive];
+  int ok, fd = d->fd;
+
+  if (d->sparse) {
+    ok = hds_write(d->sparse, state.buf, state.secsize,
+		   state.offset - sizeof(ReedHardHeader)) == state.secsize;
+  } else {
+    ok = image_pwrite(d, state.buf, state.secsize, state.offset) ==
+      state.secsize;
+  }
+  if (ok && state.cyl == 0 && state.head == 0 && state.secnum == 0) {
+    ok = set_dir_cyl(state.buf[2]);
+  }
+  if (ok && d->ov) {
+    ok = overlay_sync(d->ov) == 0;
+    fd = d->ov->fd;
+  }
+  if (ok && trs_hard_sync == TRS_HARD_SYNC_DATA) {
+    ok = fdatasync(fd) == 0;
+  } else if (ok && trs_hard_sync == TRS_HARD_SYNC_FULL) {
+    ok = fsync(fd) == 0;
+  }
+  if (!ok) {
     error("trs_hard: errno %d while writing drive %d", errno, state.drive);
     state.status = TRS_HARD_READY | TRS_HARD_SEEKDONE | TRS_HARD_ERR;
     state.error = TRS_HARD_DATAERR; /* arbitrary choice */
   }
 }
 
+/* Fast path for the block I/O instructions on the data port: return
+   how many bytes trs_hard_data_in_block (if writing is 0) or
+   trs_hard_data_out_block (if 1) can move now, or 0 if there is no
+   such transfer in progress. */
+int trs_hard_data_block_limit(int writing)
+{
+  if (!state.present || (state.status & TRS_HARD_ERR) != 0 ||
+      (state.command & TRS_HARD_CMDMASK) !=
+      (writing ? TRS_HARD_WRITE : TRS_HARD_READ)) {
+    return 0;
+  }
+  return state.secsize - state.bytesdone;
+}
+
+/* Read n bytes of the sector into buf, as n calls to hard_data_in
+   would; n must be within the limit above. */
+void trs_hard_data_in_block(unsigned char *buf, int n)
+{
+  memcpy(buf, state.buf + state.bytesdone, n);
+  state.data = buf[n - 1];
+  state.bytesdone += n;
+  if (state.bytesdone == state.secsize) next_sector();
+}
+
+/* Write n bytes of the sector from buf, as n calls to hard_data_out
+   would */
+void trs_hard_data_out_block(const unsigned char *buf, int n)
+{
+  memcpy(state.buf + state.bytesdone, buf, n);
+  state.data = buf[n - 1];
+  state.bytesdone += n;
+  if (state.bytesdone == state.secsize) {
+    write_sector();
+    next_sector();
+  }
+}
+
 /* Sleazy trick to update the "directory cylinder" byte in the Reed
    header.  This value is only needed by the Reed emulator itself, and
    we would like xtrs to set it automatically so that the user doesn't
-   have to know about it. */
-static void set_dir_cyl(int cyl)
+   have to know about it.  Returns 1 if OK, 0 on error. */
+static int set_dir_cyl(int cyl)
 {
   Drive *d = &state.d[state.drive];
-  long where = ftell(d->file);
-  fseek(d->file, 31, 0);
-  putc(cyl, d->file);
-  fseek(d->file, where, 0);
+  Uchar c = cyl;
+  return image_pwrite(d, &c, 1, 31) == 1;
 }
@@ -17,21 +17,32 @@
 
 void trs_hard_init(void);
 void trs_hard_reset(void);
-void trs_hard_change_all(void);
+void trs_hard_change_all(int force);
 const char *trs_hard_get_name(int drive);
 int trs_hard_set_name(int drive, const char *name);
 int trs_hard_create(const char *name);
 int trs_hard_in(int port);
 void trs_hard_out(int port, int value);
+int trs_hard_data_block_limit(int writing);
+void trs_hard_data_in_block(unsigned char *buf, int n);
+void trs_hard_data_out_block(const unsigned char *buf, int n);
 extern char *trs_disk_dir;
+extern int trs_hard_sync;
+extern char *trs_disk_overlay;
+
+/* Values for trs_hard_sync: what to do after writing a sector */
+#define TRS_HARD_SYNC_NONE 0  /* leave writeback to the host */
+#define TRS_HARD_SYNC_DATA 1  /* fdatasync the image */
+#define TRS_HARD_SYNC_FULL 2  /* fsync the image */
 
 /* Sector size is always 256 for TRSDOS/LDOS/etc. */
-/* Other sizes currently not emulated */
+/* Other sizes (128, 512, 1024) need an image made with mkdisk -z */
 #define TRS_HARD_SECSIZE 256
+#define TRS_HARD_MAXSECSIZE 1024
 #define TRS_HARD_SECSIZE_CODE 0x0f /* size code for 256 byte sectors?!! */
 
 /* RSHARD assumes 32 sectors/track */
-/* Other sizes currently not emulated */
+/* Other values need an image made with mkdisk -t */
 #define TRS_HARD_SEC_PER_TRK 32
 
 /*
@@ -109,7 +120,7 @@ extern char *trs_disk_dir;
 
 /* Sector count register (read/write) */
 /* Used only for multiple sector accesses; otherwise ignored. */
-/* Autodecrements when used. */
+/* Autodecrements when used; 0 means 256 sectors. */
 #define TRS_HARD_SECCNT (TRS_HARD_DATA+2)
 
 /* Sector number register (read/write) */
@@ -180,7 +191,8 @@ extern char *trs_disk_dir;
  *  0010dm00
  *  d = 0 for interrupt on DRQ, 1 for interrupt at end (DMA style)
  *      TRS-80 always uses programmed I/O, INTRQ not connected, I believe.
- *  m = multiple sector flag (not emulated!)
+ *  m = multiple sector flag: transfer seccnt sectors, advancing secnum,
+ *      then head, then cyl after each one
  */
 #define TRS_HARD_READ  0x20
 #define TRS_HARD_DMA   0x08
@@ -188,7 +200,7 @@ extern char *trs_disk_dir;
 
 /* Write sector:
  *  00110m00
- *  m = multiple sector flag (not emulated!) 
+ *  m = multiple sector flag, as for read
  */
 #define TRS_HARD_WRITE 0x30
 
@@ -0,0 +1,128 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_heat.c
+ *
+ * Access counting, to find out which parts of the emulated machine
+ * are busiest and which emulated devices cost the most host time.
+ * The memory counters are bumped directly by mem_read, mem_write, and
+ * z80_run; reads include opcode and operand bytes, while a fetch is
+ * counted once per instruction, at its first byte.  The port times
+ * are measured around all of z80_in or z80_out, so they include the
+ * debugging hooks as well as the device emulation.
+ */
+
+#define _POSIX_C_SOURCE 199309L /* time.h: clock_gettime() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "z80.h"
+#include "trs.h"
+#include "trs_heat.h"
+
+char *trs_heat_file = NULL;
+int trs_heat_on = 0;
+
+unsigned long trs_heat_reads[256];
+unsigned long trs_heat_writes[256];
+unsigned long trs_heat_fetches[256];
+
+typedef struct {
+  unsigned long ins, outs;
+  unsigned long long ns;
+  int port;
+} HeatPort;
+
+static HeatPort ports[256];
+
+unsigned long long
+trs_heat_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+trs_heat_port(int port, int output, unsigned long long start)
+{
+  HeatPort *p = &ports[port & 0xff];
+
+  if (output) {
+    p->outs++;
+  } else {
+    p->ins++;
+  }
+  p->ns += trs_heat_now() - start;
+}
+
+static void
+heat_exit(void)
+{
+  FILE *f;
+
+  f = fopen(trs_heat_file, "w");
+  if (f == NULL) {
+    error("could not write heat map %s", trs_heat_file);
+    return;
+  }
+  trs_heat_dump(f);
+  fclose(f);
+}
+
+void
+trs_heat_init(void)
+{
+  if (trs_heat_file == NULL) return;
+  trs_heat_on = 1;
+  atexit(heat_exit);
+}
+
+static int
+heat_port_cmp(const void *a, const void *b)
+{
+  const HeatPort *x = (const HeatPort *) a, *y = (const HeatPort *) b;
+  if (x->ns != y->ns) return x->ns < y->ns ? 1 : -1;
+  return x->port - y->port;
+}
+
+/* Write the page counts in address order, then the ports, most host
+   time first.  Lines for untouched pages and ports are omitted. */
+void
+trs_heat_dump(FILE *f)
+{
+  HeatPort sorted[256];
+  unsigned long count;
+  int i;
+
+  fprintf(f, "# xtrs memory heat map: page reads writes fetches\n");
+  for (i = 0; i < 256; i++) {
+    if (trs_heat_reads[i] || trs_heat_writes[i] || trs_heat_fetches[i]) {
+      fprintf(f, "%02x %lu %lu %lu\n", i, trs_heat_reads[i],
+	      trs_heat_writes[i], trs_heat_fetches[i]);
+    }
+  }
+
+  for (i = 0; i < 256; i++) {
+    sorted[i] = ports[i];
+    sorted[i].port = i;
+  }
+  qsort(sorted, 256, sizeof(HeatPort), heat_port_cmp);
+  fprintf(f, "# xtrs I/O ports: port ins outs host-ns ns-per-access\n");
+  for (i = 0; i < 256; i++) {
+    count = sorted[i].ins + sorted[i].outs;
+    if (count == 0) continue;
+    fprintf(f, "%02x %lu %lu %llu %llu\n", sorted[i].port,
+	    sorted[i].ins, sorted[i].outs, sorted[i].ns, sorted[i].ns / count);
+  }
+}
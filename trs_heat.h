@@ -0,0 +1,40 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_heat.h
+ *
+ * Access counting: memory reads, writes, and instruction fetches per
+ * 256-byte page of the Z80 address space, and inputs, outputs, and
+ * host time spent emulating each I/O port.
+ */
+
+#ifndef _TRS_HEAT_H
+#define _TRS_HEAT_H
+
+#include <stdio.h>
+#include "z80.h"
+
+extern char *trs_heat_file;   /* NULL if counting is off */
+extern int trs_heat_on;
+
+extern unsigned long trs_heat_reads[256];
+extern unsigned long trs_heat_writes[256];
+extern unsigned long trs_heat_fetches[256];
+
+#define HEAT_READ(a)  (trs_heat_reads[((a) >> 8) & 0xff]++)
+#define HEAT_WRITE(a) (trs_heat_writes[((a) >> 8) & 0xff]++)
+#define HEAT_FETCH(a) (trs_heat_fetches[((a) >> 8) & 0xff]++)
+
+void trs_heat_init(void);
+unsigned long long trs_heat_now(void);  /* host nanoseconds */
+/* After emulating an access to port that began at time start */
+void trs_heat_port(int port, int output, unsigned long long start);
+void trs_heat_dump(FILE *f);
+
+#endif /*_TRS_HEAT_H*/
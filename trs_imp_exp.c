@@ -31,6 +31,8 @@
 #include "trs.h"
 #include "trs_disk.h"
 #include "trs_hard.h"
+#include "trs_profile.h"
+#include "trs_aio.h"
 
 /*
    If the following option is set, potentially dangerous emulator traps
@@ -132,6 +134,9 @@ void do_emt_getddir()
     return;
   }
   strcpy((char *)mem_pointer(REG_HL, 1), trs_disk_dir);
+  if (mem_watch_writes) {
+    debug_watch_block(REG_HL, strlen(trs_disk_dir) + 1, 1);
+  }
   REG_A = 0;
   REG_F |= ZERO_MASK;
   REG_BC = strlen(trs_disk_dir);
@@ -221,6 +226,9 @@ void do_emt_read()
     return;
   }
   size = read(REG_DE, mem_pointer(REG_HL, 1), REG_BC);
+  if (size > 0 && mem_watch_writes) {
+    debug_watch_block(REG_HL, size, 1);
+  }
   if (size >= 0) {
     REG_A = 0;
     REG_F |= ZERO_MASK;
@@ -241,6 +249,9 @@ void do_emt_write()
     REG_BC = 0xFFFF;
     return;
   }
+  if (mem_watch_reads) {
+    debug_watch_block(REG_HL, REG_BC, 0);
+  }
   size = write(REG_DE, mem_pointer(REG_HL, 0), REG_BC);
   if (size >= 0) {
     REG_A = 0;
@@ -304,6 +315,9 @@ void do_emt_strerror()
     REG_F |= ZERO_MASK;
   }
   memcpy(mem_pointer(REG_HL, 1), msg, size);
+  if (mem_watch_writes) {
+    debug_watch_block(REG_HL, size, 1);
+  }
   mem_write(REG_HL + size++, '\r');
   mem_write(REG_HL + size, '\0');
   if (errno == 0) {
@@ -431,6 +445,9 @@ void do_emt_readdir()
     return;
   }
   strcpy((char *)mem_pointer(REG_HL, 1), result->d_name);
+  if (mem_watch_writes) {
+    debug_watch_block(REG_HL, size + 1, 1);
+  }
   REG_A = 0;
   REG_F |= ZERO_MASK;
   REG_BC = size;
@@ -471,6 +488,9 @@ void do_emt_getcwd()
     REG_BC = 0xFFFF;
     return;
   }
+  if (mem_watch_writes) {
+    debug_watch_block(REG_HL, strlen(result) + 1, 1);
+  }
   REG_A = 0;
   REG_F |= ZERO_MASK;
   REG_BC = strlen(result);
@@ -480,7 +500,7 @@ void do_emt_misc()
 {
   switch (REG_A) {
   case 0:
-    trs_change_all();
+    trs_change_all(0);
     REG_HL = trs_changecount;
     break;
   case 1:
@@ -542,6 +562,18 @@ void do_emt_misc()
   case 21:
     trs_disk_truedam = REG_HL;
     break;
+  case 22:
+    trs_prof_set_region(REG_HL);
+    break;
+  case 23:
+    trs_prof_set_region(0);
+    break;
+  case 24:
+    REG_HL = trs_disk_getfast(REG_BC);
+    break;
+  case 25:
+    trs_disk_setfast(REG_BC, REG_HL);
+    break;
   case 18: // removed; do not reuse
   case 19: // removed; do not reuse
   default:
@@ -657,3 +689,119 @@ void do_emt_closedisk()
     REG_F &= ~ZERO_MASK;
   }
 }
+
+/* Guest buffer for each AIO_READ request in flight, by id */
+static unsigned short aio_addr[AIO_MAX + 1];
+
+void do_emt_aio_submit()
+{
+  int i, op, fd, addr, len, id;
+  off_t offset;
+  void *data = NULL;
+
+  if (REG_HL + 16 > 0x10000) {
+    REG_A = EFAULT;
+    REG_F &= ~ZERO_MASK;
+    REG_DE = 0xFFFF;
+    return;
+  }
+  op = mem_read(REG_HL);
+  fd = mem_read(REG_HL + 2) | (mem_read(REG_HL + 3) << 8);
+  addr = mem_read(REG_HL + 4) | (mem_read(REG_HL + 5) << 8);
+  len = mem_read(REG_HL + 6) | (mem_read(REG_HL + 7) << 8);
+  offset = 0;
+  for (i=0; i<8; i++) {
+    offset = offset + ((off_t) mem_read(REG_HL + 8 + i) << i*8);
+  }
+  if (op != AIO_FSYNC && addr + len > 0x10000) {
+    REG_A = EFAULT;
+    REG_F &= ~ZERO_MASK;
+    REG_DE = 0xFFFF;
+    return;
+  }
+  if (op == AIO_WRITE) {
+    if (mem_watch_reads) {
+      debug_watch_block(addr, len, 0);
+    }
+    data = mem_pointer(addr, 0);
+  }
+  if ((op == AIO_WRITE && data == NULL) ||
+      (op == AIO_READ && mem_pointer(addr, 1) == NULL)) {
+    /* ROM, I/O, or unmapped; read() and write() would fail the same way */
+    REG_A = EFAULT;
+    REG_F &= ~ZERO_MASK;
+    REG_DE = 0xFFFF;
+    return;
+  }
+  id = trs_aio_submit(op, fd, data, len, offset);
+  if (id > 0) {
+    aio_addr[id] = addr;
+    REG_A = 0;
+    REG_F |= ZERO_MASK;
+    REG_DE = id;
+  } else {
+    REG_A = errno;
+    REG_F &= ~ZERO_MASK;
+    REG_DE = 0xFFFF;
+  }
+}
+
+/* Common code for emt_aio_poll and emt_aio_wait */
+static void
+emt_aio_finish(int wait)
+{
+  unsigned char *buf;
+  ssize_t size;
+  int id, err;
+
+  id = trs_aio_done(REG_DE == 0xFFFF ? 0 : REG_DE, wait);
+  if (id < 0) {
+    REG_A = errno;
+    REG_F &= ~ZERO_MASK;
+    REG_BC = 0xFFFF;
+    REG_DE = 0xFFFF;
+    return;
+  }
+  if (id == 0) {
+    /* Still in progress */
+    REG_A = 0;
+    REG_F |= ZERO_MASK;
+    REG_BC = 0;
+    REG_DE = 0;
+    return;
+  }
+  size = trs_aio_result(id, &err, &buf);
+  if (size > 0 && buf != NULL) {
+    /* Deliver the data read, at the buffer as mapped now */
+    unsigned char *dest = mem_pointer(aio_addr[id], 1);
+    if (dest == NULL) {
+      size = -1;
+      err = EFAULT;
+    } else {
+      memcpy(dest, buf, size);
+      if (mem_watch_writes) {
+        debug_watch_block(aio_addr[id], size, 1);
+      }
+    }
+  }
+  trs_aio_free(id);
+  if (size >= 0) {
+    REG_A = 0;
+    REG_F |= ZERO_MASK;
+  } else {
+    REG_A = err;
+    REG_F &= ~ZERO_MASK;
+  }
+  REG_BC = size;
+  REG_DE = id;
+}
+
+void do_emt_aio_poll()
+{
+  emt_aio_finish(0);
+}
+
+void do_emt_aio_wait()
+{
+  emt_aio_finish(1);
+}
@@ -78,7 +78,38 @@
  *         Before, HL => path, null terminated
  *         After,  AF =  0 if OK, error number if not (Z flag affected)
  *
- * ED2C-ED2E reserved
+ * ED2C emt_aio_submit
+ *   Start a read, write, or fsync on the host and return at once; the
+ *   emulator goes on running while the host does the I/O.  At most 16
+ *   requests can be in flight.  The data to write is copied when the
+ *   request is submitted, so the buffer can be reused at once.  Data
+ *   read is stored into the buffer only when emt_aio_poll or
+ *   emt_aio_wait reports the request finished; the Z80 program must
+ *   call one of them for every request.
+ *         Before, HL => 16-byte control block:
+ *                       +0     operation: 0 = read, 1 = write, 2 = fsync
+ *                       +1     reserved, 0
+ *                       +2-3   fd
+ *                       +4-5   buffer address
+ *                       +6-7   nbytes
+ *                       +8-15  file offset (8-byte little-endian integer)
+ *         After,  AF =  0 if OK, error number if not (Z flag affected)
+ *                 DE =  request id, 0xFFFF if error
+ *
+ * ED2D emt_aio_poll
+ *   Check whether a request has finished, without waiting.
+ *         Before, DE =  request id, or 0xFFFF for any request
+ *         After,  DE =  id of the finished request, now freed;
+ *                       0 if it (or every request) is still in progress;
+ *                       0xFFFF if no such request
+ *                 AF =  0 if OK or in progress, error number if not
+ *                       (Z flag affected)
+ *                 BC =  nbytes read or written, 0xFFFF if error
+ *
+ * ED2E emt_aio_wait
+ *   Like emt_aio_poll, but waits until the request has finished.
+ *   The emulator stops while it waits, as with emt_read and emt_write.
+ *
  *
  * ED2F emt_debug
  *   Enter zbx, the xtrs debugger.
@@ -208,6 +239,16 @@
  *         After,  HL = 0 or 1
  *    21 = set truedam flag
  *         Before, HL = 0 or 1
+ *    22 = enter profiling region; samples taken by -sampleprofile
+ *         are tagged with the region until function 23 is called
+ *         Before, HL = region tag, 1-65535
+ *    23 = leave profiling region (tag samples with 0 again)
+ *    24 = query disk fast flag
+ *         Before, BC = unit number, 0-7
+ *         After,  HL = 0 or 1
+ *    25 = set disk fast flag (skip seek and rotational delays)
+ *         Before, BC = unit number, 0-7
+ *                 HL = 0 or 1
  *
  * ED3D emt_ftruncate
  *         Before, DE =  fd
@@ -264,3 +305,6 @@ void do_emt_misc();
 void do_emt_ftruncate();
 void do_emt_opendisk();
 void do_emt_closedisk();
+void do_emt_aio_submit();
+void do_emt_aio_poll();
+void do_emt_aio_wait();
@@ -14,6 +14,7 @@
 
 #include "z80.h"
 #include "trs.h"
+#include "trs_metrics.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <time.h>
@@ -92,9 +93,7 @@ static int timer_hz;
 #define NEWDOS3_SEC                 0x42cc
 
 static int timer_on = 1;
-#ifdef IDEBUG
 long lost_timer_interrupts = 0;
-#endif
 
 /* Note: the independent interrupt latch and mask model is not correct
    for all interrupts.  The cassette rise/fall interrupt enable is
@@ -136,11 +135,10 @@ trs_cassette_interrupts_enabled()
 void
 trs_timer_interrupt(int state)
 {
+  if (state) trs_metrics.timer_interrupts++;
   if (trs_model == 1) {
     if (state) {
-#ifdef IDEBUG
       if (interrupt_latch & M1_TIMER_BIT) lost_timer_interrupts++;
-#endif
       interrupt_latch |= M1_TIMER_BIT;
       z80_state.irq = 1;
     } else {
@@ -148,9 +146,7 @@ trs_timer_interrupt(int state)
     }
   } else {
     if (state) {
-#ifdef IDEBUG
       if (interrupt_latch & M3_TIMER_BIT) lost_timer_interrupts++;
-#endif
       interrupt_latch |= M3_TIMER_BIT;
     } else {
       interrupt_latch &= ~M3_TIMER_BIT;
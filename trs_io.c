@@ -31,6 +31,8 @@
 #include "trs_disk.h"
 #include "trs_hard.h"
 #include "trs_uart.h"
+#include "trs_trace.h"
+#include "trs_heat.h"
 
 static int modesel = 0;     /* Model I */
 static int modeimage = 0x8; /* Model III/4/4p */
@@ -42,9 +44,16 @@ int trs_io_debug_flags = 0;
 /*ARGSUSED*/
 void z80_out(int port, int value)
 {
+  unsigned long long start = 0;
+
+  if (trs_heat_on) start = trs_heat_now();
   if (trs_io_debug_flags & IODEBUG_OUT) {
     debug("out (0x%02x), 0x%02x; pc 0x%04x\n", port, value, z80_state.pc.word);
   }
+  if (io_watch_outs && WATCHED(io_watch_outs, port & 0xff)) {
+    debug_watch_io(port & 0xff, value, 1);
+  }
+  if (trs_trace_io) trs_trace_port(STREAM_OUT, port & 0xff, value);
   /* First, ports common to all models */
   switch (port) {
   case TRS_HARD_WP:       /* 0xC0 */
@@ -257,6 +266,7 @@ void z80_out(int port, int value)
       break;
     }
   }
+  if (trs_heat_on) trs_heat_port(port, 1, start);
   return;
 }
 
@@ -264,6 +274,9 @@ void z80_out(int port, int value)
 int z80_in(int port)
 {
   int value = 0xff; // value returned for nonexistent ports
+  unsigned long long start = 0;
+
+  if (trs_heat_on) start = trs_heat_now();
 
   /* First, ports common to all models */
 
@@ -467,6 +480,54 @@ int z80_in(int port)
   if (trs_io_debug_flags & IODEBUG_IN) {
     debug("in (0x%02x) => 0x%02x; pc %04x\n", port, value, z80_state.pc.word);
   }
+  if (io_watch_ins && WATCHED(io_watch_ins, port & 0xff)) {
+    debug_watch_io(port & 0xff, value, 0);
+  }
+  if (trs_trace_io) trs_trace_port(STREAM_IN, port & 0xff, value);
+  if (trs_heat_on) trs_heat_port(port, 0, start);
 
   return value;
 }
+
+/*
+ * Fast path for the block I/O instructions.  If port is a disk data
+ * port in the middle of a sector transfer, return how many bytes
+ * z80_in_block (if writing is 0) or z80_out_block (if 1) can move in
+ * one call.  Return 0 if the caller must use z80_in or z80_out, as
+ * when port I/O is being debugged, watched, traced, or counted.
+ */
+int z80_block_limit(int port, int writing)
+{
+  if (trs_io_debug_flags || trs_trace_io || trs_heat_on ||
+      (writing ? io_watch_outs : io_watch_ins)) {
+    return 0;
+  }
+  switch (port) {
+  case TRS_HARD_DATA:   /* 0xC8 */
+    return trs_hard_data_block_limit(writing);
+  case TRSDISK3_DATA:   /* 0xF3 */
+    if (trs_model != 1) return trs_disk_data_block_limit(writing);
+    break;
+  }
+  return 0;
+}
+
+/* Read n bytes from port, within the limit above */
+void z80_in_block(int port, Uchar *buf, int n)
+{
+  if (port == TRS_HARD_DATA) {
+    trs_hard_data_in_block(buf, n);
+  } else {
+    trs_disk_data_read_block(buf, n);
+  }
+}
+
+/* Write n bytes to port, within the limit above */
+void z80_out_block(int port, const Uchar *buf, int n)
+{
+  if (port == TRS_HARD_DATA) {
+    trs_hard_data_out_block(buf, n);
+  } else {
+    trs_disk_data_write_block(buf, n);
+  }
+}
@@ -31,6 +31,9 @@
 #include <stdlib.h>
 #include "trs_disk.h"
 #include "trs_hard.h"
+#include "trs_trace.h"
+#include "trs_cover.h"
+#include "trs_heat.h"
 
 #define MAX_ROM_SIZE	(0x3800)
 #define MAX_VIDEO_SIZE	(0x0800)
@@ -97,15 +100,17 @@ void mem_bank(int command)
 	error("unknown mem_bank command %d", command);
 	break;
     }
+    trs_cover_remap();
 }
 
-/* Check for changes in all floppy, hard, and stringy drives. */
+/* Check for changes in all floppy, hard, and stringy drives.  Unless
+   force, only drives whose images have changed are reopened. */
 void
-trs_change_all()
+trs_change_all(int force)
 {
-  trs_disk_change_all();
-  trs_hard_change_all();
-  stringy_change_all();
+  trs_disk_change_all(force);
+  trs_hard_change_all(force);
+  stringy_change_all(force);
   trs_changecount++;
 }
 
@@ -119,7 +124,7 @@ void trs_reset(int poweron)
     trs_disk_reset();
     trs_hard_reset();
     stringy_reset();
-    trs_change_all();
+    trs_change_all(1);
 
     if (trs_model == 5) {
         /* Switch in boot ROM */
@@ -169,12 +174,25 @@ void trs_reset(int poweron)
 void mem_map(int which)
 {
     memory_map = which + (trs_model << 4) + (romin << 2);
+    trs_cover_remap();
 }
 
 void mem_romin(int state)
 {
     romin = (state & 1);
     memory_map = (memory_map & ~4) + (romin << 2);
+    trs_cover_remap();
+}
+
+/*
+ * Return a small integer identifying the current memory mapping
+ * (model, map, boot ROM, and upper/lower 32K bank selection), so that
+ * profiles can tell apart different code visible at the same address.
+ */
+int mem_context()
+{
+    return memory_map | ((bank_offset[0] >> 15) << 8)
+	| ((bank_offset[1] >> 15) << 10);
 }
 
 void mem_init()
@@ -223,6 +241,11 @@ int mem_read(int address)
 {
     address &= 0xffff; /* allow callers to be sloppy */
 
+    if (mem_watch_reads && WATCHED(mem_watch_reads, address)) {
+	debug_watch_mem(address, 0, 0);
+    }
+    if (trs_heat_on) HEAT_READ(address);
+
     switch (memory_map) {
       case 0x10: /* Model I */
 	if (address >= VIDEO_START) return memory[address];
@@ -296,6 +319,12 @@ void mem_write(int address, int value)
 {
     address &= 0xffff;
 
+    if (mem_watch_writes && WATCHED(mem_watch_writes, address)) {
+	debug_watch_mem(address, value, 1);
+    }
+    if (trs_trace_io) trs_trace_mem_write(address, value);
+    if (trs_heat_on) HEAT_WRITE(address);
+
     switch (memory_map) {
       case 0x10: /* Model I */
 	if (address >= RAM_START) {
@@ -519,8 +548,11 @@ int
 mem_block_transfer(Ushort dest, Ushort source, int direction, Ushort count)
 {
     int ret;
-    /* special case for screen scroll */
-    if((trs_model <= 3 || (memory_map & 3) < 2) &&
+    /* special case for screen scroll; bypasses watchpoints, tracing,
+       and access counting */
+    if(!mem_watch_reads && !mem_watch_writes && !trs_trace_io &&
+       !trs_heat_on &&
+       (trs_model <= 3 || (memory_map & 3) < 2) &&
        (dest == VIDEO_START) && (source == VIDEO_START + 0x40) &&
        (count == 0x3c0) && (direction > 0) && !grafyx_m3_active())
     {
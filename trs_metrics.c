@@ -0,0 +1,201 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_metrics.c
+ *
+ * Emulator self-metrics.  The counters in trs_metrics are always
+ * kept, since each is a single increment on an already slow path.
+ * If -metrics is given or the overlay is on, z80_run calls
+ * trs_metrics_poll whenever it polls for X events.  Every
+ * -metricsinterval seconds that writes a status file of "name value"
+ * lines, with rates computed over the interval just ended; the file
+ * is written under a temporary name and renamed into place, so
+ * readers never see a partial file.  The overlay gets its own rates
+ * several times a second.
+ */
+
+#define _XOPEN_SOURCE 500 /* sys/time.h: gettimeofday(), getrusage() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "z80.h"
+#include "trs.h"
+#include "trs_metrics.h"
+
+trs_metrics_counts trs_metrics;
+char *trs_metrics_file = NULL;
+int trs_metrics_interval = METRICS_DEFAULT_INTERVAL;
+int trs_metrics_overlay = 0;
+
+/* The state at the start of an interval */
+typedef struct {
+  double time, cpu;
+  tstate_t t_count;
+  trs_metrics_counts counts;
+} Sample;
+
+static Sample file_last, overlay_last;
+static double start_time;
+static double idle_start;
+static char *tmp_file;
+
+static double
+metrics_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double
+metrics_cpu(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void
+metrics_sample(Sample *s, double now)
+{
+  s->time = now;
+  s->cpu = metrics_cpu();
+  s->t_count = z80_state.t_count;
+  s->counts = trs_metrics;
+}
+
+/* Compute the rates between samples a and b */
+static void
+metrics_rates(const Sample *a, const Sample *b, trs_metrics_rates *r)
+{
+  double secs = b->time - a->time;
+  int i;
+
+  r->secs = secs;
+  r->emulated_mhz = (b->t_count - a->t_count) / secs / 1e6;
+  r->speed = r->emulated_mhz / z80_state.clockMHz;
+  r->host_cpu = (b->cpu - a->cpu) / secs;
+  r->idle = (b->counts.idle_us - a->counts.idle_us) / 1e6 / secs;
+  r->delay = z80_state.delay;
+  r->screen_updates =
+    (b->counts.screen_updates - a->counts.screen_updates) / secs;
+  r->timer_interrupts =
+    (b->counts.timer_interrupts - a->counts.timer_interrupts) / secs;
+  for (i = 0; i < METRICS_FLOPPIES; i++) {
+    r->floppy_sectors[i] =
+      (b->counts.floppy_sectors[i] - a->counts.floppy_sectors[i]) / secs;
+  }
+  for (i = 0; i < METRICS_HARDS; i++) {
+    r->hard_sectors[i] =
+      (b->counts.hard_sectors[i] - a->counts.hard_sectors[i]) / secs;
+  }
+  r->cassette_samples =
+    (b->counts.cassette_samples - a->counts.cassette_samples) / secs;
+}
+
+void
+trs_metrics_init(void)
+{
+  start_time = metrics_time();
+  metrics_sample(&file_last, start_time);
+  overlay_last = file_last;
+  if (trs_metrics_file == NULL) return;
+  if (trs_metrics_interval <= 0) {
+    fatal("bad metrics interval %d", trs_metrics_interval);
+  }
+  tmp_file = (char *) malloc(strlen(trs_metrics_file) + 5);
+  if (tmp_file == NULL) fatal("out of memory in metrics");
+  sprintf(tmp_file, "%s.tmp", trs_metrics_file);
+}
+
+/* Start a fresh interval when the overlay is turned on, so that its
+   first rates are not averaged over the time it was off. */
+void
+trs_metrics_set_overlay(int on)
+{
+  trs_metrics_overlay = on;
+  if (on) metrics_sample(&overlay_last, metrics_time());
+}
+
+void
+trs_metrics_idle_begin(void)
+{
+  idle_start = metrics_time();
+}
+
+void
+trs_metrics_idle_end(void)
+{
+  trs_metrics.idle_us += (metrics_time() - idle_start) * 1e6;
+}
+
+static void
+metrics_write(const trs_metrics_rates *r, double now)
+{
+  FILE *f;
+  int i;
+
+  f = fopen(tmp_file, "w");
+  if (f == NULL) {
+    error("could not write metrics %s", tmp_file);
+    trs_metrics_file = NULL;
+    return;
+  }
+  fprintf(f, "uptime %.0f\n", now - start_time);
+  fprintf(f, "interval %.3f\n", r->secs);
+  fprintf(f, "emulated_mhz %.3f\n", r->emulated_mhz);
+  fprintf(f, "target_mhz %.3f\n", z80_state.clockMHz);
+  fprintf(f, "speed %.3f\n", r->speed);
+  fprintf(f, "host_cpu %.3f\n", r->host_cpu);
+  fprintf(f, "delay %d\n", r->delay);
+  fprintf(f, "idle %.3f\n", r->idle);
+  fprintf(f, "screen_updates_per_sec %.1f\n", r->screen_updates);
+  fprintf(f, "timer_interrupts_per_sec %.1f\n", r->timer_interrupts);
+  fprintf(f, "lost_timer_interrupts %ld\n", lost_timer_interrupts);
+  for (i = 0; i < METRICS_FLOPPIES; i++) {
+    fprintf(f, "floppy%d_sectors_per_sec %.1f\n", i, r->floppy_sectors[i]);
+  }
+  for (i = 0; i < METRICS_HARDS; i++) {
+    fprintf(f, "hard%d_sectors_per_sec %.1f\n", i, r->hard_sectors[i]);
+  }
+  fprintf(f, "cassette_samples_per_sec %.1f\n", r->cassette_samples);
+  if (fclose(f) != 0 || rename(tmp_file, trs_metrics_file) != 0) {
+    error("could not write metrics %s", trs_metrics_file);
+    trs_metrics_file = NULL;
+  }
+}
+
+void
+trs_metrics_poll(void)
+{
+  double now = metrics_time();
+  trs_metrics_rates r;
+  Sample s;
+
+  if (trs_metrics_overlay &&
+      now - overlay_last.time >= METRICS_OVERLAY_INTERVAL) {
+    metrics_sample(&s, now);
+    metrics_rates(&overlay_last, &s, &r);
+    trs_screen_overlay(&r);
+    overlay_last = s;
+  }
+  if (trs_metrics_file && now - file_last.time >= trs_metrics_interval) {
+    metrics_sample(&s, now);
+    metrics_rates(&file_last, &s, &r);
+    metrics_write(&r, now);
+    file_last = s;
+  }
+}
@@ -0,0 +1,64 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_metrics.h
+ *
+ * Emulator self-metrics: how fast the emulation is running and how
+ * busy the emulated devices are, written periodically to a status
+ * file for monitoring, or shown by the frontend in an overlay.
+ */
+
+#ifndef _TRS_METRICS_H
+#define _TRS_METRICS_H
+
+#define METRICS_FLOPPIES 8  /* NDRIVES in trs_disk.c */
+#define METRICS_HARDS    4  /* TRS_HARD_MAXDRIVES */
+#define METRICS_DEFAULT_INTERVAL 1  /* seconds */
+#define METRICS_OVERLAY_INTERVAL 0.25  /* seconds */
+
+/* Event counts since startup, bumped by the modules concerned */
+typedef struct {
+  unsigned long screen_updates;    /* characters drawn, refreshes */
+  unsigned long timer_interrupts;
+  unsigned long floppy_sectors[METRICS_FLOPPIES];
+  unsigned long hard_sectors[METRICS_HARDS];
+  unsigned long cassette_samples;  /* read or written */
+  unsigned long long idle_us;      /* host time waiting for input */
+} trs_metrics_counts;
+
+/* Rates over an interval, per second except as noted */
+typedef struct {
+  double secs;                     /* length of the interval */
+  double emulated_mhz;
+  double speed;                    /* emulated_mhz / z80_state.clockMHz */
+  double host_cpu;                 /* fraction of one host CPU */
+  double idle;                     /* fraction of time in pause() */
+  int delay;                       /* z80_state.delay at the end */
+  double screen_updates;
+  double timer_interrupts;
+  double floppy_sectors[METRICS_FLOPPIES];
+  double hard_sectors[METRICS_HARDS];
+  double cassette_samples;
+} trs_metrics_rates;
+
+extern trs_metrics_counts trs_metrics;
+extern char *trs_metrics_file;      /* NULL if the status file is off */
+extern int trs_metrics_interval;
+extern int trs_metrics_overlay;     /* frontend overlay is shown */
+
+void trs_metrics_init(void);
+void trs_metrics_set_overlay(int on);
+void trs_metrics_poll(void);        /* called often from z80_run */
+void trs_metrics_idle_begin(void);
+void trs_metrics_idle_end(void);
+
+/* Provided by the frontend: redraw the overlay with new rates */
+void trs_screen_overlay(const trs_metrics_rates *r);
+
+#endif /*_TRS_METRICS_H*/
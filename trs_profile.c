@@ -0,0 +1,464 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_profile.c
+ *
+ * Profiling of emulated Z80 code.
+ *
+ * The call-graph profiler keeps a calling context tree: one node per
+ * distinct chain of subroutine entry points.  Whenever the shadow
+ * stack changes, the T-states since the previous change are charged
+ * to the node that was current, giving exclusive time per context;
+ * inclusive time is the sum over a node's subtree.  At exit the tree
+ * is written in the "folded stack" format read by flamegraph tools:
+ * one line per context, entry points separated by semicolons,
+ * followed by the exclusive T-state count.
+ *
+ * The sampling profiler is much cheaper: it looks at the machine only
+ * once every N T-states, using a deadline in z80_state that z80_run
+ * checks alongside the event scheduler's, so it costs one comparison
+ * per instruction plus one hash table update per sample.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "z80.h"
+#include "trs.h"
+#include "trs_profile.h"
+
+int trs_prof_calls = 0;
+char *trs_prof_calls_file = NULL;
+
+typedef struct {
+  int parent;          /* index of parent node; -1 for the root */
+  int next;            /* next node in the same hash chain */
+  Ushort addr;         /* subroutine entry point */
+  Uchar kind;          /* PROF_KIND_* */
+  unsigned long calls; /* times this context was entered */
+  tstate_t self;       /* exclusive T-states */
+  tstate_t total;      /* inclusive T-states, valid only while dumping */
+} ProfNode;
+
+typedef struct {
+  int node;
+  Ushort sp;           /* stack address holding the return address */
+} ProfFrame;
+
+#define PROF_HASH_SIZE 4096
+#define PROF_MAX_DEPTH 512
+#define PROF_MAX_PATH  64
+
+static ProfNode *nodes;
+static int num_nodes, max_nodes;
+static int hash[PROF_HASH_SIZE];
+
+static ProfFrame frames[PROF_MAX_DEPTH];
+static int depth;
+static int cur_node;
+static tstate_t last_t;
+
+static int
+prof_hash(int parent, Ushort addr, int kind)
+{
+  return ((unsigned) parent * 31 + addr * 7 + kind) % PROF_HASH_SIZE;
+}
+
+static int
+prof_child(int parent, Ushort addr, int kind)
+{
+  int h = prof_hash(parent, addr, kind);
+  int i;
+
+  for (i = hash[h]; i >= 0; i = nodes[i].next) {
+    if (nodes[i].parent == parent && nodes[i].addr == addr &&
+	nodes[i].kind == kind) {
+      return i;
+    }
+  }
+  if (num_nodes == max_nodes) {
+    max_nodes *= 2;
+    nodes = (ProfNode *) realloc(nodes, max_nodes * sizeof(ProfNode));
+    if (nodes == NULL) fatal("out of memory in call-graph profiler");
+  }
+  i = num_nodes++;
+  memset(&nodes[i], 0, sizeof(ProfNode));
+  nodes[i].parent = parent;
+  nodes[i].addr = addr;
+  nodes[i].kind = kind;
+  nodes[i].next = hash[h];
+  hash[h] = i;
+  return i;
+}
+
+/* Charge the T-states since the last stack change to the current node */
+static void
+prof_charge(void)
+{
+  nodes[cur_node].self += z80_state.t_count - last_t;
+  last_t = z80_state.t_count;
+}
+
+/* Discard frames whose return address slot is below sp; that is,
+   frames that were popped or abandoned without a matching RET. */
+static void
+prof_prune(Ushort sp)
+{
+  while (depth > 0 && frames[depth - 1].sp < sp) depth--;
+  cur_node = depth ? frames[depth - 1].node : 0;
+}
+
+static void
+prof_exit(void)
+{
+  FILE *f;
+
+  f = fopen(trs_prof_calls_file, "w");
+  if (f == NULL) {
+    error("could not write call profile %s", trs_prof_calls_file);
+    return;
+  }
+  trs_prof_calls_dump(f);
+  fclose(f);
+}
+
+static void prof_sample_init(void);
+
+void
+trs_prof_init(void)
+{
+  int i;
+
+  prof_sample_init();
+  if (trs_prof_calls_file == NULL) return;
+
+  max_nodes = 1024;
+  nodes = (ProfNode *) malloc(max_nodes * sizeof(ProfNode));
+  if (nodes == NULL) fatal("out of memory in call-graph profiler");
+  for (i = 0; i < PROF_HASH_SIZE; i++) hash[i] = -1;
+
+  /* Node 0 is the root: code not inside any call we have seen */
+  num_nodes = 1;
+  memset(&nodes[0], 0, sizeof(ProfNode));
+  nodes[0].parent = -1;
+  depth = 0;
+  cur_node = 0;
+  last_t = z80_state.t_count;
+
+  trs_prof_calls = 1;
+  atexit(prof_exit);
+}
+
+void
+trs_prof_call(int kind)
+{
+  Ushort sp = REG_SP;
+
+  prof_charge();
+  /* Any frame at or below the new return address slot is dead */
+  prof_prune(sp + 1);
+  if (depth == PROF_MAX_DEPTH) {
+    /* Runaway recursion or a stack we cannot follow; forget the
+       oldest half rather than stop tracking the newest calls. */
+    memmove(frames, frames + PROF_MAX_DEPTH / 2,
+	    (PROF_MAX_DEPTH / 2) * sizeof(ProfFrame));
+    depth = PROF_MAX_DEPTH / 2;
+  }
+  cur_node = prof_child(cur_node, REG_PC, kind);
+  nodes[cur_node].calls++;
+  frames[depth].node = cur_node;
+  frames[depth].sp = sp;
+  depth++;
+}
+
+void
+trs_prof_ret(void)
+{
+  Ushort sp = REG_SP - 2;  /* where the return address was */
+
+  prof_charge();
+  prof_prune(sp);
+  /* A RET that does not match the top frame is a computed jump
+     (e.g., PUSH HL; RET), not a subroutine return; ignore it. */
+  if (depth > 0 && frames[depth - 1].sp == sp) {
+    depth--;
+    cur_node = depth ? frames[depth - 1].node : 0;
+  }
+}
+
+static void
+prof_name(char *buf, Ushort addr, int kind)
+{
+  switch (kind) {
+  case PROF_KIND_INT:
+    sprintf(buf, "int@%04x", addr);
+    break;
+  case PROF_KIND_NMI:
+    sprintf(buf, "nmi@%04x", addr);
+    break;
+  default:
+    sprintf(buf, "%04x", addr);
+    break;
+  }
+}
+
+/* Write the tree in folded-stack format */
+void
+trs_prof_calls_dump(FILE *f)
+{
+  int i, n, len;
+  int path[PROF_MAX_PATH];
+  char name[16];
+
+  if (!trs_prof_calls) return;
+  prof_charge();
+
+  for (i = 0; i < num_nodes; i++) {
+    if (nodes[i].self == 0) continue;
+    if (i == 0) {
+      fprintf(f, "[top] %" TSTATE_T_LEN "\n", nodes[0].self);
+      continue;
+    }
+    len = 0;
+    for (n = i; n > 0 && len < PROF_MAX_PATH; n = nodes[n].parent) {
+      path[len++] = n;
+    }
+    if (n > 0) fputs("[truncated];", f);
+    while (len > 0) {
+      n = path[--len];
+      prof_name(name, nodes[n].addr, nodes[n].kind);
+      fputs(name, f);
+      if (len > 0) putc(';', f);
+    }
+    fprintf(f, " %" TSTATE_T_LEN "\n", nodes[i].self);
+  }
+}
+
+typedef struct {
+  Ushort addr;
+  Uchar kind;
+  unsigned long calls;
+  tstate_t self, total;
+} ProfFlat;
+
+static int
+prof_flat_cmp(const void *a, const void *b)
+{
+  const ProfFlat *x = (const ProfFlat *) a, *y = (const ProfFlat *) b;
+  if (x->total != y->total) return x->total < y->total ? 1 : -1;
+  return (int) x->addr - (int) y->addr;
+}
+
+/* Print a flat profile: calls, inclusive and exclusive T-states per
+   entry point, sorted by inclusive time. */
+void
+trs_prof_calls_report(FILE *f, int max_lines)
+{
+  ProfFlat *flat;
+  int *index;
+  int num_flat = 0;
+  int i, j, n;
+  tstate_t all;
+
+  if (!trs_prof_calls) {
+    fprintf(f, "Call-graph profiling is not enabled (see -callprofile).\n");
+    return;
+  }
+  prof_charge();
+
+  /* Children always have higher indices than their parents, so one
+     backward pass accumulates inclusive totals. */
+  for (i = 0; i < num_nodes; i++) nodes[i].total = nodes[i].self;
+  for (i = num_nodes - 1; i > 0; i--) {
+    nodes[nodes[i].parent].total += nodes[i].total;
+  }
+  all = nodes[0].total;
+
+  flat = (ProfFlat *) calloc(num_nodes, sizeof(ProfFlat));
+  index = (int *) malloc(3 * Z80_ADDRESS_LIMIT * sizeof(int));
+  if (flat == NULL || index == NULL) {
+    free(flat);
+    free(index);
+    return;
+  }
+  for (i = 0; i < 3 * Z80_ADDRESS_LIMIT; i++) index[i] = -1;
+  for (i = 1; i < num_nodes; i++) {
+    int recursive = 0;
+    /* Count inclusive time only at the outermost activation */
+    for (n = nodes[i].parent; n > 0; n = nodes[n].parent) {
+      if (nodes[n].addr == nodes[i].addr && nodes[n].kind == nodes[i].kind) {
+	recursive = 1;
+	break;
+      }
+    }
+    j = index[nodes[i].kind * Z80_ADDRESS_LIMIT + nodes[i].addr];
+    if (j < 0) {
+      j = num_flat++;
+      index[nodes[i].kind * Z80_ADDRESS_LIMIT + nodes[i].addr] = j;
+      flat[j].addr = nodes[i].addr;
+      flat[j].kind = nodes[i].kind;
+    }
+    flat[j].calls += nodes[i].calls;
+    flat[j].self += nodes[i].self;
+    if (!recursive) flat[j].total += nodes[i].total;
+  }
+  qsort(flat, num_flat, sizeof(ProfFlat), prof_flat_cmp);
+
+  fprintf(f, "%-10s %10s %14s %6s %14s %6s\n",
+	  "entry", "calls", "inclusive", "%", "exclusive", "%");
+  for (j = 0; j < num_flat && (max_lines <= 0 || j < max_lines); j++) {
+    char name[16];
+    prof_name(name, flat[j].addr, flat[j].kind);
+    fprintf(f, "%-10s %10lu %14" TSTATE_T_LEN " %5.1f%% %14" TSTATE_T_LEN
+	    " %5.1f%%\n", name, flat[j].calls,
+	    flat[j].total, all ? 100.0 * flat[j].total / all : 0.0,
+	    flat[j].self, all ? 100.0 * flat[j].self / all : 0.0);
+  }
+  free(flat);
+  free(index);
+}
+
+
+/*
+ * Sampling profiler
+ */
+
+char *trs_prof_sample_file = NULL;
+int trs_prof_sample_interval = PROF_DEFAULT_SAMPLE_INTERVAL;
+
+typedef struct {
+  int next;            /* next entry in the same hash chain */
+  Ushort pc, sptop;
+  Ushort region;       /* tag set by the guest with emt_misc */
+  Ushort context;      /* mem_context() */
+  unsigned long count;
+} ProfSample;
+
+static ProfSample *samples;
+static int num_samples, max_samples;
+static int sample_hash[PROF_HASH_SIZE];
+static unsigned long total_samples;
+static int cur_region;
+
+static void
+prof_sample_exit(void)
+{
+  FILE *f;
+
+  f = fopen(trs_prof_sample_file, "w");
+  if (f == NULL) {
+    error("could not write sample profile %s", trs_prof_sample_file);
+    return;
+  }
+  trs_prof_samples_dump(f);
+  fclose(f);
+}
+
+static void
+prof_sample_init(void)
+{
+  int i;
+
+  if (trs_prof_sample_file == NULL) return;
+  if (trs_prof_sample_interval <= 0) {
+    fatal("bad sample interval %d", trs_prof_sample_interval);
+  }
+
+  max_samples = 1024;
+  samples = (ProfSample *) malloc(max_samples * sizeof(ProfSample));
+  if (samples == NULL) fatal("out of memory in sampling profiler");
+  for (i = 0; i < PROF_HASH_SIZE; i++) sample_hash[i] = -1;
+
+  z80_state.sample_sched = z80_state.t_count + trs_prof_sample_interval;
+  if (z80_state.sample_sched == 0) z80_state.sample_sched--;
+  atexit(prof_sample_exit);
+}
+
+void
+trs_prof_sample(void)
+{
+  Ushort pc = REG_PC;
+  Ushort sptop = 0;
+  Ushort context = mem_context();
+  Uchar *p;
+  int h, i;
+
+  /* Avoid mem_read here; it could disturb a memory-mapped device */
+  p = mem_pointer(REG_SP, 0);
+  if (p != NULL && REG_SP != 0xffff) sptop = p[0] | (p[1] << 8);
+
+  h = ((unsigned) pc * 31 + sptop * 7 + context + cur_region * 131)
+    % PROF_HASH_SIZE;
+  for (i = sample_hash[h]; i >= 0; i = samples[i].next) {
+    if (samples[i].pc == pc && samples[i].sptop == sptop &&
+	samples[i].context == context && samples[i].region == cur_region) {
+      break;
+    }
+  }
+  if (i < 0) {
+    if (num_samples == max_samples) {
+      max_samples *= 2;
+      samples = (ProfSample *)
+	realloc(samples, max_samples * sizeof(ProfSample));
+      if (samples == NULL) fatal("out of memory in sampling profiler");
+    }
+    i = num_samples++;
+    samples[i].pc = pc;
+    samples[i].sptop = sptop;
+    samples[i].context = context;
+    samples[i].region = cur_region;
+    samples[i].count = 0;
+    samples[i].next = sample_hash[h];
+    sample_hash[h] = i;
+  }
+  samples[i].count++;
+  total_samples++;
+
+  z80_state.sample_sched = z80_state.t_count + trs_prof_sample_interval;
+  if (z80_state.sample_sched == 0) z80_state.sample_sched--;
+}
+
+/* Called via emt_misc to mark a region of interest; 0 = none */
+void
+trs_prof_set_region(int tag)
+{
+  cur_region = tag;
+}
+
+static int
+prof_sample_cmp(const void *a, const void *b)
+{
+  const ProfSample *x = (const ProfSample *) a, *y = (const ProfSample *) b;
+  if (x->count != y->count) return x->count < y->count ? 1 : -1;
+  if (x->region != y->region) return (int) x->region - (int) y->region;
+  return (int) x->pc - (int) y->pc;
+}
+
+/* Write the histogram, most frequent first.  The hash chains are
+   not needed afterward, so the table is sorted in place. */
+void
+trs_prof_samples_dump(FILE *f)
+{
+  int i;
+
+  if (samples == NULL) return;
+  qsort(samples, num_samples, sizeof(ProfSample), prof_sample_cmp);
+  for (i = 0; i < PROF_HASH_SIZE; i++) sample_hash[i] = -1;
+  for (i = 0; i < num_samples; i++) samples[i].next = -1;
+
+  fprintf(f, "# xtrs sample profile: interval %d T-states, %lu samples\n",
+	  trs_prof_sample_interval, total_samples);
+  fprintf(f, "# count region context pc sptop\n");
+  for (i = 0; i < num_samples; i++) {
+    fprintf(f, "%lu %04x %03x %04x %04x\n", samples[i].count,
+	    samples[i].region, samples[i].context,
+	    samples[i].pc, samples[i].sptop);
+  }
+}
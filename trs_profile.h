@@ -0,0 +1,56 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_profile.h
+ *
+ * Profiling of emulated Z80 code.
+ */
+
+#ifndef _TRS_PROFILE_H
+#define _TRS_PROFILE_H
+
+#include "z80.h"
+
+/*
+ * Call-graph profiler.  A shadow stack follows CALL/RST/interrupt
+ * entry and RET, and T-states are charged to the calling context
+ * that was current when they were spent.  Frames are matched by the
+ * stack address of their return address, not by its value, so code
+ * that pops, replaces, or abandons return addresses (as the ROMs
+ * and DOSes often do) resynchronizes at the next call or return.
+ */
+#define PROF_KIND_CALL 0
+#define PROF_KIND_INT  1
+#define PROF_KIND_NMI  2
+
+extern int trs_prof_calls;  /* nonzero if call-graph profiling is on */
+extern char *trs_prof_calls_file;
+
+void trs_prof_init(void);
+void trs_prof_call(int kind);  /* after the return address is pushed */
+void trs_prof_ret(void);       /* after the return address is popped */
+void trs_prof_calls_dump(FILE *f);
+void trs_prof_calls_report(FILE *f, int max_lines);
+
+/*
+ * Statistical sampling profiler.  Every trs_prof_sample_interval
+ * T-states, z80_run calls trs_prof_sample, which counts the current
+ * PC, the word on top of the stack (usually the caller's return
+ * address), the memory context, and the guest-selected region tag.
+ */
+#define PROF_DEFAULT_SAMPLE_INTERVAL 1009 /* prime, to avoid aliasing */
+
+extern char *trs_prof_sample_file;
+extern int trs_prof_sample_interval;
+
+void trs_prof_sample(void);
+void trs_prof_set_region(int tag);
+void trs_prof_samples_dump(FILE *f);
+
+#endif /*_TRS_PROFILE_H*/
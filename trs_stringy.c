@@ -23,6 +23,7 @@
 #include "z80.h"
 #include "trs.h"
 #include "trs_disk.h"
+#include "trs_watch.h"
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
@@ -63,6 +64,7 @@ typedef long stringy_pos_t;
 typedef struct {
   char *name;
   FILE *file;
+  int watch;              /* trs_watch handle for name */
   stringy_pos_t length;
   stringy_pos_t eotWidth;
   stringy_pos_t pos;
@@ -267,6 +269,7 @@ stringy_change(int unit)
     fclose(s->file);
     s->file = NULL;
   }
+  s->watch = trs_watch_start(s->watch, s->name);
   if (s->name == NULL) {
     s->in_port = STRINGY_NO_WAFER;
     return 0;
@@ -298,12 +301,13 @@ stringy_change(int unit)
   return ires;
 }
 
+/* Reopen the drives whose images have changed, or all if force */
 void
-stringy_change_all(void)
+stringy_change_all(int force)
 {
   int i;
   for (i = 0; i < STRINGY_MAX_UNITS; i++) {
-    stringy_change(i);
+    if (force || trs_watch_changed(stringy_info[i].watch)) stringy_change(i);
   }
 }
 
@@ -0,0 +1,445 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_trace.c
+ *
+ * Binary execution trace.  When enabled, z80_run stores a fixed-size
+ * record for every instruction in a ring buffer, overwriting the
+ * oldest, so the buffer always holds what led up to the present.
+ * Recording is a few dozen stores per instruction, far cheaper than
+ * disassembling with the debugger's traceon.  The ring is written out
+ * when the debugger stops, on its tracedump command, and if xtrs
+ * itself crashes; tracedump(1) renders the file.
+ *
+ * The dump code uses only open, write, and close, so that it is safe
+ * to call from the crash signal handler.
+ *
+ * For captures too long for any ring, the trace can instead be
+ * streamed to a file, optionally along with every memory write and
+ * port access.  Events are packed into large blocks; a background
+ * thread compresses each full block (with zlib, if available) and
+ * writes it, so the emulator pays only for filling the buffers.
+ * Streaming stops when the file reaches its size limit.
+ */
+
+#define _XOPEN_SOURCE 500 /* signal.h: SA_RESETHAND */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "z80.h"
+#include "trs.h"
+#include "trs_trace.h"
+
+int trs_trace_size = 0;
+char *trs_trace_file = TRACE_DEFAULT_FILE;
+trs_trace_rec *trs_trace_ring = NULL;
+
+char *trs_trace_stream_file = NULL;
+int trs_trace_stream_limit = TRACE_DEFAULT_LIMIT;
+int trs_trace_stream_io = 0;
+int trs_trace_on = 0;
+int trs_trace_io = 0;
+
+static int trace_next;     /* slot for the next record */
+static int trace_wrapped;  /* nonzero once every slot has been used */
+static tstate_t trace_last_t;
+
+/* Encoding buffer for trs_trace_dump */
+#define TRACE_DUMP_CHUNK 256
+static Uchar dump_buf[TRACE_DUMP_CHUNK * TRACE_RECORD_SIZE];
+
+static void
+put_word(Uchar *p, unsigned int w)
+{
+  p[0] = w & 0xff;
+  p[1] = (w >> 8) & 0xff;
+}
+
+static void
+put_long(Uchar *p, unsigned int l)
+{
+  put_word(p, l & 0xffff);
+  put_word(p + 2, l >> 16);
+}
+
+static void
+encode_rec(Uchar *p, trs_trace_rec *r)
+{
+  put_word(p, r->pc);
+  memcpy(p + 2, r->op, 4);
+  put_word(p + 6, r->af);
+  put_word(p + 8, r->bc);
+  put_word(p + 10, r->de);
+  put_word(p + 12, r->hl);
+  put_word(p + 14, r->ix);
+  put_word(p + 16, r->iy);
+  put_word(p + 18, r->sp);
+  put_word(p + 20, r->tdelta);
+  put_word(p + 22, r->context);
+}
+
+static int
+write_all(int fd, Uchar *buf, int len)
+{
+  int n;
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n <= 0) return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int
+trs_trace_dump(const char *filename)
+{
+  int fd, count, first, i, n, slot;
+  Uchar *p;
+  trs_trace_rec *r;
+
+  if (trs_trace_ring == NULL) return 0;
+  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return -1;
+
+  count = trace_wrapped ? trs_trace_size : trace_next;
+  first = trace_wrapped ? trace_next : 0;
+  memcpy(dump_buf, TRACE_MAGIC, 8);
+  put_long(dump_buf + 8, count);
+  put_long(dump_buf + 12, TRACE_RECORD_SIZE);
+  if (write_all(fd, dump_buf, TRACE_HEADER_SIZE) < 0) goto fail;
+
+  for (i = 0; i < count; i += n) {
+    n = count - i;
+    if (n > TRACE_DUMP_CHUNK) n = TRACE_DUMP_CHUNK;
+    for (p = dump_buf, slot = 0; slot < n; slot++, p += TRACE_RECORD_SIZE) {
+      r = &trs_trace_ring[(first + i + slot) % trs_trace_size];
+      encode_rec(p, r);
+    }
+    if (write_all(fd, dump_buf, n * TRACE_RECORD_SIZE) < 0) goto fail;
+  }
+  close(fd);
+  return count;
+
+ fail:
+  close(fd);
+  return -1;
+}
+
+/*
+ * Streaming.  The emulator fills stream_bufs[stream_prod]; when it is
+ * full, it is handed to the writer thread and the emulator moves on
+ * to the next buffer, waiting only if all of them are still queued.
+ */
+#define STREAM_BUF_SIZE 65536
+#define STREAM_NBUFS 8
+
+typedef struct {
+  int len;
+  int events;
+  int has_insn;
+  tstate_t first_t;
+  Uchar data[STREAM_BUF_SIZE];
+} StreamBuf;
+
+static StreamBuf *stream_bufs;
+static int stream_on;       /* nonzero while events are being streamed */
+static int stream_prod;     /* buffer being filled by the emulator */
+static int stream_cons;     /* next buffer for the writer thread */
+static int stream_filled;   /* buffers queued for the writer */
+static int stream_done;     /* no more buffers will be queued */
+static int stream_full;     /* size limit reached or write failed */
+static int stream_fd = -1;
+static pthread_t stream_thread;
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t stream_space = PTHREAD_COND_INITIALIZER;
+
+static void *
+stream_writer(void *arg)
+{
+  Uchar header[STREAM_BLOCK_HEADER_SIZE];
+  long long written = TRACE_HEADER_SIZE;
+  long long limit = (long long) trs_trace_stream_limit << 20;
+  StreamBuf *b;
+  Uchar *data;
+  int len, method, full = 0;
+#ifdef HAVE_ZLIB
+  uLongf zlen;
+  Uchar *zbuf = (Uchar *) malloc(compressBound(STREAM_BUF_SIZE));
+#endif
+
+  for (;;) {
+    pthread_mutex_lock(&stream_lock);
+    while (stream_filled == 0 && !stream_done) {
+      pthread_cond_wait(&stream_ready, &stream_lock);
+    }
+    if (stream_filled == 0) {
+      pthread_mutex_unlock(&stream_lock);
+      break;
+    }
+    b = &stream_bufs[stream_cons];
+    pthread_mutex_unlock(&stream_lock);
+
+    if (!full) {
+      data = b->data;
+      len = b->len;
+      method = STREAM_STORED;
+#ifdef HAVE_ZLIB
+      zlen = compressBound(STREAM_BUF_SIZE);
+      if (zbuf && compress2(zbuf, &zlen, b->data, b->len, 1) == Z_OK &&
+	  zlen < b->len) {
+	data = zbuf;
+	len = zlen;
+	method = STREAM_DEFLATE;
+      }
+#endif
+      memset(header, 0, sizeof(header));
+      put_long(header, method);
+      put_long(header + 4, len);
+      put_long(header + 8, b->len);
+      put_long(header + 12, b->events);
+      put_long(header + 16, b->first_t & 0xffffffff);
+      put_long(header + 20, (unsigned long long) b->first_t >> 32);
+      if (written + STREAM_BLOCK_HEADER_SIZE + len > limit ||
+	  write_all(stream_fd, header, STREAM_BLOCK_HEADER_SIZE) < 0 ||
+	  write_all(stream_fd, data, len) < 0) {
+	full = 1;
+      } else {
+	written += STREAM_BLOCK_HEADER_SIZE + len;
+      }
+    }
+
+    pthread_mutex_lock(&stream_lock);
+    stream_full = full;
+    stream_filled--;
+    stream_cons = (stream_cons + 1) % STREAM_NBUFS;
+    pthread_cond_signal(&stream_space);
+    pthread_mutex_unlock(&stream_lock);
+  }
+
+#ifdef HAVE_ZLIB
+  free(zbuf);
+#endif
+  return NULL;
+}
+
+static void
+stream_stop(void)
+{
+  stream_on = 0;
+  trs_trace_io = 0;
+  trs_trace_on = (trs_trace_ring != NULL);
+}
+
+/* Queue the current buffer for the writer and start the next one */
+static void
+stream_flush(void)
+{
+  StreamBuf *b = &stream_bufs[stream_prod];
+  int full;
+
+  if (b->events == 0) return;
+  pthread_mutex_lock(&stream_lock);
+  stream_filled++;
+  pthread_cond_signal(&stream_ready);
+  while (stream_filled == STREAM_NBUFS) {
+    pthread_cond_wait(&stream_space, &stream_lock);
+  }
+  full = stream_full;
+  pthread_mutex_unlock(&stream_lock);
+
+  stream_prod = (stream_prod + 1) % STREAM_NBUFS;
+  b = &stream_bufs[stream_prod];
+  b->len = b->events = b->has_insn = 0;
+  if (full) {
+    stream_stop();
+    error("trace stream %s is full or cannot be written; stopped",
+	  trs_trace_stream_file);
+  }
+}
+
+static void
+stream_put(int type, Uchar *payload, int len, int insn)
+{
+  StreamBuf *b = &stream_bufs[stream_prod];
+
+  if (b->len + 1 + len > STREAM_BUF_SIZE) {
+    stream_flush();
+    if (!stream_on) return;
+    b = &stream_bufs[stream_prod];
+  }
+  if (b->events == 0 || (insn && !b->has_insn)) {
+    b->first_t = z80_state.t_count;
+    b->has_insn = insn;
+  }
+  b->data[b->len++] = type;
+  memcpy(&b->data[b->len], payload, len);
+  b->len += len;
+  b->events++;
+}
+
+void
+trs_trace_mem_write(int address, int value)
+{
+  Uchar p[3];
+
+  if (!stream_on) return;
+  put_word(p, address);
+  p[2] = value;
+  stream_put(STREAM_MEMW, p, 3, 0);
+}
+
+void
+trs_trace_port(int type, int port, int value)
+{
+  Uchar p[2];
+
+  if (!stream_on) return;
+  p[0] = port;
+  p[1] = value;
+  stream_put(type, p, 2, 0);
+}
+
+static void
+stream_exit(void)
+{
+  if (stream_on) stream_flush();
+  stream_stop();
+  pthread_mutex_lock(&stream_lock);
+  stream_done = 1;
+  pthread_cond_signal(&stream_ready);
+  pthread_mutex_unlock(&stream_lock);
+  pthread_join(stream_thread, NULL);
+  close(stream_fd);
+}
+
+static void
+stream_init(void)
+{
+  Uchar header[TRACE_HEADER_SIZE];
+  sigset_t all, old;
+
+  stream_fd = open(trs_trace_stream_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (stream_fd < 0) {
+    error("can't open trace stream %s: %s", trs_trace_stream_file,
+	  strerror(errno));
+    return;
+  }
+  memset(header, 0, sizeof(header));
+  memcpy(header, TRACE_STREAM_MAGIC, 8);
+  if (write_all(stream_fd, header, TRACE_HEADER_SIZE) < 0) {
+    error("can't write trace stream %s: %s", trs_trace_stream_file,
+	  strerror(errno));
+    close(stream_fd);
+    return;
+  }
+  stream_bufs = (StreamBuf *) calloc(STREAM_NBUFS, sizeof(StreamBuf));
+  if (stream_bufs == NULL) fatal("out of memory for trace stream");
+
+  /* The writer thread must not take the emulator's signals */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  if (pthread_create(&stream_thread, NULL, stream_writer, NULL) != 0) {
+    fatal("can't start trace stream writer thread");
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  stream_on = 1;
+  trs_trace_io = trs_trace_stream_io;
+  atexit(stream_exit);
+}
+
+static void
+trace_crash(int sig)
+{
+  static const char msg[] = "xtrs: crashed; execution trace written\n";
+
+  if (trs_trace_dump(trs_trace_file) >= 0 &&
+      write(2, msg, sizeof(msg) - 1) < 0) {
+    /* nothing more we can do */
+  }
+  /* SA_RESETHAND restored the default action; let it happen */
+  raise(sig);
+}
+
+void
+trs_trace_init(void)
+{
+  struct sigaction sa;
+
+  trace_last_t = z80_state.t_count;
+  if (trs_trace_stream_file) stream_init();
+  trs_trace_on = stream_on;
+  if (trs_trace_size <= 0) return;
+  trs_trace_ring =
+    (trs_trace_rec *) calloc(trs_trace_size, sizeof(trs_trace_rec));
+  if (trs_trace_ring == NULL) fatal("out of memory for execution trace");
+  trace_next = 0;
+  trace_wrapped = 0;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = trace_crash;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESETHAND;
+  sigaction(SIGSEGV, &sa, NULL);
+  sigaction(SIGBUS, &sa, NULL);
+  sigaction(SIGILL, &sa, NULL);
+  sigaction(SIGFPE, &sa, NULL);
+  sigaction(SIGABRT, &sa, NULL);
+  trs_trace_on = 1;
+}
+
+void
+trs_trace_record(void)
+{
+  trs_trace_rec rec, *r;
+  Uchar buf[TRACE_RECORD_SIZE];
+  Ushort pc = REG_PC;
+  tstate_t delta = z80_state.t_count - trace_last_t;
+  Uchar *p;
+  int i;
+
+  r = trs_trace_ring ? &trs_trace_ring[trace_next] : &rec;
+  r->pc = pc;
+  /* mem_pointer, not mem_read: no device side effects or watchpoints */
+  for (i = 0; i < 4; i++) {
+    p = mem_pointer(pc + i, 0);
+    r->op[i] = p ? *p : 0xff;
+  }
+  r->af = REG_AF;
+  r->bc = REG_BC;
+  r->de = REG_DE;
+  r->hl = REG_HL;
+  r->ix = REG_IX;
+  r->iy = REG_IY;
+  r->sp = REG_SP;
+  r->tdelta = (delta > 0xffff) ? 0xffff : delta;
+  r->context = mem_context();
+  trace_last_t = z80_state.t_count;
+
+  if (trs_trace_ring && ++trace_next == trs_trace_size) {
+    trace_next = 0;
+    trace_wrapped = 1;
+  }
+  if (stream_on) {
+    encode_rec(buf, r);
+    stream_put(STREAM_INSN, buf, TRACE_RECORD_SIZE, 1);
+  }
+}
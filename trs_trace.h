@@ -0,0 +1,99 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_trace.h
+ *
+ * Binary execution trace: a ring buffer holding the last N
+ * instructions executed, which can be written to a file, and a
+ * compressed stream of every instruction for long captures.  Both
+ * kinds of file are read back with tracedump(1).
+ */
+
+#ifndef _TRS_TRACE_H
+#define _TRS_TRACE_H
+
+#include "z80.h"
+
+/*
+ * Trace file format.  A header of TRACE_HEADER_SIZE bytes:
+ *   8 bytes  TRACE_MAGIC
+ *   4 bytes  number of records (little-endian)
+ *   4 bytes  record size, TRACE_RECORD_SIZE (little-endian)
+ * followed by the records, oldest first.  Each record describes the
+ * state just before one instruction executed; all words are
+ * little-endian:
+ *   0  pc         2 bytes
+ *   2  opcode     4 bytes at pc (instructions are at most 4 bytes)
+ *   6  af bc de hl ix iy sp   2 bytes each
+ *  20  tdelta     T-states since the previous record, up to 0xffff
+ *  22  context    memory mapping, from mem_context()
+ */
+#define TRACE_MAGIC "XTRSTRC1"
+#define TRACE_HEADER_SIZE 16
+#define TRACE_RECORD_SIZE 24
+
+typedef struct {
+  Ushort pc;
+  Uchar op[4];
+  Ushort af, bc, de, hl, ix, iy, sp;
+  Ushort tdelta;
+  Ushort context;
+} trs_trace_rec;
+
+/*
+ * Streamed trace file format, for long captures.  A header of
+ * TRACE_HEADER_SIZE bytes: 8 bytes TRACE_STREAM_MAGIC, then 8 bytes
+ * of zero.  Then a sequence of blocks, each with this header of
+ * STREAM_BLOCK_HEADER_SIZE bytes (little-endian):
+ *   0  method          STREAM_STORED or STREAM_DEFLATE (zlib)
+ *   4  stored length   bytes of data following this header
+ *   8  data length     bytes of events after decompression
+ *  12  events          number of events in the block
+ *  16  first_t         T-state counter when the block's first
+ *                      instruction executed (8 bytes)
+ *  24  8 bytes of zero
+ * The data is a sequence of events, each a type byte and a payload:
+ *   STREAM_INSN   a TRACE_RECORD_SIZE record, as above
+ *   STREAM_MEMW   address (2 bytes), value (1 byte)
+ *   STREAM_OUT    port (1 byte), value (1 byte)
+ *   STREAM_IN     port (1 byte), value (1 byte)
+ * Memory writes and port I/O belong to the preceding instruction.
+ * The first instruction in a block executed at first_t, so decoding
+ * can start at any block; tracedump(1) uses this to seek.
+ */
+#define TRACE_STREAM_MAGIC "XTRSTRS1"
+#define STREAM_BLOCK_HEADER_SIZE 32
+#define STREAM_STORED  0
+#define STREAM_DEFLATE 1
+#define STREAM_INSN 1
+#define STREAM_MEMW 2
+#define STREAM_OUT  3
+#define STREAM_IN   4
+
+#define TRACE_DEFAULT_FILE "xtrs.trace"
+#define TRACE_DEFAULT_LIMIT 1024  /* megabytes */
+
+extern int trs_trace_size;       /* records in the ring; 0 = off */
+extern char *trs_trace_file;
+extern trs_trace_rec *trs_trace_ring;  /* NULL if the ring is off */
+
+extern char *trs_trace_stream_file;  /* NULL if streaming is off */
+extern int trs_trace_stream_limit;   /* megabytes */
+extern int trs_trace_stream_io;      /* option: stream memory writes, I/O */
+
+extern int trs_trace_on;  /* nonzero if z80_run must call trs_trace_record */
+extern int trs_trace_io;  /* nonzero if writes and I/O are being streamed */
+
+void trs_trace_init(void);
+void trs_trace_record(void);     /* before each instruction */
+int trs_trace_dump(const char *filename);  /* returns records written */
+void trs_trace_mem_write(int address, int value);
+void trs_trace_port(int type, int port, int value);
+
+#endif /*_TRS_TRACE_H*/
@@ -0,0 +1,211 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_watch.c
+ *
+ * Change detection for mounted disk images; see trs_watch.h.
+ *
+ * A drive's image counts as changed if it is written and closed,
+ * renamed, deleted, or has its permissions changed (mkdisk -p), or if
+ * its name in the directory is created, deleted, or renamed over, as
+ * when a symbolic link in the disk directory is pointed at another
+ * image.  Watching the file itself catches changes to the target of
+ * such a link.  Nothing is noticed while an image is merely modified
+ * in place by a program that keeps it open; xtrs never expected that
+ * to work anyway.
+ */
+
+#define _XOPEN_SOURCE 500 /* string.h: strdup() */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if __linux
+#include <sys/inotify.h>
+#endif
+
+#include "trs_watch.h"
+
+#if __linux
+
+#define WATCH_MAX 32  /* floppies + hard drives + stringy drives */
+
+#define FILE_EVENTS \
+  (IN_CLOSE_WRITE|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF)
+#define DIR_EVENTS \
+  (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ATTRIB|IN_CLOSE_WRITE| \
+   IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+typedef struct {
+  int used;
+  int dirty;    /* changed since trs_watch_start */
+  int filewd;   /* watch on the image, or -1 if it did not exist */
+  int dirwd;    /* watch on its directory, or -1 if lost */
+  char *base;   /* last component of the image's name */
+} Watch;
+
+static Watch watch[WATCH_MAX];
+static int watch_fd = -2;  /* -2 until first use, -1 if no inotify */
+
+/* Remove inotify watch wd unless a drive is still using it */
+static void
+release(int wd)
+{
+  int i;
+
+  if (wd < 0) return;
+  for (i = 0; i < WATCH_MAX; i++) {
+    if (watch[i].used && (watch[i].filewd == wd || watch[i].dirwd == wd)) {
+      return;
+    }
+  }
+  inotify_rm_watch(watch_fd, wd);
+}
+
+/* Read all pending events and mark the drives they concern */
+static void
+drain(void)
+{
+  union {
+    struct inotify_event ev;
+    char buf[4096];
+  } u;
+  struct inotify_event *ev;
+  ssize_t n;
+  char *p;
+  int i;
+
+  while ((n = read(watch_fd, u.buf, sizeof(u.buf))) > 0) {
+    for (p = u.buf; p < u.buf + n; p += sizeof(*ev) + ev->len) {
+      ev = (struct inotify_event *) p;
+      for (i = 0; i < WATCH_MAX; i++) {
+	Watch *w = &watch[i];
+	if (!w->used) continue;
+	if ((ev->mask & IN_Q_OVERFLOW) || ev->wd == w->filewd ||
+	    (ev->wd == w->dirwd &&
+	     (ev->len == 0 || strcmp(ev->name, w->base) == 0))) {
+	  w->dirty = 1;
+	}
+	if (ev->mask & IN_IGNORED) {
+	  /* Watch went away with the file or directory */
+	  if (ev->wd == w->filewd) w->filewd = -1;
+	  if (ev->wd == w->dirwd) w->dirwd = -1;
+	}
+      }
+    }
+  }
+}
+
+/*
+ * Start watching the image file name, which the caller is about to
+ * (re)open, in place of watch w.  Returns the new watch handle, or 0
+ * if name cannot be watched; it then always counts as changed.  Call
+ * after closing the old image, so that the close is not taken for a
+ * change.
+ */
+int
+trs_watch_start(int w, const char *name)
+{
+  struct stat st;
+  const char *slash, *base;
+  char *dir;
+  Watch *n;
+  int i;
+
+  if (watch_fd == -2) {
+    watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  }
+  /* Devices such as a real floppy drive change media without any
+     event, so they must be checked every time */
+  if (name == NULL || watch_fd < 0 ||
+      (stat(name, &st) == 0 && !S_ISREG(st.st_mode))) {
+    trs_watch_stop(w);
+    return 0;
+  }
+  for (i = 0; i < WATCH_MAX && watch[i].used; i++) ;
+  if (i == WATCH_MAX) {
+    trs_watch_stop(w);
+    return 0;
+  }
+  n = &watch[i];
+
+  slash = strrchr(name, '/');
+  if (slash == NULL) {
+    dir = strdup(".");
+    base = name;
+  } else {
+    dir = (char *) malloc(slash - name + 2);
+    memcpy(dir, name, slash - name + (slash == name));
+    dir[slash - name + (slash == name)] = '\0';
+    base = slash + 1;
+  }
+  /* Adding the same watch as the old one gives back the same wd, so
+     the old one is stopped only after this */
+  n->dirwd = inotify_add_watch(watch_fd, dir, DIR_EVENTS);
+  free(dir);
+  if (n->dirwd < 0) {
+    trs_watch_stop(w);
+    return 0;
+  }
+  /* If the image does not exist yet, the directory watch sees it
+     created */
+  n->filewd = inotify_add_watch(watch_fd, name, FILE_EVENTS);
+  n->base = strdup(base);
+  n->used = 1;
+  trs_watch_stop(w);
+  drain();
+  n->dirty = 0;
+  return i + 1;
+}
+
+void
+trs_watch_stop(int w)
+{
+  Watch *o;
+
+  if (w <= 0) return;
+  o = &watch[w - 1];
+  o->used = 0;
+  release(o->filewd);
+  release(o->dirwd);
+  free(o->base);
+  o->base = NULL;
+}
+
+/* Has the image changed since trs_watch_start? */
+int
+trs_watch_changed(int w)
+{
+  if (w <= 0) return 1;
+  drain();
+  return watch[w - 1].dirty;
+}
+
+#else /* !__linux */
+
+int
+trs_watch_start(int w, const char *name)
+{
+  return 0;
+}
+
+void
+trs_watch_stop(int w)
+{
+}
+
+int
+trs_watch_changed(int w)
+{
+  return 1;
+}
+
+#endif
@@ -0,0 +1,29 @@
+/* Copyright (c) 2026, xtrs contributors */
+/* $Id$ */
+
+/* This software may be copied, modified, and used for any purpose
+ * without fee, provided that (1) the above copyright notice is
+ * retained, and (2) modified versions are clearly marked as having
+ * been modified, with the modifier's name and the date included.  */
+
+/*
+ * trs_watch.h
+ *
+ * Change detection for mounted floppy, hard disk, and stringy images.
+ * Each drive watches its image file and the directory entry that
+ * names it (normally in the disk directory), so that a check for disk
+ * changes need only reopen the drives whose image really changed.
+ * Uses inotify on Linux; elsewhere every drive always counts as
+ * changed, as before.
+ */
+
+#ifndef _TRS_WATCH_H
+#define _TRS_WATCH_H
+
+/* A watch handle is 0 for none, so drive structures that are zeroed
+   at startup need no other initialization */
+int trs_watch_start(int w, const char *name);
+void trs_watch_stop(int w);
+int trs_watch_changed(int w);
+
+#endif
@@ -58,6 +58,11 @@
 #include "trs_disk.h"
 #include "trs_uart.h"
 #include "trs_imp_exp.h"
+#include "trs_profile.h"
+#include "trs_trace.h"
+#include "trs_cover.h"
+#include "trs_heat.h"
+#include "trs_metrics.h"
 
 #define DEF_FONT1	"-misc-fixed-medium-r-normal--20-200-75-75-*-100-iso8859-1"
 #define DEF_WIDEFONT1	"-misc-fixed-medium-r-normal--20-200-75-75-*-200-iso8859-1"
@@ -92,8 +97,14 @@ static int unmap_help_window = 0;
 static GC gc;
 static GC gc_inv;
 static GC gc_xor;
+static char const *overlay_font_name = "fixed";
 static int currentmode = NORMAL;
 static int OrigHeight,OrigWidth;
+static int overlay_height = 0;  /* below OrigHeight; 0 if overlay is off */
+static XFontStruct *overlay_font;
+static GC overlay_gc;
+static trs_metrics_rates overlay_rates;
+static int overlay_valid = 0;
 static int usefont = DEF_USEFONT;
 static int cur_char_width = TRS_CHAR_WIDTH;
 static int cur_char_height = TRS_CHAR_HEIGHT * 2;
@@ -141,6 +152,9 @@ static XrmOptionDescRec opts[] = {
 {"-doubler",    "*doubler",     XrmoptionSepArg,        (caddr_t)NULL},
 {"-sizemap",    "*sizemap",     XrmoptionSepArg,        (caddr_t)NULL},
 {"-stepmap",    "*stepmap",     XrmoptionSepArg,        (caddr_t)NULL},
+{"-fastdisk",   "*fastdisk",    XrmoptionNoArg,         (caddr_t)"on"},
+{"-nofastdisk", "*fastdisk",    XrmoptionNoArg,         (caddr_t)"off"},
+{"-fastmap",    "*fastmap",     XrmoptionSepArg,        (caddr_t)NULL},
 {"-charset",    "*charset",     XrmoptionSepArg,        (caddr_t)NULL},
 {"-truedam",    "*truedam",     XrmoptionNoArg,         (caddr_t)"on"},
 {"-notruedam",  "*truedam",     XrmoptionNoArg,         (caddr_t)"off"},
@@ -157,6 +171,31 @@ static XrmOptionDescRec opts[] = {
 {"-noshiftbracket","*shiftbracket",XrmoptionNoArg,      (caddr_t)"off"},
 {"-emtsafe",    "*emtsafe",     XrmoptionNoArg,         (caddr_t)"on"},
 {"-noemtsafe",  "*emtsafe",     XrmoptionNoArg,         (caddr_t)"off"},
+{"-callprofile","*callprofile", XrmoptionSepArg,        (caddr_t)NULL},
+{"-sampleprofile","*sampleprofile",XrmoptionSepArg,     (caddr_t)NULL},
+{"-sampleinterval","*sampleinterval",XrmoptionSepArg,   (caddr_t)NULL},
+{"-tracebuffer","*tracebuffer", XrmoptionSepArg,        (caddr_t)NULL},
+{"-tracefile",  "*tracefile",   XrmoptionSepArg,        (caddr_t)NULL},
+{"-tracestream","*tracestream", XrmoptionSepArg,        (caddr_t)NULL},
+{"-tracelimit", "*tracelimit",  XrmoptionSepArg,        (caddr_t)NULL},
+{"-traceio",    "*traceio",     XrmoptionNoArg,         (caddr_t)"on"},
+{"-notraceio",  "*traceio",     XrmoptionNoArg,         (caddr_t)"off"},
+{"-coverage",   "*coverage",    XrmoptionSepArg,        (caddr_t)NULL},
+{"-coverbranches","*coverbranches",XrmoptionNoArg,      (caddr_t)"on"},
+{"-nocoverbranches","*coverbranches",XrmoptionNoArg,    (caddr_t)"off"},
+{"-heatmap",    "*heatmap",     XrmoptionSepArg,        (caddr_t)NULL},
+{"-metrics",    "*metrics",     XrmoptionSepArg,        (caddr_t)NULL},
+{"-metricsinterval","*metricsinterval",XrmoptionSepArg, (caddr_t)NULL},
+{"-overlay",    "*overlay",     XrmoptionNoArg,         (caddr_t)"on"},
+{"-nooverlay",  "*overlay",     XrmoptionNoArg,         (caddr_t)"off"},
+{"-diskmmap",   "*diskmmap",    XrmoptionNoArg,         (caddr_t)"on"},
+{"-nodiskmmap", "*diskmmap",    XrmoptionNoArg,         (caddr_t)"off"},
+{"-diskmsync",  "*diskmsync",   XrmoptionSepArg,        (caddr_t)NULL},
+{"-diskram",    "*diskram",     XrmoptionNoArg,         (caddr_t)"on"},
+{"-nodiskram",  "*diskram",     XrmoptionNoArg,         (caddr_t)"off"},
+{"-diskraminterval","*diskraminterval",XrmoptionSepArg, (caddr_t)NULL},
+{"-hardsync",   "*hardsync",    XrmoptionSepArg,        (caddr_t)NULL},
+{"-diskoverlay","*diskoverlay", XrmoptionSepArg,        (caddr_t)NULL},
 };
 
 static int num_opts = (sizeof opts / sizeof opts[0]);
@@ -227,6 +266,7 @@ struct stat statbuf;
 /* Private routines */
 void bitmap_init();
 void screen_init();
+static void overlay_set_height();
 
 static XrmDatabase x_db = NULL;
 static XrmDatabase command_db = NULL;
@@ -245,7 +285,7 @@ int trs_parse_command_line(int argc, char **argv, int *debug)
   char *type;
   XrmValue value;
   char *xrms, *tmp;
-  int stepdefault, i, s[8];
+  int stepdefault, fastdefault, i, s[8];
 
   title = program_name; /* default */
 
@@ -515,6 +555,33 @@ int trs_parse_command_line(int argc, char **argv, int *debug)
     }
   }
 
+  /* Defaults for fastmap */
+  (void) sprintf(option, "%s%s", program_name, ".fastdisk");
+  fastdefault = 0;
+  if (XrmGetResource(x_db, option, "Xtrs.Fastdisk", &type, &value)) {
+    if (strcmp(value.addr,"on") == 0) {
+      fastdefault = 1;
+    } else if (strcmp(value.addr,"off") == 0) {
+      fastdefault = 0;
+    }
+  }
+
+  for (i=0; i<=7; i++) {
+    s[i] = fastdefault;
+  }
+  (void) sprintf(option, "%s%s", program_name, ".fastmap");
+  if (XrmGetResource(x_db, option, "Xtrs.Fastmap", &type, &value)) {
+    sscanf((char*)value.addr, "%d,%d,%d,%d,%d,%d,%d,%d",
+	   &s[0], &s[1], &s[2], &s[3], &s[4], &s[5], &s[6], &s[7]);
+  }
+  for (i=0; i<=7; i++) {
+    if (s[i] != 0 && s[i] != 1) {
+      fatal("bad value %d for disk %d fast flag", s[i], i);
+    } else {
+      trs_disk_setfast(i, s[i]);
+    }
+  }
+
   (void) sprintf(option, "%s%s", program_name, ".truedam");
   if (XrmGetResource(x_db, option, "Xtrs.Truedam", &type, &value)) {
     if (strcmp(value.addr,"on") == 0) {
@@ -555,6 +622,142 @@ int trs_parse_command_line(int argc, char **argv, int *debug)
     trs_kb_bracket(trs_model >= 4);
   }
 
+  (void) sprintf(option, "%s%s", program_name, ".callprofile");
+  if (XrmGetResource(x_db, option, "Xtrs.Callprofile", &type, &value)) {
+      trs_prof_calls_file = strdup(value.addr);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".sampleprofile");
+  if (XrmGetResource(x_db, option, "Xtrs.Sampleprofile", &type, &value)) {
+      trs_prof_sample_file = strdup(value.addr);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".sampleinterval");
+  if (XrmGetResource(x_db, option, "Xtrs.Sampleinterval", &type, &value)) {
+      trs_prof_sample_interval = strtol(value.addr, NULL, 0);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".tracebuffer");
+  if (XrmGetResource(x_db, option, "Xtrs.Tracebuffer", &type, &value)) {
+      trs_trace_size = strtol(value.addr, NULL, 0);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".tracefile");
+  if (XrmGetResource(x_db, option, "Xtrs.Tracefile", &type, &value)) {
+      trs_trace_file = strdup(value.addr);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".tracestream");
+  if (XrmGetResource(x_db, option, "Xtrs.Tracestream", &type, &value)) {
+      trs_trace_stream_file = strdup(value.addr);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".tracelimit");
+  if (XrmGetResource(x_db, option, "Xtrs.Tracelimit", &type, &value)) {
+      trs_trace_stream_limit = strtol(value.addr, NULL, 0);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".traceio");
+  if (XrmGetResource(x_db, option, "Xtrs.Traceio", &type, &value)) {
+    if (strcmp(value.addr,"on") == 0) {
+      trs_trace_stream_io = True;
+    } else if (strcmp(value.addr,"off") == 0) {
+      trs_trace_stream_io = False;
+    }
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".coverage");
+  if (XrmGetResource(x_db, option, "Xtrs.Coverage", &type, &value)) {
+      trs_cover_file = strdup(value.addr);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".coverbranches");
+  if (XrmGetResource(x_db, option, "Xtrs.Coverbranches", &type, &value)) {
+    if (strcmp(value.addr,"on") == 0) {
+      trs_cover_branches = True;
+    } else if (strcmp(value.addr,"off") == 0) {
+      trs_cover_branches = False;
+    }
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".heatmap");
+  if (XrmGetResource(x_db, option, "Xtrs.Heatmap", &type, &value)) {
+      trs_heat_file = strdup(value.addr);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".metrics");
+  if (XrmGetResource(x_db, option, "Xtrs.Metrics", &type, &value)) {
+      trs_metrics_file = strdup(value.addr);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".metricsinterval");
+  if (XrmGetResource(x_db, option, "Xtrs.Metricsinterval", &type, &value)) {
+      trs_metrics_interval = strtol(value.addr, NULL, 0);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".overlay");
+  if (XrmGetResource(x_db, option, "Xtrs.Overlay", &type, &value)) {
+    if (strcmp(value.addr,"on") == 0) {
+      trs_metrics_overlay = True;
+    } else if (strcmp(value.addr,"off") == 0) {
+      trs_metrics_overlay = False;
+    }
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".diskmmap");
+  if (XrmGetResource(x_db, option, "Xtrs.Diskmmap", &type, &value)) {
+    if (strcmp(value.addr,"on") == 0) {
+      trs_disk_mmap = True;
+    } else if (strcmp(value.addr,"off") == 0) {
+      trs_disk_mmap = False;
+    }
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".diskmsync");
+  if (XrmGetResource(x_db, option, "Xtrs.Diskmsync", &type, &value)) {
+    if (strcmp(value.addr,"none") == 0) {
+      trs_disk_msync = TRSDISK_MSYNC_NONE;
+    } else if (strcmp(value.addr,"async") == 0) {
+      trs_disk_msync = TRSDISK_MSYNC_ASYNC;
+    } else if (strcmp(value.addr,"sync") == 0) {
+      trs_disk_msync = TRSDISK_MSYNC_SYNC;
+    } else {
+      fatal("unrecognized msync policy %s", value.addr);
+    }
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".diskram");
+  if (XrmGetResource(x_db, option, "Xtrs.Diskram", &type, &value)) {
+    if (strcmp(value.addr,"on") == 0) {
+      trs_disk_ram = True;
+    } else if (strcmp(value.addr,"off") == 0) {
+      trs_disk_ram = False;
+    }
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".diskraminterval");
+  if (XrmGetResource(x_db, option, "Xtrs.Diskraminterval", &type, &value)) {
+      trs_disk_ram_interval = strtol(value.addr, NULL, 0);
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".hardsync");
+  if (XrmGetResource(x_db, option, "Xtrs.Hardsync", &type, &value)) {
+    if (strcmp(value.addr,"none") == 0) {
+      trs_hard_sync = TRS_HARD_SYNC_NONE;
+    } else if (strcmp(value.addr,"data") == 0) {
+      trs_hard_sync = TRS_HARD_SYNC_DATA;
+    } else if (strcmp(value.addr,"full") == 0) {
+      trs_hard_sync = TRS_HARD_SYNC_FULL;
+    } else {
+      fatal("unrecognized hard disk sync policy %s", value.addr);
+    }
+  }
+
+  (void) sprintf(option, "%s%s", program_name, ".diskoverlay");
+  if (XrmGetResource(x_db, option, "Xtrs.Diskoverlay", &type, &value)) {
+    trs_disk_overlay = strdup(value.addr);
+  }
+
   return argc;
 }
 
@@ -606,7 +809,7 @@ void trs_show_help()
 {
   XWindowAttributes parent_attrs;
   unsigned int const help_width = 495;
-  unsigned int const help_height = 365;
+  unsigned int const help_height = 380;
   unsigned int help_xpos, help_ypos;
   unsigned long foreground, background;
   GC help_gc;
@@ -627,6 +830,7 @@ void trs_show_help()
     "F8: exit emulator",
     "F9: enter zbx debugger",
     "F10: TRS-80 reset button",
+    "F12: toggle performance overlay",
     "",
     "LeftArrow, Backspace, Delete: TRS-80 left arrow key",
     "RightArrow, Tab: TRS-80 right arrow key",
@@ -901,13 +1105,21 @@ void trs_screen_init()
     OrigHeight = cur_char_height * col_chars + 2 * border_width;
     top_margin = border_width;
   }
+  overlay_font = XLoadQueryFont(display, overlay_font_name);
+  if (overlay_font != NULL) {
+    overlay_gc = XCreateGC(display, root_window, GCGraphicsExposures, &gcvals);
+    XSetForeground(display, overlay_gc, fore_pixel);
+    XSetBackground(display, overlay_gc, back_pixel);
+    XSetFont(display, overlay_gc, overlay_font->fid);
+  }
+  overlay_set_height();
   window = XCreateSimpleWindow(display, root_window, 400, 400,
-			       OrigWidth, OrigHeight, 1, foreground,
-			       background);
+			       OrigWidth, OrigHeight + overlay_height, 1,
+			       foreground, background);
 #if XDEBUG
     debug("XCreateSimpleWindow(%d, %d)\n", OrigWidth, OrigHeight);
 #endif /*XDEBUG*/
-  trs_fix_size(window, OrigWidth, OrigHeight);
+  trs_fix_size(window, OrigWidth, OrigHeight + overlay_height);
   XStoreName(display,window,title);
   XSelectInput(display, window, EVENT_MASK);
 
@@ -926,6 +1138,91 @@ void trs_screen_init()
   XClearWindow(display,window);
 }
 
+/*
+ * Performance overlay: a status line below the emulated screen with
+ * the speed, host CPU use, speed-control delay, and an activity light
+ * for each disk drive.  It is redrawn with new rates by
+ * trs_screen_overlay and toggled with F12.
+ */
+
+static void overlay_set_height()
+{
+  if (trs_metrics_overlay && overlay_font == NULL) {
+    error("cannot show overlay; cannot open font \"%s\"", overlay_font_name);
+    trs_metrics_set_overlay(0);
+  }
+  if (trs_metrics_overlay) {
+    overlay_height = overlay_font->ascent + overlay_font->descent + 4;
+  } else {
+    overlay_height = 0;
+  }
+}
+
+static int overlay_lights(int x, int y, int size, char *label,
+			  double *sectors, int n)
+{
+  int i;
+
+  XDrawString(display, window, overlay_gc, x, y, label, strlen(label));
+  x += XTextWidth(overlay_font, label, strlen(label)) + 2;
+  for (i = 0; i < n; i++) {
+    if (overlay_valid && sectors[i] > 0) {
+      XFillRectangle(display, window, overlay_gc, x, y - size, size, size);
+    } else {
+      XDrawRectangle(display, window, overlay_gc, x, y - size,
+		     size - 1, size - 1);
+    }
+    x += size + 2;
+  }
+  return x;
+}
+
+static void overlay_draw()
+{
+  char buf[80];
+  int x, y, size;
+
+  if (overlay_height == 0) return;
+  XFillRectangle(display, window, gc_inv, 0, OrigHeight,
+		 OrigWidth, overlay_height);
+  XDrawLine(display, window, overlay_gc, 0, OrigHeight,
+	    OrigWidth, OrigHeight);
+  if (overlay_valid) {
+    snprintf(buf, sizeof(buf), "speed %3.0f%%  cpu %3.0f%%  delay %d",
+	     overlay_rates.speed * 100, overlay_rates.host_cpu * 100,
+	     overlay_rates.delay);
+  } else {
+    snprintf(buf, sizeof(buf), "speed   --  cpu   --  delay %d",
+	     z80_state.delay);
+  }
+  x = border_width + 2;
+  y = OrigHeight + 2 + overlay_font->ascent;
+  XDrawString(display, window, overlay_gc, x, y, buf, strlen(buf));
+  x += XTextWidth(overlay_font, buf, strlen(buf)) + overlay_font->ascent;
+  size = overlay_font->ascent - 2;
+  x = overlay_lights(x, y, size, "fd", overlay_rates.floppy_sectors,
+		     METRICS_FLOPPIES);
+  overlay_lights(x + size, y, size, "hd", overlay_rates.hard_sectors,
+		 METRICS_HARDS);
+}
+
+static void overlay_toggle()
+{
+  trs_metrics_set_overlay(!trs_metrics_overlay);
+  overlay_set_height();
+  overlay_valid = 0;
+  trs_fix_size(window, OrigWidth, OrigHeight + overlay_height);
+  XResizeWindow(display, window, OrigWidth, OrigHeight + overlay_height);
+  overlay_draw();
+}
+
+void trs_screen_overlay(const trs_metrics_rates *r)
+{
+  overlay_rates = *r;
+  overlay_valid = 1;
+  overlay_draw();
+}
+
 KeySym last_key[256];
 
 /*
@@ -975,7 +1272,9 @@ void trs_get_event(int wait)
   }
 
   if (wait) {
+    trs_metrics_idle_begin();
     pause();
+    trs_metrics_idle_end();
     trs_paused = 1;
   }
 
@@ -1072,7 +1371,12 @@ void trs_get_event(int wait)
 	trs_skip_next_kbwait();
 	break;
       case XK_F7:
-	trs_change_all();
+	trs_change_all(1);
+	key = 0;
+	trs_skip_next_kbwait();
+	break;
+      case XK_F12:
+	overlay_toggle();
 	key = 0;
 	trs_skip_next_kbwait();
 	break;
@@ -1184,8 +1488,8 @@ void trs_screen_640x240(int flag)
     OrigHeight = cur_char_height * col_chars + 2 * border_width;
     left_margin = border_width;
     top_margin = border_width;
-    trs_fix_size(window, OrigWidth, OrigHeight);
-    XResizeWindow(display, window, OrigWidth, OrigHeight);
+    trs_fix_size(window, OrigWidth, OrigHeight + overlay_height);
+    XResizeWindow(display, window, OrigWidth, OrigHeight + overlay_height);
     XClearWindow(display,window);
     XFlush(display);
 #if XDEBUG
@@ -1372,6 +1676,7 @@ void trs_screen_refresh()
 {
   int i, srcx, srcy, dunx, duny;
 
+  trs_metrics.screen_updates++;
 #if XDEBUG
   debug("trs_screen_refresh\n");
 #endif
@@ -1412,6 +1717,7 @@ void trs_screen_refresh()
       trs_screen_write_char(i, trs_screen[i]);
     }
   }
+  overlay_draw();
 }
 
 void trs_screen_write_char(int position, int char_index)
@@ -1420,6 +1726,7 @@ void trs_screen_write_char(int position, int char_index)
   int plane;
   char temp_char;
 
+  trs_metrics.screen_updates++;
   trs_screen[position] = char_index;
   if (position >= screen_chars) {
     return;
@@ -1538,6 +1845,7 @@ void trs_screen_scroll()
 {
   int i = 0;
 
+  trs_metrics.screen_updates++;
   for (i = row_chars; i < screen_chars; i++)
     trs_screen[i-row_chars] = trs_screen[i];
 
@@ -32,6 +32,9 @@ extern void emt_4misc(/* int func, int *hl, int *bc, int *de */);
 extern int emt_ftruncate(/* int fd, long length */);
 extern int /*emt_opendisk*/ emt_dkopen(/* char *fname, int oflag, int mode */);
 extern int /*emt_closedisk*/ emt_dkclose(/* int fd */);
+extern int /*emt_aio_submit*/ emt_asubmit(/* char *cb */);
+extern int /*emt_aio_poll*/ emt_apoll(/* int id, int *count */);
+extern int /*emt_aio_wait*/ emt_await(/* int id, int *count */);
 
 /* oflag values for emt_open and emt_opendisk */
 #define EO_ACCMODE   03
@@ -43,6 +46,12 @@ extern int /*emt_closedisk*/ emt_dkclose(/* int fd */);
 #define EO_TRUNC  01000
 #define EO_APPEND 02000
 
+/* operations in an emt_asubmit control block */
+#define EMT_AIO_READ  0
+#define EMT_AIO_WRITE 1
+#define EMT_AIO_FSYNC 2
+#define EMT_AIO_ANY   (-1)  /* id for emt_apoll and emt_await */
+
 /* local values for emt_time */
 #define EMT_TIME_GMT 0
 #define EMT_TIME_LOCAL 1
@@ -70,3 +79,7 @@ extern int /*emt_closedisk*/ emt_dkclose(/* int fd */);
 #define EMT_MISC_SET_VOLUME       19
 #define EMT_MISC_QUERY_TRUEDAM    20
 #define EMT_MISC_SET_TRUEDAM      21
+#define EMT_MISC_PROF_REGION      22
+#define EMT_MISC_PROF_NOREGION    23
+#define EMT_MISC_QUERY_FASTDISK   24
+#define EMT_MISC_SET_FASTDISK     25
@@ -43,6 +43,12 @@
 #include "z80.h"
 #include "trs.h"
 #include "trs_imp_exp.h"
+#include "trs_profile.h"
+#include "trs_trace.h"
+#include "trs_cover.h"
+#include "trs_heat.h"
+#include "trs_metrics.h"
+#include "dis.h"
 #include <stdlib.h>  /* for rand() */
 #include <time.h>    /* for time() */
 
@@ -59,6 +65,32 @@
  */
 struct z80_state_struct z80_state;
 
+Uchar *z80_exec_traps = NULL;
+
+/*
+ * Hooks for the call-graph profiler (trs_profile.c).  Called after
+ * the instruction has updated PC, SP, and the T-state counter.
+ */
+#define PROF_CALL(kind) \
+    do { if (trs_prof_calls) trs_prof_call(kind); } while (0)
+#define PROF_RET() \
+    do { if (trs_prof_calls) trs_prof_ret(); } while (0)
+
+/*
+ * Opcode mix statistics, compiled in with -DOPSTATS.  One counter per
+ * opcode, indexed by the opcode ids of dis.h: the unprefixed opcode,
+ * or 256 + 256 * table + opcode, where the tables are CB, DD, ED, FD,
+ * DDCB, and FDCB in that order.  The prefix bytes themselves are also
+ * counted, but not reported.
+ */
+#ifdef OPSTATS
+static unsigned long opstats[DIS_NIDS];
+#define OPSTAT(table, op) \
+    (opstats[(table) < 0 ? (op) : 256 * (table) + 256 + (op)]++)
+#else
+#define OPSTAT(table, op)
+#endif
+
 /*
  * Tables and routines for computing various flag values:
  */
@@ -1147,9 +1179,55 @@ static void do_ind()
     T_COUNT(15);
 }
 
+/*
+ * Move as much of a block I/O instruction's transfer as the port
+ * allows in one call, updating HL and B and counting T-states as the
+ * instruction's own loop would, and return the number moved.  The
+ * caller then moves any remaining bytes one at a time.
+ */
+static int block_in(int direction)
+{
+    Uchar buf[256];
+    int n, i;
+
+    n = z80_block_limit(REG_C, 0);
+    if(n == 0) return 0;
+    if(n > (REG_B == 0 ? 256 : REG_B))
+      n = (REG_B == 0 ? 256 : REG_B);
+    z80_in_block(REG_C, buf, n);
+    for(i = 0; i < n; i++)
+    {
+	mem_write(REG_HL, buf[i]);
+	REG_HL += direction;
+    }
+    REG_B -= n;
+    T_COUNT(20 * n);
+    return n;
+}
+
+static int block_out(int direction)
+{
+    Uchar buf[256];
+    int n, i;
+
+    n = z80_block_limit(REG_C, 1);
+    if(n == 0) return 0;
+    if(n > (REG_B == 0 ? 256 : REG_B))
+      n = (REG_B == 0 ? 256 : REG_B);
+    for(i = 0; i < n; i++)
+    {
+	buf[i] = mem_read(REG_HL);
+	REG_HL += direction;
+    }
+    z80_out_block(REG_C, buf, n);
+    REG_B -= n;
+    T_COUNT(20 * n);
+    return n;
+}
+
 static void do_indr()
 {
-    do
+    if(block_in(-1) == 0 || REG_B != 0) do
     {
 	mem_write(REG_HL, z80_in(REG_C));
 	REG_HL--;
@@ -1179,7 +1257,7 @@ static void do_ini()
 
 static void do_inir()
 {
-    do
+    if(block_in(1) == 0 || REG_B != 0) do
     {
 	mem_write(REG_HL, z80_in(REG_C));
 	REG_HL++;
@@ -1239,7 +1317,7 @@ static void do_outd()
 
 static void do_outdr()
 {
-    do
+    if(block_out(-1) == 0 || REG_B != 0) do
     {
 	z80_out(REG_C, mem_read(REG_HL));
 	REG_HL--;
@@ -1269,7 +1347,7 @@ static void do_outi()
 
 static void do_outir()
 {
-    do
+    if(block_out(1) == 0 || REG_B != 0) do
     {
 	z80_out(REG_C, mem_read(REG_HL));
 	REG_HL++;
@@ -1325,6 +1403,7 @@ static void do_int()
       break;
     case 1:
       REG_PC = 0x38;
+      PROF_CALL(PROF_KIND_INT);
       break;
     case 2:
       /* REG_PC = REG_I << 8 + get_irq_vector(); */
@@ -1340,6 +1419,7 @@ static void do_nmi()
     mem_write_word(REG_SP, REG_PC);
     z80_state.iff1 = 0;
     REG_PC = 0x66;
+    PROF_CALL(PROF_KIND_NMI);
 }
 
 /*
@@ -1350,6 +1430,7 @@ static void do_CB_instruction()
     Uchar instruction;
     
     instruction = mem_read(REG_PC++);
+    OPSTAT(0, instruction);
     
     switch(instruction)
     {
@@ -2150,6 +2231,7 @@ static void do_indexed_instruction(Ushort *ixp)
     Uchar instruction;
     
     instruction = mem_read(REG_PC++);
+    OPSTAT(ixp == &REG_IX ? 1 : 3, instruction);
     
     switch(instruction)
     {
@@ -2363,6 +2445,7 @@ static void do_indexed_instruction(Ushort *ixp)
 
 	  offset = (signed char) mem_read(REG_PC++);
 	  sub_instruction = mem_read(REG_PC++);
+	  OPSTAT(ixp == &REG_IX ? 4 : 5, sub_instruction);
 
 	  /* Instructions with (sub_instruction & 7) != 6 are undocumented;
 	     their extra effect is handled after this switch */
@@ -2637,6 +2720,7 @@ static int do_ED_instruction()
     int debug = 0;
     
     instruction = mem_read(REG_PC++);
+    OPSTAT(2, instruction);
     
     switch(instruction)
     {
@@ -2853,6 +2937,7 @@ static int do_ED_instruction()
 	REG_PC = mem_read_word(REG_SP);
 	REG_SP += 2;
 	T_COUNT(14);
+	PROF_RET();
 	break;
 
       case 0x45:	/* retn */
@@ -2860,6 +2945,7 @@ static int do_ED_instruction()
 	REG_SP += 2;
 	z80_state.iff1 = z80_state.iff2;  /* restore the iff state */
 	T_COUNT(14);
+	PROF_RET();
 	break;
 
       case 0x55:	/* ret [undocumented] */
@@ -2871,6 +2957,7 @@ static int do_ED_instruction()
 	REG_PC = mem_read_word(REG_SP);
 	REG_SP += 2;
 	T_COUNT(14);
+	PROF_RET();
 	break;
 
       case 0x6F:	/* rld */
@@ -2913,6 +3000,15 @@ static int do_ED_instruction()
       case 0x2b:        /* emt_setddir */
 	do_emt_setddir();
 	break;
+      case 0x2c:        /* emt_aio_submit */
+	do_emt_aio_submit();
+	break;
+      case 0x2d:        /* emt_aio_poll */
+	do_emt_aio_poll();
+	break;
+      case 0x2e:        /* emt_aio_wait */
+	do_emt_aio_wait();
+	break;
       case 0x2f:        /* emt_debug */
 	if (trs_continuous > 0) trs_continuous = 0;
 	debug = 1;
@@ -3000,6 +3096,7 @@ int z80_run(int continuous)
 	if (x_poll_count <= 0) {
 	    x_poll_count = X_POLL_INTERVAL;
 	    trs_get_event(FALSE);
+	    if (trs_metrics_file || trs_metrics_overlay) trs_metrics_poll();
 	} else {
 	    x_poll_count--;
 	}
@@ -3008,7 +3105,15 @@ int z80_run(int continuous)
 	  while (--i) dummy = i;
 	}
 
+	z80_state.instr_pc = REG_PC;
+	if (trs_trace_on) trs_trace_record();
+	if (trs_cover_map) {
+	    COVER_EXEC(REG_PC);
+	    if (trs_cover_branches) trs_cover_branch();
+	}
+	if (trs_heat_on) HEAT_FETCH(REG_PC);
 	instruction = mem_read(REG_PC++);
+	OPSTAT(-1, instruction);
 	
 	switch(instruction)
 	{
@@ -3128,6 +3233,7 @@ int z80_run(int continuous)
 	    mem_write_word(REG_SP, REG_PC + 2);
 	    REG_PC = address;
 	    T_COUNT(17);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	    
 	  case 0xC4:	/* call nz, address */
@@ -3138,6 +3244,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -3153,6 +3260,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -3168,6 +3276,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -3183,6 +3292,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -3198,6 +3308,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -3213,6 +3324,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -3228,6 +3340,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -3243,6 +3356,7 @@ int z80_run(int continuous)
 		mem_write_word(REG_SP, REG_PC + 2);
 		REG_PC = address;
 		T_COUNT(17);
+		PROF_CALL(PROF_KIND_CALL);
 	    }
 	    else
 	    {
@@ -4042,6 +4156,7 @@ int z80_run(int continuous)
 	    REG_PC = mem_read_word(REG_SP);
 	    REG_SP += 2;
 	    T_COUNT(10);
+	    PROF_RET();
 	    break;
 	    
 	  case 0xC0:	/* ret nz */
@@ -4050,6 +4165,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4060,6 +4176,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4070,6 +4187,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4080,6 +4198,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4090,6 +4209,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4100,6 +4220,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4110,6 +4231,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4120,6 +4242,7 @@ int z80_run(int continuous)
 		REG_PC = mem_read_word(REG_SP);
 		REG_SP += 2;
 		T_COUNT(11);
+		PROF_RET();
             } else {
 	        T_COUNT(5);
 	    }
@@ -4150,48 +4273,56 @@ int z80_run(int continuous)
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x00;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	  case 0xCF:	/* rst 08h */
 	    REG_SP -= 2;
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x08;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	  case 0xD7:	/* rst 10h */
 	    REG_SP -= 2;
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x10;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	  case 0xDF:	/* rst 18h */
 	    REG_SP -= 2;
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x18;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	  case 0xE7:	/* rst 20h */
 	    REG_SP -= 2;
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x20;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	  case 0xEF:	/* rst 28h */
 	    REG_SP -= 2;
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x28;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	  case 0xF7:	/* rst 30h */
 	    REG_SP -= 2;
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x30;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	  case 0xFF:	/* rst 38h */
 	    REG_SP -= 2;
 	    mem_write_word(REG_SP, REG_PC);
 	    REG_PC = 0x38;
 	    T_COUNT(11);
+	    PROF_CALL(PROF_KIND_CALL);
 	    break;
 	    
 	  case 0x37:	/* scf */
@@ -4297,6 +4428,10 @@ int z80_run(int continuous)
 	  /* Subtraction wrapped; time for event to happen */
 	  trs_do_event();	    
 	}
+	if (z80_state.sample_sched &&
+	    (z80_state.sample_sched - z80_state.t_count > TSTATE_T_MID)) {
+	  trs_prof_sample();
+	}
 
 	/* Check for an interrupt */
 	if (trs_continuous >= 0)
@@ -4326,6 +4461,12 @@ int z80_run(int continuous)
 	        do_int();
 	    }
 	}
+
+	/* Return to the debugger if we have reached a trap */
+	if (z80_exec_traps &&
+	    (z80_exec_traps[REG_PC >> 3] & (1 << (REG_PC & 7)))) {
+	    if (trs_continuous > 0) trs_continuous = 0;
+	}
     } while (trs_continuous > 0);
     return ret;
 }
@@ -4345,3 +4486,60 @@ void z80_reset()
     srand(time(NULL));  /* Seed the RNG, for reading the refresh register */
 }
 
+#ifdef OPSTATS
+static int opstats_cmp(const void *a, const void *b)
+{
+    unsigned long x = opstats[*(const int *) a], y = opstats[*(const int *) b];
+    if (x != y) return x < y ? 1 : -1;
+    return *(const int *) a - *(const int *) b;
+}
+
+/* Write the opcode histogram, most frequent first */
+void z80_opstats_dump(FILE *f)
+{
+    static int order[DIS_NIDS];
+    unsigned long total = 0;
+    char name[40];
+    int i, id;
+
+    for (i = 0; i < DIS_NIDS; i++) {
+	order[i] = i;
+	if (dis_name(i, name, sizeof(name)) >= 0) total += opstats[i];
+    }
+    qsort(order, DIS_NIDS, sizeof(int), opstats_cmp);
+    fprintf(f, "# xtrs opcode mix: %lu instructions\n", total);
+    fprintf(f, "# count percent opcode instruction\n");
+    for (i = 0; i < DIS_NIDS; i++) {
+	id = order[i];
+	if (opstats[id] == 0) break;
+	if (dis_name(id, name, sizeof(name)) < 0) continue;
+	fprintf(f, "%lu %.3f ", opstats[id], 100.0 * opstats[id] / total);
+	if (id < 256) {
+	    fprintf(f, "%02x", id);
+	} else {
+	    static const char *prefix[] = {
+		"cb", "dd", "ed", "fd", "ddcb", "fdcb"
+	    };
+	    fprintf(f, "%s%02x", prefix[id / 256 - 1], id % 256);
+	}
+	fprintf(f, " %s\n", name);
+    }
+}
+
+static void opstats_exit(void)
+{
+    FILE *f = fopen(OPSTATS_FILE, "w");
+
+    if (f == NULL) {
+	error("could not write opcode statistics %s", OPSTATS_FILE);
+	return;
+    }
+    z80_opstats_dump(f);
+    fclose(f);
+}
+
+void z80_opstats_init(void)
+{
+    atexit(opstats_exit);
+}
+#endif /* OPSTATS */
@@ -127,6 +127,15 @@ struct z80_state_struct
     /* Simple event scheduler.  If nonzero, when t_count passes sched,
      * trs_do_event() is called and sched is set to zero. */
     tstate_t sched;
+
+    /* Second deadline of the same kind, reserved for the sampling
+     * profiler.  If nonzero, when t_count passes sample_sched,
+     * trs_prof_sample() is called; it sets the next deadline. */
+    tstate_t sample_sched;
+
+    /* Address of the instruction now executing; REG_PC has usually
+     * moved past it by the time it touches memory or I/O. */
+    Ushort instr_pc;
 };
 
 #define Z80_ADDRESS_LIMIT	(1 << 16)
@@ -224,7 +233,30 @@ struct z80_state_struct
 
 extern struct z80_state_struct z80_state;
 
+/* Bitmap of addresses with debugger traps, one bit per address, or
+ * NULL if none.  z80_run stops running continuously when PC reaches
+ * an address whose bit is set. */
+extern Uchar *z80_exec_traps;
+
+/* Debugger watchpoint bitmaps, one bit per address or port, or NULL
+ * if there are no watchpoints of the given kind.  The memory and I/O
+ * access paths test them and call the matching debug_watch_ routine
+ * on a hit, so watchpoints cost nothing per instruction. */
+extern Uchar *mem_watch_reads, *mem_watch_writes;
+extern Uchar *io_watch_ins, *io_watch_outs;
+#define WATCHED(map, a) ((map)[((a) >> 3)] & (1 << ((a) & 7)))
+extern void debug_watch_mem(int address, int value, int writing);
+extern void debug_watch_block(int address, int count, int writing);
+extern void debug_watch_io(int port, int value, int output);
+
 extern void z80_reset(void);
+#ifdef OPSTATS
+#ifndef OPSTATS_FILE
+#define OPSTATS_FILE "xtrs.opstats"
+#endif
+extern void z80_opstats_init(void);
+extern void z80_opstats_dump(FILE *f);
+#endif
 extern int z80_run(int continuous);
 extern void mem_init(void);
 extern int mem_read(int address);
@@ -241,6 +273,9 @@ extern void error(const char *fmt, ...);
 extern void fatal(const char *fmt, ...);
 extern void z80_out(int port, int value);
 extern int z80_in(int port);
+extern int z80_block_limit(int port, int writing);
+extern void z80_in_block(int port, Uchar *buf, int n);
+extern void z80_out_block(int port, const Uchar *buf, int n);
 extern int disassemble(unsigned short pc);
 extern void debug_init(void);
 extern void debug_shell(void);